@@ -0,0 +1,289 @@
+/**
+    CompressedHistory.h
+
+    Long-window store of positioned density samples {time, position, density}, compressed in
+    fixed-size blocks, for trend queries over windows well beyond the live buffers (30-60 s at
+    tens of kHz in a few MB).
+
+    Features:
+    - BLOCK_SAMPLES samples per block; the newest, still open block is kept uncompressed
+    - Timestamps delta-encoded off the block's own sample period (first timestamp plus
+      i * period), leaving only the zigzagged jitter residual to store
+    - Positions and densities stored as offsets from the block minimum, bit-packed to the width
+      the block actually needs (a 12-bit density scale never takes more than 12 bits)
+    - Per-block summary: time bounds, position bounds, density min / max / sum / count
+    - Queries skip blocks outside the position range on the summary alone, decode only the
+      densities of blocks inside it, and fully decode only blocks straddling a bound, whose
+      filter pass runs on the SIMD kernels (DensityKernels.h)
+    - Sealed blocks reuse the word arrays of evicted ones: no allocation in steady state
+
+    Not thread-safe; the owner serializes append, trim and queries.
+*/
+
+#ifndef COMPRESSED_HISTORY_H
+#define COMPRESSED_HISTORY_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "DensityKernels.h"
+
+// Summary of one history block, precomputed when the block is sealed
+struct HistoryBlockSummary {
+    int64_t min_time_us, max_time_us;
+    int min_pos_mm, max_pos_mm;
+    int min_density, max_density;
+    int64_t sum;
+    int count;
+};
+
+class CompressedHistory {
+public:
+    static constexpr std::size_t BLOCK_SAMPLES = 256;
+
+    /**
+        @param window_us - How long samples are kept, measured back from the newest appended one
+    */
+    explicit CompressedHistory(int64_t window_us) : window_us(window_us) {}
+
+    // Adds one sample; samples come roughly in time order (residual jitter is fine)
+    void append(int64_t time_us, int position_mm, int density) {
+        open_times[open_count] = time_us;
+        open_positions[open_count] = position_mm;
+        open_densities[open_count] = density;
+        if (++open_count == BLOCK_SAMPLES) seal_open_block();
+        newest_us = std::max(newest_us, time_us);
+        evict_old_blocks();
+    }
+
+    /**
+        Appends the matching densities of every retained sample with time >= cutoff_us and
+        position in [min_pos_mm, max_pos_mm] to out, starting at out[used] (out grows as needed).
+        @param cutoff_us - Oldest timestamp to include, e.g. newest_time() - window
+        @return Sum, count and minimum of the appended densities
+    */
+    DensityAccumulator collect(int min_pos_mm, int max_pos_mm, int64_t cutoff_us, std::vector<int>& out) const {
+        DensityAccumulator total{0, 0, INT_MAX};
+        int positions[BLOCK_SAMPLES], densities[BLOCK_SAMPLES];
+        int64_t times[BLOCK_SAMPLES];
+
+        for (std::size_t b = 0; b < block_count; ++b) {
+            const Block& block = ring[(first_block + b) % ring.size()];
+            const HistoryBlockSummary& s = block.summary;
+            if (s.max_time_us < cutoff_us || s.max_pos_mm < min_pos_mm || s.min_pos_mm > max_pos_mm) continue;
+
+            reserve(out, total.count);
+            if (s.min_time_us >= cutoff_us && s.min_pos_mm >= min_pos_mm && s.max_pos_mm <= max_pos_mm) {
+                // Whole block matches: its summary has the reductions, only the values are decoded
+                unpack_offsets(block.words.data() + block.density_word, s.count, block.density_bits, block.density_base,
+                               out.data() + total.count);
+                merge(total, DensityAccumulator{s.sum, s.count, s.min_density});
+                continue;
+            }
+
+            unpack_offsets(block.words.data() + block.position_word, s.count, block.position_bits, block.position_base, positions);
+            unpack_offsets(block.words.data() + block.density_word, s.count, block.density_bits, block.density_base, densities);
+            std::size_t n = static_cast<std::size_t>(s.count);
+            if (s.min_time_us < cutoff_us) {
+                unpack_times(block, times);
+                n = drop_older(times, positions, densities, n, cutoff_us);
+            }
+            merge(total, filter_reduce_densities(positions, densities, n, min_pos_mm, max_pos_mm, out.data() + total.count));
+        }
+
+        if (open_count > 0) {
+            reserve(out, total.count);
+            std::copy(open_times, open_times + open_count, times);
+            std::copy(open_positions, open_positions + open_count, positions);
+            std::copy(open_densities, open_densities + open_count, densities);
+            const std::size_t n = drop_older(times, positions, densities, open_count, cutoff_us);
+            merge(total, filter_reduce_densities(positions, densities, n, min_pos_mm, max_pos_mm, out.data() + total.count));
+        }
+        return total;
+    }
+
+    // Newest appended timestamp (INT64_MIN when empty)
+    int64_t newest_time() const { return newest_us; }
+    int64_t window() const { return window_us; }
+
+    // Changes how long samples are kept; a shorter window takes effect with the next append
+    void set_window(int64_t new_window_us) { window_us = new_window_us; }
+
+    // from_us - length_us, saturated so an empty history or an extreme window cannot overflow
+    static int64_t window_start(int64_t from_us, int64_t length_us) {
+        if (length_us >= 0) return from_us < INT64_MIN + length_us ? INT64_MIN : from_us - length_us;
+        return from_us > INT64_MAX + length_us ? INT64_MAX : from_us - length_us;
+    }
+
+    std::size_t samples() const { return sealed_samples + open_count; }
+    std::size_t sealed_blocks() const { return block_count; }
+
+    // Bytes of packed sample data in the sealed blocks (excluding summaries and spare capacity)
+    std::size_t packed_bytes() const {
+        std::size_t bytes = 0;
+        for (std::size_t b = 0; b < block_count; ++b) bytes += ring[(first_block + b) % ring.size()].words.size() * sizeof(uint64_t);
+        return bytes;
+    }
+
+private:
+    struct Block {
+        HistoryBlockSummary summary;
+        int64_t first_time_us;
+        int64_t period_us;
+        int position_base, density_base;  // the block minima; stored values are offsets from them
+        uint8_t time_bits, position_bits, density_bits;
+        std::size_t position_word, density_word;  // start of each packed column in words
+        std::vector<uint64_t> words;              // times, then positions, then densities
+    };
+
+    static int bits_for(uint64_t v) { return v == 0 ? 0 : 64 - __builtin_clzll(v); }
+
+    static uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    static int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+    static std::size_t words_for(std::size_t n, int bits) { return (n * static_cast<std::size_t>(bits) + 63) / 64; }
+
+    // Writes n values of `bits` bits each, starting at a word boundary (words pre-zeroed)
+    template <typename ValueOf>
+    static void pack(uint64_t* words, std::size_t n, int bits, ValueOf value_of) {
+        if (bits == 0) return;
+        for (std::size_t i = 0; i < n; ++i) {
+            const uint64_t v = value_of(i);
+            const std::size_t bit = i * static_cast<std::size_t>(bits);
+            const unsigned shift = bit & 63;
+            words[bit >> 6] |= v << shift;
+            if (shift + static_cast<unsigned>(bits) > 64) words[(bit >> 6) + 1] |= v >> (64 - shift);
+        }
+    }
+
+    // Reads value i of a packed column
+    static uint64_t unpack(const uint64_t* words, std::size_t i, int bits) {
+        const uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+        const std::size_t bit = i * static_cast<std::size_t>(bits);
+        const unsigned shift = bit & 63;
+        uint64_t v = words[bit >> 6] >> shift;
+        if (shift + static_cast<unsigned>(bits) > 64) v |= words[(bit >> 6) + 1] << (64 - shift);
+        return v & mask;
+    }
+
+    // base + packed offset for n values; a zero-width column is n copies of base
+    static void unpack_offsets(const uint64_t* words, int n, int bits, int base, int* out) {
+        if (bits == 0) {
+            std::fill(out, out + n, base);
+            return;
+        }
+        for (int i = 0; i < n; ++i) out[i] = static_cast<int>(base + static_cast<int64_t>(unpack(words, i, bits)));
+    }
+
+    static void unpack_times(const Block& block, int64_t* out) {
+        for (int i = 0; i < block.summary.count; ++i) {
+            const int64_t residual = block.time_bits == 0 ? 0 : unzigzag(unpack(block.words.data(), i, block.time_bits));
+            out[i] = block.first_time_us + i * block.period_us + residual;
+        }
+    }
+
+    // Compacts away the samples older than cutoff_us; returns how many remain
+    static std::size_t drop_older(const int64_t* times, int* positions, int* densities, std::size_t n, int64_t cutoff_us) {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            positions[kept] = positions[i];
+            densities[kept] = densities[i];
+            kept += times[i] >= cutoff_us;
+        }
+        return kept;
+    }
+
+    static void merge(DensityAccumulator& total, const DensityAccumulator& part) {
+        total.sum += part.sum;
+        total.count += part.count;
+        total.min = std::min(total.min, part.min);
+    }
+
+    // Room for one more block's worth of output after `used` values
+    static void reserve(std::vector<int>& out, int used) {
+        if (out.size() < static_cast<std::size_t>(used) + BLOCK_SAMPLES) out.resize(static_cast<std::size_t>(used) + BLOCK_SAMPLES);
+    }
+
+    void seal_open_block() {
+        if (block_count == ring.size()) grow_ring();
+        Block& block = ring[(first_block + block_count) % ring.size()];
+        const std::size_t n = open_count;
+
+        HistoryBlockSummary& s = block.summary;
+        s = HistoryBlockSummary{INT64_MAX, INT64_MIN, INT_MAX, INT_MIN, INT_MAX, INT_MIN, 0, static_cast<int>(n)};
+        for (std::size_t i = 0; i < n; ++i) {
+            s.min_time_us = std::min(s.min_time_us, open_times[i]);
+            s.max_time_us = std::max(s.max_time_us, open_times[i]);
+            s.min_pos_mm = std::min(s.min_pos_mm, open_positions[i]);
+            s.max_pos_mm = std::max(s.max_pos_mm, open_positions[i]);
+            s.min_density = std::min(s.min_density, open_densities[i]);
+            s.max_density = std::max(s.max_density, open_densities[i]);
+            s.sum += open_densities[i];
+        }
+
+        // Nominal period of this block: first to last sample, evenly spaced
+        block.first_time_us = open_times[0];
+        block.period_us = n > 1 ? (open_times[n - 1] - open_times[0]) / static_cast<int64_t>(n - 1) : 0;
+        auto residual = [&](std::size_t i) {
+            return zigzag(open_times[i] - (block.first_time_us + static_cast<int64_t>(i) * block.period_us));
+        };
+        uint64_t widest_residual = 0;
+        for (std::size_t i = 0; i < n; ++i) widest_residual |= residual(i);
+
+        block.position_base = s.min_pos_mm;
+        block.density_base = s.min_density;
+        block.time_bits = static_cast<uint8_t>(bits_for(widest_residual));
+        block.position_bits = static_cast<uint8_t>(bits_for(static_cast<uint64_t>(int64_t(s.max_pos_mm) - s.min_pos_mm)));
+        block.density_bits = static_cast<uint8_t>(bits_for(static_cast<uint64_t>(int64_t(s.max_density) - s.min_density)));
+
+        block.position_word = words_for(n, block.time_bits);
+        block.density_word = block.position_word + words_for(n, block.position_bits);
+        block.words.assign(block.density_word + words_for(n, block.density_bits), 0);
+        pack(block.words.data(), n, block.time_bits, residual);
+        pack(block.words.data() + block.position_word, n, block.position_bits,
+             [&](std::size_t i) { return static_cast<uint64_t>(int64_t(open_positions[i]) - block.position_base); });
+        pack(block.words.data() + block.density_word, n, block.density_bits,
+             [&](std::size_t i) { return static_cast<uint64_t>(int64_t(open_densities[i]) - block.density_base); });
+
+        ++block_count;
+        sealed_samples += n;
+        open_count = 0;
+    }
+
+    // Doubles the block ring, keeping the blocks in order (their word arrays move, not copy)
+    void grow_ring() {
+        std::vector<Block> larger(std::max<std::size_t>(16, 2 * ring.size()));
+        for (std::size_t b = 0; b < block_count; ++b) larger[b] = std::move(ring[(first_block + b) % ring.size()]);
+        ring.swap(larger);
+        first_block = 0;
+    }
+
+    // Drops sealed blocks whose newest sample left the window; their word arrays stay for reuse
+    void evict_old_blocks() {
+        const int64_t cutoff_us = window_start(newest_us, window_us);
+        while (block_count > 0 && ring[first_block].summary.max_time_us < cutoff_us) {
+            sealed_samples -= static_cast<std::size_t>(ring[first_block].summary.count);
+            first_block = (first_block + 1) % ring.size();
+            --block_count;
+        }
+    }
+
+    int64_t window_us;
+    int64_t newest_us = INT64_MIN;
+
+    // Sealed blocks, oldest first: ring[(first_block + b) % ring.size()] for b < block_count
+    std::vector<Block> ring;
+    std::size_t first_block = 0;
+    std::size_t block_count = 0;
+    std::size_t sealed_samples = 0;
+
+    // Open block
+    int64_t open_times[BLOCK_SAMPLES];
+    int open_positions[BLOCK_SAMPLES];
+    int open_densities[BLOCK_SAMPLES];
+    std::size_t open_count = 0;
+};
+
+#endif // COMPRESSED_HISTORY_H
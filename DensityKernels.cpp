@@ -0,0 +1,333 @@
+/**
+    DensityKernels.cpp
+
+    Scalar and SIMD implementations of filter_reduce_densities. The x86-64 variants are compiled
+    with per-function target attributes, so the translation unit builds with default flags and
+    the fastest supported kernel is chosen at runtime with __builtin_cpu_supports.
+
+    Each kernel processes full vectors and hands the remainder to the scalar loop, so results
+    (including the order of the compacted output) are identical across instruction sets.
+    Kernels are templates over the density element type; 16-bit densities are widened to 32-bit
+    lanes on load, so everything after the load is shared.
+*/
+
+#include "DensityKernels.h"
+
+#include <array>
+#include <climits>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DENSITY_KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define DENSITY_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+template <typename DensityT>
+using KernelFn = DensityAccumulator (*)(const int*, const DensityT*, std::size_t, int, int, int*, DensityAccumulator);
+
+// Branch-free scalar tail/fallback; continues from a partially reduced accumulator
+template <typename DensityT>
+static DensityAccumulator filter_reduce_scalar(const int* positions, const DensityT* densities, std::size_t n,
+                                               int min_pos_mm, int max_pos_mm, int* out, DensityAccumulator acc) {
+    for (std::size_t i = 0; i < n; ++i) {
+        const int density = densities[i];
+        const int keep = (positions[i] >= min_pos_mm) & (positions[i] <= max_pos_mm);
+        // Unconditional store; the slot is only claimed when the sample is kept
+        out[acc.count] = density;
+        acc.count += keep;
+        acc.sum += keep ? density : 0;
+        acc.min = (keep && density < acc.min) ? density : acc.min;
+    }
+    return acc;
+}
+
+#if DENSITY_KERNELS_X86
+
+// For each 8-bit keep mask, the lane indices of the kept elements packed to the front
+static std::array<std::array<int, 8>, 256> make_compaction_table_8() {
+    std::array<std::array<int, 8>, 256> table{};
+    for (int mask = 0; mask < 256; ++mask) {
+        int k = 0;
+        for (int lane = 0; lane < 8; ++lane) {
+            if (mask & (1 << lane)) table[mask][k++] = lane;
+        }
+    }
+    return table;
+}
+
+// For each 4-bit keep mask, a pshufb control that packs the kept 32-bit lanes to the front
+static std::array<std::array<uint8_t, 16>, 16> make_compaction_table_4() {
+    std::array<std::array<uint8_t, 16>, 16> table{};
+    for (int mask = 0; mask < 16; ++mask) {
+        int k = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (mask & (1 << lane)) {
+                for (int byte = 0; byte < 4; ++byte) table[mask][k * 4 + byte] = static_cast<uint8_t>(lane * 4 + byte);
+                ++k;
+            }
+        }
+        for (; k < 4; ++k) {
+            for (int byte = 0; byte < 4; ++byte) table[mask][k * 4 + byte] = 0x80;
+        }
+    }
+    return table;
+}
+
+static const auto COMPACT_8 = make_compaction_table_8();
+static const auto COMPACT_4 = make_compaction_table_4();
+
+// Density loads widened to 32-bit lanes: 4, 8 or 16 consecutive densities
+__attribute__((target("sse4.1")))
+static inline __m128i load_densities_4(const int* d) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(d)); }
+__attribute__((target("sse4.1")))
+static inline __m128i load_densities_4(const uint16_t* d) {
+    return _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(d)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load_densities_8(const int* d) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d)); }
+__attribute__((target("avx2")))
+static inline __m256i load_densities_8(const uint16_t* d) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i load_densities_16(const int* d) { return _mm512_loadu_si512(d); }
+__attribute__((target("avx512f")))
+static inline __m512i load_densities_16(const uint16_t* d) {
+    // maskz form: the unmasked intrinsic trips GCC's maybe-uninitialized check on its passthrough
+    return _mm512_maskz_cvtepu16_epi32(0xFFFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d)));
+}
+
+// 256-bit variant for the AVX-512 kernel's widening sums (avoids 512 -> 256 extracts)
+__attribute__((target("avx512f")))
+static inline __m256i load_densities_8_avx512(const int* d) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d)); }
+__attribute__((target("avx512f")))
+static inline __m256i load_densities_8_avx512(const uint16_t* d) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d)));
+}
+
+template <typename DensityT>
+__attribute__((target("sse4.1")))
+static DensityAccumulator filter_reduce_sse41(const int* positions, const DensityT* densities, std::size_t n,
+                                              int min_pos_mm, int max_pos_mm, int* out, DensityAccumulator acc) {
+    const __m128i lo = _mm_set1_epi32(min_pos_mm);
+    const __m128i hi = _mm_set1_epi32(max_pos_mm);
+    const __m128i int_max = _mm_set1_epi32(INT_MAX);
+    __m128i vmin = int_max;
+    __m128i vsum = _mm_setzero_si128();
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(positions + i));
+        const __m128i d = load_densities_4(densities + i);
+        const __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(lo, p), _mm_cmpgt_epi32(p, hi));
+
+        // Masked sum in 64-bit lanes, masked min
+        const __m128i kept = _mm_andnot_si128(outside, d);
+        vsum = _mm_add_epi64(vsum, _mm_cvtepi32_epi64(kept));
+        vsum = _mm_add_epi64(vsum, _mm_cvtepi32_epi64(_mm_srli_si128(kept, 8)));
+        vmin = _mm_min_epi32(vmin, _mm_blendv_epi8(d, int_max, outside));
+
+        // Compaction: shuffle kept lanes to the front and store a full vector
+        const int keep = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF;
+        const __m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(COMPACT_4[keep].data()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + acc.count), _mm_shuffle_epi8(d, control));
+        acc.count += __builtin_popcount(keep);
+    }
+
+    alignas(16) int64_t sums[2];
+    alignas(16) int mins[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), vsum);
+    _mm_store_si128(reinterpret_cast<__m128i*>(mins), vmin);
+    acc.sum += sums[0] + sums[1];
+    for (int lane : mins) acc.min = lane < acc.min ? lane : acc.min;
+
+    return filter_reduce_scalar(positions + i, densities + i, n - i, min_pos_mm, max_pos_mm, out, acc);
+}
+
+template <typename DensityT>
+__attribute__((target("avx2")))
+static DensityAccumulator filter_reduce_avx2(const int* positions, const DensityT* densities, std::size_t n,
+                                             int min_pos_mm, int max_pos_mm, int* out, DensityAccumulator acc) {
+    const __m256i lo = _mm256_set1_epi32(min_pos_mm);
+    const __m256i hi = _mm256_set1_epi32(max_pos_mm);
+    const __m256i int_max = _mm256_set1_epi32(INT_MAX);
+    __m256i vmin = int_max;
+    __m256i vsum = _mm256_setzero_si256();
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(positions + i));
+        const __m256i d = load_densities_8(densities + i);
+        const __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(lo, p), _mm256_cmpgt_epi32(p, hi));
+
+        const __m256i kept = _mm256_andnot_si256(outside, d);
+        vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(kept)));
+        vsum = _mm256_add_epi64(vsum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(kept, 1)));
+        vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(d, int_max, outside));
+
+        const int keep = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xFF;
+        const __m256i permutation = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(COMPACT_8[keep].data()));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + acc.count), _mm256_permutevar8x32_epi32(d, permutation));
+        acc.count += __builtin_popcount(keep);
+    }
+
+    alignas(32) int64_t sums[4];
+    alignas(32) int mins[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), vsum);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mins), vmin);
+    acc.sum += sums[0] + sums[1] + sums[2] + sums[3];
+    for (int lane : mins) acc.min = lane < acc.min ? lane : acc.min;
+
+    return filter_reduce_scalar(positions + i, densities + i, n - i, min_pos_mm, max_pos_mm, out, acc);
+}
+
+template <typename DensityT>
+__attribute__((target("avx512f")))
+static DensityAccumulator filter_reduce_avx512(const int* positions, const DensityT* densities, std::size_t n,
+                                               int min_pos_mm, int max_pos_mm, int* out, DensityAccumulator acc) {
+    const __m512i lo = _mm512_set1_epi32(min_pos_mm);
+    const __m512i hi = _mm512_set1_epi32(max_pos_mm);
+    __m512i vmin = _mm512_set1_epi32(INT_MAX);
+    __m512i vsum = _mm512_setzero_si512();
+
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512i p = _mm512_loadu_si512(positions + i);
+        const __m512i d = load_densities_16(densities + i);
+        const __mmask16 keep = _mm512_cmpge_epi32_mask(p, lo) & _mm512_cmple_epi32_mask(p, hi);
+
+        // Masked widening of each half straight from memory, avoiding 512 -> 256 extracts
+        const __m256i d_low = load_densities_8_avx512(densities + i);
+        const __m256i d_high = load_densities_8_avx512(densities + i + 8);
+        vsum = _mm512_add_epi64(vsum, _mm512_maskz_cvtepi32_epi64(static_cast<__mmask8>(keep), d_low));
+        vsum = _mm512_add_epi64(vsum, _mm512_maskz_cvtepi32_epi64(static_cast<__mmask8>(keep >> 8), d_high));
+        vmin = _mm512_mask_min_epi32(vmin, keep, vmin, d);
+
+        // Native compaction
+        _mm512_mask_compressstoreu_epi32(out + acc.count, keep, d);
+        acc.count += __builtin_popcount(keep);
+    }
+
+    alignas(64) int64_t sums[8];
+    alignas(64) int mins[16];
+    _mm512_store_si512(sums, vsum);
+    _mm512_store_si512(mins, vmin);
+    for (int64_t lane : sums) acc.sum += lane;
+    for (int lane : mins) acc.min = lane < acc.min ? lane : acc.min;
+
+    return filter_reduce_scalar(positions + i, densities + i, n - i, min_pos_mm, max_pos_mm, out, acc);
+}
+
+#endif // DENSITY_KERNELS_X86
+
+#if DENSITY_KERNELS_NEON
+
+static inline int32x4_t load_densities_4(const int* d) { return vld1q_s32(d); }
+static inline int32x4_t load_densities_4(const uint16_t* d) { return vreinterpretq_s32_u32(vmovl_u16(vld1_u16(d))); }
+
+template <typename DensityT>
+static DensityAccumulator filter_reduce_neon(const int* positions, const DensityT* densities, std::size_t n,
+                                             int min_pos_mm, int max_pos_mm, int* out, DensityAccumulator acc) {
+    const int32x4_t lo = vdupq_n_s32(min_pos_mm);
+    const int32x4_t hi = vdupq_n_s32(max_pos_mm);
+    const int32x4_t int_max = vdupq_n_s32(INT_MAX);
+    int32x4_t vmin = int_max;
+    int64x2_t vsum = vdupq_n_s64(0);
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const int32x4_t p = vld1q_s32(positions + i);
+        const int32x4_t d = load_densities_4(densities + i);
+        const uint32x4_t keep = vandq_u32(vcgeq_s32(p, lo), vcleq_s32(p, hi));
+
+        const int32x4_t kept = vreinterpretq_s32_u32(vandq_u32(keep, vreinterpretq_u32_s32(d)));
+        vsum = vaddq_s64(vsum, vpaddlq_s32(kept));
+        vmin = vminq_s32(vmin, vbslq_s32(keep, d, int_max));
+
+        // No compress instruction: branch-free lane stores
+        uint32_t keep_lanes[4];
+        vst1q_u32(keep_lanes, keep);
+        for (int lane = 0; lane < 4; ++lane) {
+            out[acc.count] = densities[i + lane];
+            acc.count += keep_lanes[lane] & 1;
+        }
+    }
+
+    acc.sum += vaddvq_s64(vsum);
+    const int lane_min = vminvq_s32(vmin);
+    acc.min = lane_min < acc.min ? lane_min : acc.min;
+
+    return filter_reduce_scalar(positions + i, densities + i, n - i, min_pos_mm, max_pos_mm, out, acc);
+}
+
+#endif // DENSITY_KERNELS_NEON
+
+template <typename DensityT>
+static KernelFn<DensityT> kernel_for(DensityKernelIsa isa) {
+    switch (isa) {
+#if DENSITY_KERNELS_X86
+        case DensityKernelIsa::SSE41: return filter_reduce_sse41<DensityT>;
+        case DensityKernelIsa::AVX2: return filter_reduce_avx2<DensityT>;
+        case DensityKernelIsa::AVX512: return filter_reduce_avx512<DensityT>;
+#endif
+#if DENSITY_KERNELS_NEON
+        case DensityKernelIsa::NEON: return filter_reduce_neon<DensityT>;
+#endif
+        default: return filter_reduce_scalar<DensityT>;
+    }
+}
+
+bool density_kernel_supported(DensityKernelIsa isa) {
+    switch (isa) {
+        case DensityKernelIsa::Scalar: return true;
+#if DENSITY_KERNELS_X86
+        case DensityKernelIsa::SSE41: return __builtin_cpu_supports("sse4.1");
+        case DensityKernelIsa::AVX2: return __builtin_cpu_supports("avx2");
+        case DensityKernelIsa::AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+#if DENSITY_KERNELS_NEON
+        case DensityKernelIsa::NEON: return true;
+#endif
+        default: return false;
+    }
+}
+
+DensityKernelIsa active_density_kernel() {
+    // Widest first; evaluated once
+    static const DensityKernelIsa selected = [] {
+        const DensityKernelIsa preference[] = {DensityKernelIsa::AVX512, DensityKernelIsa::AVX2,
+                                               DensityKernelIsa::SSE41, DensityKernelIsa::NEON};
+        for (DensityKernelIsa isa : preference) {
+            if (density_kernel_supported(isa)) return isa;
+        }
+        return DensityKernelIsa::Scalar;
+    }();
+    return selected;
+}
+
+DensityAccumulator filter_reduce_densities(DensityKernelIsa isa, const int* positions, const int* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out) {
+    return kernel_for<int>(isa)(positions, densities, n, min_pos_mm, max_pos_mm, out, DensityAccumulator{0, 0, INT_MAX});
+}
+
+DensityAccumulator filter_reduce_densities(const int* positions, const int* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out) {
+    static const KernelFn<int> kernel = kernel_for<int>(active_density_kernel());
+    return kernel(positions, densities, n, min_pos_mm, max_pos_mm, out, DensityAccumulator{0, 0, INT_MAX});
+}
+
+DensityAccumulator filter_reduce_densities(DensityKernelIsa isa, const int* positions, const uint16_t* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out) {
+    return kernel_for<uint16_t>(isa)(positions, densities, n, min_pos_mm, max_pos_mm, out, DensityAccumulator{0, 0, INT_MAX});
+}
+
+DensityAccumulator filter_reduce_densities(const int* positions, const uint16_t* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out) {
+    static const KernelFn<uint16_t> kernel = kernel_for<uint16_t>(active_density_kernel());
+    return kernel(positions, densities, n, min_pos_mm, max_pos_mm, out, DensityAccumulator{0, 0, INT_MAX});
+}
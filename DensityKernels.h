@@ -0,0 +1,71 @@
+/**
+    DensityKernels.h
+
+    Vectorized inner loop of CalculateDensityValues: given a resolved position column and the
+    matching density column, keep the densities whose position lies in [min_pos_mm, max_pos_mm],
+    compact them into an output array, and reduce their sum, count and minimum in vector lanes.
+
+    Features:
+    - AVX-512 (compress-store), AVX2 (permute-table compaction) and SSE4.1 kernels on x86-64
+    - NEON kernel on AArch64
+    - Branch-free scalar fallback
+    - Runtime dispatch to the widest kernel the CPU supports, selected once on first use
+    - Sums accumulated in 64-bit lanes so they cannot overflow
+    - int and uint16_t density columns (16-bit densities are widened on load)
+
+    All kernels produce identical results, including the order of the compacted densities.
+*/
+
+#ifndef DENSITY_KERNELS_H
+#define DENSITY_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Result of one filter/reduce pass; min is INT_MAX when count is 0
+struct DensityAccumulator {
+    int64_t sum;
+    int count;
+    int min;
+};
+
+// Instruction-set variants of the kernel
+enum class DensityKernelIsa {
+    Scalar,
+    SSE41,
+    AVX2,
+    AVX512,
+    NEON
+};
+
+/**
+    Filters and reduces with the best kernel for this CPU.
+
+    @param positions - Interpolated position (mm) of each sample
+    @param densities - Density of each sample
+    @param n - Number of samples
+    @param min_pos_mm - Lower bound of the position range (inclusive)
+    @param max_pos_mm - Upper bound of the position range (inclusive)
+    @param out - Receives the matching densities in sample order; must have room for n values
+    @return Sum, count and minimum of the matching densities
+*/
+DensityAccumulator filter_reduce_densities(const int* positions, const int* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out);
+
+// Same as filter_reduce_densities with an explicit kernel (must be supported; see below)
+DensityAccumulator filter_reduce_densities(DensityKernelIsa isa, const int* positions, const int* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out);
+
+// 16-bit density column variants; the compacted output is still widened to int
+DensityAccumulator filter_reduce_densities(const int* positions, const uint16_t* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out);
+DensityAccumulator filter_reduce_densities(DensityKernelIsa isa, const int* positions, const uint16_t* densities, std::size_t n,
+                                           int min_pos_mm, int max_pos_mm, int* out);
+
+// Whether this build and CPU can run the given kernel
+bool density_kernel_supported(DensityKernelIsa isa);
+
+// Kernel picked by runtime dispatch
+DensityKernelIsa active_density_kernel();
+
+#endif // DENSITY_KERNELS_H
@@ -0,0 +1,189 @@
+/**
+    MappedRingFile.h
+
+    File-backed storage for one SensorDataManager's two sample rings: the timestamp and value
+    arrays and the ring indices live in a memory-mapped file with a fixed binary layout, so the
+    live window survives a process restart and can be read in place by other tools.
+
+    Features:
+    - One MAP_SHARED mapping holding a MappedRingHeader followed by the four (mirrored) ring
+      arrays, each 4096-byte aligned; the rings read and write the mapping directly, no copies
+    - Re-attach: opening a file written with the same layout adopts its contents as they are;
+      any other file is reinitialized empty (attached() tells which happened)
+    - Process crashes lose at most the samples being pushed when the process died: the pages stay
+      in the kernel's page cache and reach the file on their own, and the rings order their slot
+      and index stores so the indices never cover a half-written or overwritten slot. sync()
+      additionally forces the pages to disk for power-loss safety
+    - Layout described entirely by the header (offsets, element sizes, capacities, time base), so
+      an offline reader needs only this header definition
+
+    All fields are native-endian. Throws std::system_error if the file cannot be opened, sized or
+    mapped. One manager at a time may use a file; the file object must outlive it.
+*/
+
+#ifndef MAPPED_RING_FILE_H
+#define MAPPED_RING_FILE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SampleRing.h"
+
+// Shape of the rings a file holds; two files are compatible iff their layouts are equal
+struct MappedRingLayout {
+    uint32_t time_bytes;      // sizeof(stored timestamp): 4 or 8
+    uint32_t density_bytes;   // sizeof(stored density): 2 or 4
+    uint64_t density_capacity;
+    uint64_t position_capacity;
+    int64_t window_us;
+};
+
+/**
+    Start of every capture file. Ring 0 is the density stream, ring 1 the position stream. Ring r
+    holds capacity[r] samples in arrays of 2 * capacity[r] elements (slot s is mirrored at
+    s + capacity[r]); its live window is the indices[r].count elements starting at element
+    indices[r].head of both arrays, oldest first. Stored timestamps are microseconds relative to
+    time_base_us.
+*/
+struct MappedRingHeader {
+    char magic[8];          // "SDMRING" and a NUL
+    uint32_t version;       // MappedRingFile::VERSION
+    uint32_t header_bytes;  // offset of the first array
+    MappedRingLayout layout;
+    uint64_t times_offset[2];
+    uint64_t values_offset[2];
+    int64_t time_base_us;
+    uint32_t rebasing;      // nonzero while stored timestamps are being rewritten (contents unusable)
+    uint32_t reserved;
+    SampleRingIndices indices[2];
+};
+static_assert(std::is_standard_layout<MappedRingHeader>::value && std::is_trivially_copyable<MappedRingHeader>::value,
+              "the capture header is a raw on-disk record");
+
+class MappedRingFile {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr std::size_t DENSITY = 0;
+    static constexpr std::size_t POSITION = 1;
+
+    /**
+        Opens (or creates) the capture file and maps it.
+        @param path - File to use; created with mode 0644 if missing
+        @param layout - Shape of the manager's rings, e.g. SensorDataManager::CaptureLayout()
+    */
+    MappedRingFile(const std::string& path, const MappedRingLayout& layout) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        MappedRingHeader expected = initial_header(layout);
+        bytes = file_bytes(expected);
+
+        struct stat status;
+        if (::fstat(fd, &status) != 0) fail("fstat " + path);
+        const bool same_size = static_cast<uint64_t>(status.st_size) == bytes;
+        if (!same_size) {
+            // Drop the old contents entirely, so the new arrays start zero-filled
+            if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, static_cast<off_t>(bytes)) != 0) fail("ftruncate " + path);
+        }
+
+        void* address = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) fail("mmap " + path);
+        base = static_cast<unsigned char*>(address);
+
+        attached_existing = same_size && compatible(header(), expected);
+        if (!attached_existing) std::memcpy(base, &expected, sizeof(expected));
+    }
+
+    ~MappedRingFile() {
+        ::munmap(base, bytes);
+        ::close(fd);
+    }
+
+    MappedRingFile(const MappedRingFile&) = delete;
+    MappedRingFile& operator=(const MappedRingFile&) = delete;
+
+    // Whether the file already held a usable capture with this layout when it was opened
+    bool attached() const { return attached_existing; }
+
+    MappedRingHeader& header() { return *reinterpret_cast<MappedRingHeader*>(base); }
+    const MappedRingHeader& header() const { return *reinterpret_cast<const MappedRingHeader*>(base); }
+
+    // Start of the mapping, for readers walking the layout themselves
+    const unsigned char* data() const { return base; }
+    std::size_t size() const { return bytes; }
+
+    /**
+        Storage of ring DENSITY or POSITION, for SampleRing's external-storage constructor.
+        TimeT / ValueT must have the sizes recorded in the layout.
+    */
+    template <typename TimeT, typename ValueT>
+    SampleRingStorage<TimeT, ValueT> ring(std::size_t which) {
+        MappedRingHeader& h = header();
+        return {reinterpret_cast<TimeT*>(base + h.times_offset[which]), reinterpret_cast<ValueT*>(base + h.values_offset[which]),
+                &h.indices[which]};
+    }
+
+    // Writes every dirty page back to the file and waits for it (msync MS_SYNC)
+    void sync() {
+        if (::msync(base, bytes, MS_SYNC) != 0) throw std::system_error(errno, std::generic_category(), "msync");
+    }
+
+private:
+    static constexpr uint64_t PAGE = 4096;
+
+    static uint64_t page_align(uint64_t n) { return (n + PAGE - 1) / PAGE * PAGE; }
+
+    // Header for an empty file of this layout, with the array offsets filled in
+    static MappedRingHeader initial_header(const MappedRingLayout& layout) {
+        MappedRingHeader h{};
+        std::memcpy(h.magic, "SDMRING", 8);
+        h.version = VERSION;
+        h.header_bytes = static_cast<uint32_t>(page_align(sizeof(MappedRingHeader)));
+        h.layout = layout;
+
+        const uint64_t capacity[2] = {layout.density_capacity, layout.position_capacity};
+        const uint64_t value_bytes[2] = {layout.density_bytes, sizeof(int)};
+        uint64_t offset = h.header_bytes;
+        for (std::size_t r = 0; r < 2; ++r) {
+            h.times_offset[r] = offset;
+            offset += page_align(2 * capacity[r] * layout.time_bytes);
+            h.values_offset[r] = offset;
+            offset += page_align(2 * capacity[r] * value_bytes[r]);
+        }
+        return h;
+    }
+
+    static uint64_t file_bytes(const MappedRingHeader& h) {
+        return h.values_offset[1] + page_align(2 * h.layout.position_capacity * sizeof(int));
+    }
+
+    static bool compatible(const MappedRingHeader& found, const MappedRingHeader& expected) {
+        return std::memcmp(found.magic, expected.magic, sizeof(found.magic)) == 0 && found.version == expected.version &&
+               found.header_bytes == expected.header_bytes &&
+               std::memcmp(&found.layout, &expected.layout, sizeof(MappedRingLayout)) == 0 &&
+               std::memcmp(found.times_offset, expected.times_offset, sizeof(found.times_offset)) == 0 &&
+               std::memcmp(found.values_offset, expected.values_offset, sizeof(found.values_offset)) == 0 &&
+               found.rebasing == 0;
+    }
+
+    [[noreturn]] void fail(const std::string& what) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    int fd = -1;
+    uint64_t bytes = 0;
+    unsigned char* base = nullptr;
+    bool attached_existing = false;
+};
+
+#endif // MAPPED_RING_FILE_H
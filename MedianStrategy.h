@@ -8,7 +8,11 @@
     Features:
     - NthElement: Average-case O(n) median using std::nth_element
     - FullSort: Simpler but slower std::sort-based median
-    - HeapMedian: Online-style median using two heaps (max/min)
+    - HeapMedian: Online-style median using two heaps (max/min), see StreamingMedian.h
+    - OrderStatistic: Incrementally maintained Fenwick count tree (OrderStatisticTree.h), used by
+      SensorDataManager's registered ranges
+    - Histogram: O(n + D) counting median over a bounded integer domain [0, D), no sorting or heap.
+      D is set at compile time with -DMEDIAN_HISTOGRAM_DOMAIN=<D> (default 4096, a 12-bit scale).
 
     The strategy is intended for integration with real-time sensor data processing pipelines
     like those found in SensorDataManager.cpp.
@@ -18,19 +22,36 @@
 #define MEDIAN_STRATEGY_H
 
 #include <vector>
-#include <queue>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include "StreamingMedian.h"
+
+// Value domain [0, MEDIAN_HISTOGRAM_DOMAIN) of the Histogram algorithm; the counting array
+// (4 bytes per value) lives on the stack, so keep it to a sensor's real resolution.
+#ifndef MEDIAN_HISTOGRAM_DOMAIN
+#define MEDIAN_HISTOGRAM_DOMAIN 4096
+#endif
 
 /**
     Enum representing the supported median algorithms.
     - NthElement: Uses partial sort (efficient for large datasets)
     - FullSort: Fully sorts the data before extracting median
-    - HeapMedian: Uses two heaps for robust, real-time median tracking
+    - HeapMedian: Uses two heaps for robust, real-time median tracking. Long-lived owners
+      (SensorDataManager::RegisterDensityRange) keep a StreamingMedian across calls; a one-off
+      compute() call refills a reused per-thread instance.
+    - OrderStatistic: Median read from a count tree kept up to date as samples arrive and expire.
+      Only incremental owners (SensorDataManager::RegisterDensityRange) benefit; a one-off
+      compute() call has nothing to reuse and falls back to NthElement.
+    - Histogram: Counts values into fixed bins and walks the prefix sum; falls back to NthElement
+      when a value lies outside [0, MEDIAN_HISTOGRAM_DOMAIN)
 */
 enum class MedianAlgorithm {
     NthElement,
     FullSort,
-    HeapMedian
+    HeapMedian,
+    OrderStatistic,
+    Histogram
 };
 
 
@@ -46,13 +67,14 @@ public:
 
         @param data - Reference to the data vector (can be reordered in-place)
         @param algorithm - Algorithm type from the MedianAlgorithm enum
-        @return Integer median value (lower middle in case of even-length vector)
+        @return Integer median value (element n / 2 of the sorted data, i.e. the upper middle for even n)
     */
     static int compute(std::vector<int>& data, MedianAlgorithm algorithm) {
         int n = data.size();
         if (n == 0) return 0;
 
         switch (algorithm) {
+            case MedianAlgorithm::OrderStatistic:
             case MedianAlgorithm::NthElement:
                 // Partially sorts the vector so the nth element is in correct position
                 std::nth_element(data.begin(), data.begin() + n / 2, data.end());
@@ -64,34 +86,63 @@ public:
                 return data[n / 2];
 
             case MedianAlgorithm::HeapMedian: {
-                // Maintains two heaps:
-                // - max-heap for lower half
-                // - min-heap for upper half
-                std::priority_queue<int> lower;
-                std::priority_queue<int, std::vector<int>, std::greater<int>> upper;
-
-                for (int val : data) {
-                    if (lower.empty() || val < lower.top())
-                        lower.push(val);
-                    else
-                        upper.push(val);
-                    
-                    // Balance the heaps so their sizes differ by at most one
-                    if (lower.size() > upper.size() + 1) {
-                        upper.push(lower.top()); lower.pop();
-                    } else if (upper.size() > lower.size()) {
-                        lower.push(upper.top()); upper.pop();
-                    }
-                }
-                
-                // Return top of max-heap as the median
-                return lower.top();
+                // Two heaps (max-heap for the lower half, min-heap for the upper half). The per-thread
+                // instance keeps its heap capacity, so repeated calls stop allocating.
+                static thread_local StreamingMedian heaps;
+                heaps.clear();
+                for (int val : data) heaps.insert(val);
+
+                // Top of the lower max-heap is the median
+                return heaps.median();
             }
 
+            case MedianAlgorithm::Histogram:
+                return compute_histogram<MEDIAN_HISTOGRAM_DOMAIN>(data);
+
             default:
                 return 0;
         }
     }
+
+    /**
+        Counting median over the compile-time domain [0, Domain). In-domain data is left
+        unmodified. A first min/max pass (branch-free, vectorizable) bounds the bins that need
+        clearing and walking; data with any value outside [0, Domain) falls back to nth_element
+        and is reordered.
+
+        @param data - Values to take the median of (non-empty)
+        @return Element n / 2 of the sorted data (upper middle for even n), identical to NthElement
+    */
+    template <int Domain>
+    static int compute_histogram(std::vector<int>& data) {
+        static_assert(Domain > 0, "Histogram domain must be positive");
+        const std::size_t n = data.size();
+        if (n == 0) return 0;
+
+        int lo = data[0], hi = data[0];
+        for (int val : data) {
+            lo = std::min(lo, val);
+            hi = std::max(hi, val);
+        }
+        if (lo < 0 || hi >= Domain) {
+            std::nth_element(data.begin(), data.begin() + n / 2, data.end());
+            return data[n / 2];
+        }
+
+        // Uninitialized on purpose: only bins [lo, hi] are cleared and read
+        std::array<uint32_t, Domain> counts;
+        std::fill(counts.begin() + lo, counts.begin() + hi + 1, 0u);
+        for (int val : data) ++counts[val];
+
+        // First value whose cumulative count passes the middle index
+        const std::size_t target = n / 2;
+        std::size_t cumulative = 0;
+        for (int v = lo; v < hi; ++v) {
+            cumulative += counts[v];
+            if (cumulative > target) return v;
+        }
+        return hi;
+    }
 };
 
 #endif // MEDIAN_STRATEGY_H
\ No newline at end of file
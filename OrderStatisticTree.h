@@ -0,0 +1,109 @@
+/**
+    OrderStatisticTree.h
+
+    A Fenwick (binary indexed) tree of value counts over a bounded integer domain [0, Domain).
+    It supports insert/erase and rank queries, so the median and minimum of a changing multiset
+    of densities can be read without copying or sorting.
+
+    Features:
+    - insert / erase in O(log Domain)
+    - k-th smallest (median, min) by binary lifting in O(log Domain)
+    - count of values <= v in O(log Domain)
+    - k-th smallest of a signed sum of trees (e.g. prefix differences of a Fenwick tree of trees)
+      in O(n log Domain), without materializing the merged counts
+    - Fixed-size storage, no allocation after construction
+
+    Values outside the domain are clamped to its edges.
+*/
+
+#ifndef ORDER_STATISTIC_TREE_H
+#define ORDER_STATISTIC_TREE_H
+
+#include <array>
+
+template <int Domain>
+class OrderStatisticTree {
+    static_assert(Domain > 0, "OrderStatisticTree domain must be positive");
+
+public:
+    void insert(int value) { add(clamp(value), 1); }
+    void erase(int value) { add(clamp(value), -1); }
+
+    int size() const { return total; }
+    bool empty() const { return total == 0; }
+
+    // Number of stored values <= value
+    int count_not_above(int value) const {
+        if (value < 0) return 0;
+        int count = 0;
+        for (int i = clamp(value) + 1; i > 0; i -= i & -i) count += tree[i];
+        return count;
+    }
+
+    /**
+        Returns the k-th smallest stored value (0-based). Requires k < size().
+        Walks down the implicit tree from the highest power of two, so no prefix sums are recomputed.
+    */
+    int kth(int k) const {
+        int index = 0;
+        int remaining = k + 1;
+        for (int step = TOP_STEP; step > 0; step >>= 1) {
+            if (index + step <= Domain && tree[index + step] < remaining) {
+                index += step;
+                remaining -= tree[index];
+            }
+        }
+        // index is the number of values strictly below the answer, i.e. the answer itself
+        return index;
+    }
+
+    int min() const { return kth(0); }
+
+    // Median with the MedianStrategy::compute convention (element n / 2 of the sorted data)
+    int median() const { return kth(total / 2); }
+
+    /**
+        Returns the k-th smallest value (0-based) of the multiset whose counts are
+        sum(signs[t] * counts of trees[t]) for t in [0, n). The Fenwick arrays are linear in the counts,
+        so kth's walk works on their signed sum directly. Requires every merged count to be >= 0 and
+        k < the merged size.
+    */
+    static int kth_of_sum(const OrderStatisticTree* const* trees, const int* signs, int n, int k) {
+        int index = 0;
+        int remaining = k + 1;
+        for (int step = TOP_STEP; step > 0; step >>= 1) {
+            if (index + step > Domain) continue;
+            int below = 0;
+            for (int t = 0; t < n; ++t) below += signs[t] * trees[t]->tree[index + step];
+            if (below < remaining) {
+                index += step;
+                remaining -= below;
+            }
+        }
+        return index;
+    }
+
+    static int clamp(int value) {
+        return value < 0 ? 0 : (value >= Domain ? Domain - 1 : value);
+    }
+
+private:
+    static constexpr int highest_power_of_two(int n) {
+        int p = 1;
+        while (p * 2 <= n) p *= 2;
+        return p;
+    }
+
+    static constexpr int TOP_STEP = highest_power_of_two(Domain);
+
+    void add(int value, int delta) {
+        for (int i = value + 1; i <= Domain; i += i & -i) tree[i] += delta;
+        total += delta;
+    }
+
+    // 1-based Fenwick array; tree[0] is unused
+    std::array<int, Domain + 1> tree{};
+    int total = 0;
+};
+
+#endif // ORDER_STATISTIC_TREE_H
@@ -0,0 +1,225 @@
+/**
+    PositionIndex.h
+
+    Index of (position, value) entries keyed by 1 mm position bucket, for answering sum, count, min
+    and median of all entries in a position range without visiting them one by one.
+
+    Features:
+    - Fenwick trees of per-bucket sums and counts: sum / count of any range in O(log PositionDomain)
+    - Fenwick tree over BucketBlock-wide blocks of value-count trees (OrderStatisticTree.h): min and
+      median of the whole blocks inside a range in O(log blocks * log ValueDomain)
+    - Per-bucket entry lists threaded through the slot arrays, so the partial blocks at the two
+      range ends cost at most 2 * BucketBlock buckets, independent of the number of entries
+    - insert / erase in O(log PositionDomain + log blocks * log ValueDomain)
+    - Storage allocated at construction; only the edge-value scratch list grows, up to the largest
+      set of edge entries a query has seen
+
+    Entries are addressed by a caller-chosen slot in [0, slot_count) and must leave each bucket in
+    the order they entered it (true for samples expiring from a time window). Entries whose position
+    or value lies outside [0, PositionDomain) / [0, ValueDomain) are only counted: while any is
+    present, exact() is false and range statistics must be computed another way.
+*/
+
+#ifndef POSITION_INDEX_H
+#define POSITION_INDEX_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "OrderStatisticTree.h"
+
+template <int PositionDomain, int ValueDomain, int BucketBlock = 64>
+class PositionIndex {
+    static_assert(PositionDomain > 0 && BucketBlock > 0, "PositionIndex domain and block must be positive");
+
+public:
+    // Statistics of one range; min and median are only meaningful when count > 0
+    struct Stats {
+        int64_t sum;
+        int count;
+        int min;
+        int median;
+    };
+
+    /**
+        @param slot_count - Number of distinct slots entries are stored under
+    */
+    explicit PositionIndex(std::size_t slot_count)
+        : slot_bucket(slot_count, NONE), slot_value(slot_count, 0), slot_next(slot_count, NONE),
+          bucket_head(PositionDomain, NONE), bucket_tail(PositionDomain, NONE),
+          bucket_sums(PositionDomain + 1, 0), bucket_counts(PositionDomain + 1, 0),
+          block_trees(BLOCKS) {}
+
+    PositionIndex(const PositionIndex&) = delete;
+    PositionIndex& operator=(const PositionIndex&) = delete;
+
+    void insert(std::size_t slot, int position, int value) {
+        slot_value[slot] = value;
+        slot_next[slot] = NONE;
+        if (position < 0 || position >= PositionDomain || value < 0 || value >= ValueDomain) {
+            slot_bucket[slot] = OUTSIDE;
+            ++outside;
+            return;
+        }
+
+        slot_bucket[slot] = position;
+        if (bucket_tail[position] == NONE) bucket_head[position] = static_cast<int>(slot);
+        else slot_next[bucket_tail[position]] = static_cast<int>(slot);
+        bucket_tail[position] = static_cast<int>(slot);
+        add(position, value, 1);
+    }
+
+    // Removes the entry in slot, which must be the oldest one left in its bucket
+    void erase(std::size_t slot) {
+        const int bucket = slot_bucket[slot];
+        slot_bucket[slot] = NONE;
+        if (bucket == OUTSIDE) {
+            --outside;
+            return;
+        }
+
+        bucket_head[bucket] = slot_next[slot];
+        if (bucket_head[bucket] == NONE) bucket_tail[bucket] = NONE;
+        add(bucket, slot_value[slot], -1);
+    }
+
+    void clear() {
+        std::fill(slot_bucket.begin(), slot_bucket.end(), NONE);
+        std::fill(bucket_head.begin(), bucket_head.end(), NONE);
+        std::fill(bucket_tail.begin(), bucket_tail.end(), NONE);
+        std::fill(bucket_sums.begin(), bucket_sums.end(), 0);
+        std::fill(bucket_counts.begin(), bucket_counts.end(), 0);
+        for (auto& tree : block_trees) tree = OrderStatisticTree<ValueDomain>();
+        outside = 0;
+    }
+
+    // Whether every stored entry lies inside both domains, i.e. query() sees all of them
+    bool exact() const { return outside == 0; }
+
+    /**
+        Statistics of the entries with position in [min_pos, max_pos], plus extra values the caller
+        already knows to be in the range (e.g. samples not indexed yet). Requires exact() and extra
+        values inside [0, ValueDomain).
+
+        @param extra - extra[0 .. extra_count) to merge in
+    */
+    Stats query(int min_pos, int max_pos, const int* extra, std::size_t extra_count) {
+        const int lo = std::max(min_pos, 0);
+        const int hi = std::min(max_pos, PositionDomain - 1);
+
+        Stats stats{0, static_cast<int>(extra_count), INT_MAX, 0};
+        for (std::size_t i = 0; i < extra_count; ++i) stats.sum += extra[i];
+
+        // Whole blocks [first_block, end_block) go through the block trees, edge buckets through scratch
+        const OrderStatisticTree<ValueDomain>* trees[2 * MAX_FENWICK_TERMS + 1];
+        int signs[2 * MAX_FENWICK_TERMS + 1];
+        int tree_count = 0;
+
+        if (lo <= hi) {
+            stats.sum += prefix(bucket_sums, hi + 1) - prefix(bucket_sums, lo);
+            stats.count += static_cast<int>(prefix(bucket_counts, hi + 1) - prefix(bucket_counts, lo));
+
+            const int first_block = (lo + BucketBlock - 1) / BucketBlock;
+            const int end_block = (hi + 1) / BucketBlock;
+            if (first_block < end_block) {
+                for (int j = end_block; j > 0; j -= j & -j) {
+                    trees[tree_count] = &block_trees[j - 1];
+                    signs[tree_count++] = 1;
+                }
+                for (int j = first_block; j > 0; j -= j & -j) {
+                    trees[tree_count] = &block_trees[j - 1];
+                    signs[tree_count++] = -1;
+                }
+                gather(lo, first_block * BucketBlock - 1);
+                gather(end_block * BucketBlock, hi);
+            } else {
+                gather(lo, hi);
+            }
+        }
+        if (stats.count == 0) {
+            edge_values.clear();
+            return stats;
+        }
+
+        for (int value : edge_values) scratch.insert(value);
+        for (std::size_t i = 0; i < extra_count; ++i) scratch.insert(extra[i]);
+        trees[tree_count] = &scratch;
+        signs[tree_count++] = 1;
+
+        stats.min = OrderStatisticTree<ValueDomain>::kth_of_sum(trees, signs, tree_count, 0);
+        stats.median = OrderStatisticTree<ValueDomain>::kth_of_sum(trees, signs, tree_count, stats.count / 2);
+
+        for (int value : edge_values) scratch.erase(value);
+        for (std::size_t i = 0; i < extra_count; ++i) scratch.erase(extra[i]);
+        edge_values.clear();
+        return stats;
+    }
+
+private:
+    static constexpr int NONE = -1;
+    static constexpr int OUTSIDE = -2;
+    static constexpr int BLOCKS = (PositionDomain + BucketBlock - 1) / BucketBlock;
+
+    static constexpr int fenwick_terms(int n) {
+        int terms = 0;
+        while (n > 0) {
+            ++terms;
+            n >>= 1;
+        }
+        return terms;
+    }
+    // Upper bound on the nodes of one Fenwick prefix over the blocks
+    static constexpr int MAX_FENWICK_TERMS = fenwick_terms(BLOCKS);
+
+    void add(int bucket, int value, int delta) {
+        for (int i = bucket + 1; i <= PositionDomain; i += i & -i) {
+            bucket_sums[i] += static_cast<int64_t>(delta) * value;
+            bucket_counts[i] += delta;
+        }
+        for (int j = bucket / BucketBlock + 1; j <= BLOCKS; j += j & -j) {
+            if (delta > 0) block_trees[j - 1].insert(value);
+            else block_trees[j - 1].erase(value);
+        }
+    }
+
+    // Sum of the first n buckets
+    template <typename T>
+    static int64_t prefix(const std::vector<T>& fenwick, int n) {
+        int64_t total = 0;
+        for (int i = n; i > 0; i -= i & -i) total += fenwick[i];
+        return total;
+    }
+
+    // Appends the values of every entry in buckets [first, last] to edge_values
+    void gather(int first, int last) {
+        for (int bucket = first; bucket <= last; ++bucket) {
+            for (int slot = bucket_head[bucket]; slot != NONE; slot = slot_next[slot]) edge_values.push_back(slot_value[slot]);
+        }
+    }
+
+    // Per-slot entry data: bucket (NONE when empty, OUTSIDE when not indexed), value, next slot in bucket
+    std::vector<int> slot_bucket;
+    std::vector<int> slot_value;
+    std::vector<int> slot_next;
+
+    // Oldest and newest slot of each bucket's entry list
+    std::vector<int> bucket_head;
+    std::vector<int> bucket_tail;
+
+    // 1-based Fenwick arrays over buckets
+    std::vector<int64_t> bucket_sums;
+    std::vector<int64_t> bucket_counts;
+
+    // 1-based Fenwick tree over blocks; node j - 1 counts the values of blocks (j - (j & -j), j]
+    std::vector<OrderStatisticTree<ValueDomain>> block_trees;
+
+    // Edge buckets' values during a query, merged through scratch; both are empty between queries
+    std::vector<int> edge_values;
+    OrderStatisticTree<ValueDomain> scratch;
+
+    int outside = 0;
+};
+
+#endif // POSITION_INDEX_H
@@ -0,0 +1,63 @@
+/**
+    SampleArena.h
+
+    A single, fixed-size, 64-byte aligned memory block that many SampleRing buffers carve their
+    storage from, so a multi-lane setup makes one allocation instead of four per lane and keeps all
+    sample storage contiguous.
+
+    Features:
+    - One std::aligned_alloc at construction, released at destruction
+    - Bump allocation with per-request alignment; nothing is freed individually
+    - Throws std::bad_alloc when exhausted, like the heap path it replaces
+
+    Not thread-safe: carve everything during setup (construction of the owning managers), before
+    any other thread uses the memory. The arena must outlive every buffer carved from it.
+*/
+
+#ifndef SAMPLE_ARENA_H
+#define SAMPLE_ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+class SampleArena {
+public:
+    static constexpr std::size_t ALIGNMENT = 64;
+
+    /**
+        @param bytes - Total capacity; sum the storage_bytes of every buffer to be carved
+    */
+    explicit SampleArena(std::size_t bytes)
+        : size((bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT),
+          base(static_cast<unsigned char*>(std::aligned_alloc(ALIGNMENT, size > 0 ? size : ALIGNMENT))) {
+        if (!base) throw std::bad_alloc();
+    }
+
+    ~SampleArena() { std::free(base); }
+
+    SampleArena(const SampleArena&) = delete;
+    SampleArena& operator=(const SampleArena&) = delete;
+
+    /**
+        Carves bytes from the arena.
+        @param alignment - Power of two, at most ALIGNMENT
+        @return Pointer valid for the arena's lifetime
+    */
+    void* allocate(std::size_t bytes, std::size_t alignment = ALIGNMENT) {
+        const std::size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (offset > size || bytes > size - offset) throw std::bad_alloc();
+        used = offset + bytes;
+        return base + offset;
+    }
+
+    std::size_t capacity() const { return size; }
+    std::size_t bytes_used() const { return used; }
+
+private:
+    std::size_t size;
+    unsigned char* base;
+    std::size_t used = 0;
+};
+
+#endif // SAMPLE_ARENA_H
@@ -0,0 +1,262 @@
+/**
+    SampleRecording.h
+
+    Compact binary record/replay of sensor traffic: a recorder attached to a manager logs every
+    density and position sample the manager accepts, and a replay driver feeds a recording back
+    through any manager, as fast as the CPU allows or paced at (a multiple of) real time.
+
+    Features:
+    - Delta encoding: each sample is two LEB128 varints, the zigzagged timestamp delta against the
+      previous sample of either stream (shifted left once, the low bit naming the stream) and the
+      zigzagged value delta against the previous sample of the same stream. Regular 4-20 kHz
+      traffic takes 2-4 bytes per sample instead of 12 raw
+    - SampleRecorder: thread-safe append (density and position producers may record concurrently),
+      64 KB write buffer, flushed when full, on flush() and on destruction. A failed write is
+      sticky: recording stops, failed() reports it and flush() throws
+    - SampleRecordingReader: loads a recording and decodes it sample by sample; a final sample cut
+      short by a crash ends the recording instead of failing it
+    - ReplayRecording: drives MeasureDensityReady / MeasurePositionReady in recorded order
+
+    File layout: the 8-byte magic "SDMREC" plus two NULs, a uint32 version, a uint32 reserved
+    field (all native-endian), then the samples. The first sample's deltas are taken against time 0
+    and value 0. Samples are stored in the order the recorder received them. A manager hands them
+    over in batches merged by timestamp, so each stream keeps its ingest order.
+*/
+
+#ifndef SAMPLE_RECORDING_H
+#define SAMPLE_RECORDING_H
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "SensorDataManager.h"
+
+enum class SampleStream : uint8_t { Density = 0, Position = 1 };
+
+// One decoded sample
+struct RecordedSample {
+    SampleStream stream;
+    int value;  // density, or position in mm
+    int64_t time_uS;
+};
+
+namespace sample_recording {
+
+constexpr char MAGIC[8] = {'S', 'D', 'M', 'R', 'E', 'C', '\0', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr std::size_t HEADER_BYTES = sizeof(MAGIC) + 2 * sizeof(uint32_t);
+
+inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+// Appends v as LEB128 (at most 10 bytes)
+inline unsigned char* put_varint(unsigned char* out, uint64_t v) {
+    while (v >= 0x80) {
+        *out++ = static_cast<unsigned char>(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = static_cast<unsigned char>(v);
+    return out;
+}
+
+// Reads one LEB128 value from [in, end); false if it runs past end or is longer than 10 bytes
+inline bool get_varint(const unsigned char*& in, const unsigned char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 70 && in < end; shift += 7) {
+        const unsigned char byte = *in++;
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) return true;
+    }
+    return false;
+}
+
+}  // namespace sample_recording
+
+class SampleRecorder {
+public:
+    /**
+        Creates (or truncates) the recording file and writes its header.
+        Throws std::system_error if the file cannot be opened.
+    */
+    explicit SampleRecorder(const std::string& path) : path(path), file(std::fopen(path.c_str(), "wb")) {
+        if (!file) throw std::system_error(errno, std::generic_category(), "open " + path);
+        std::memcpy(buffer, sample_recording::MAGIC, sizeof(sample_recording::MAGIC));
+        const uint32_t header[2] = {sample_recording::VERSION, 0};
+        std::memcpy(buffer + sizeof(sample_recording::MAGIC), header, sizeof(header));
+        used = sample_recording::HEADER_BYTES;
+    }
+
+    // Never throws; call flush() first to learn whether the tail reached the file
+    ~SampleRecorder() {
+        write_buffer();
+        std::fclose(file);
+    }
+
+    SampleRecorder(const SampleRecorder&) = delete;
+    SampleRecorder& operator=(const SampleRecorder&) = delete;
+
+    void record(SampleStream stream, int value, int64_t time_uS) {
+        std::lock_guard<std::mutex> lock(mutex);
+        encode(stream, value, time_uS);
+    }
+
+    // A block of samples of one stream, under one lock
+    void record(SampleStream stream, const SensorSample* samples, std::size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::size_t i = 0; i < count; ++i) encode(stream, samples[i].value, samples[i].time_uS);
+    }
+
+    /**
+        Hands everything recorded so far to the operating system.
+        Throws std::system_error if this or any earlier write failed.
+    */
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        write_buffer();
+        if (error == 0 && std::fflush(file) != 0) error = errno != 0 ? errno : EIO;
+        if (error != 0) throw std::system_error(error, std::generic_category(), "write " + path);
+    }
+
+    // True once a write has failed; later samples are counted but no longer written
+    bool failed() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return error != 0;
+    }
+
+    uint64_t samples() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return recorded;
+    }
+
+private:
+    static constexpr std::size_t BUFFER_BYTES = 64 * 1024;
+    static constexpr std::size_t MAX_SAMPLE_BYTES = 20;  // two 10-byte varints
+
+    void encode(SampleStream stream, int value, int64_t time_uS) {
+        if (used + MAX_SAMPLE_BYTES > BUFFER_BYTES) write_buffer();
+        const std::size_t s = static_cast<std::size_t>(stream);
+        unsigned char* out = buffer + used;
+        out = sample_recording::put_varint(out, sample_recording::zigzag(time_uS - previous_time) << 1 | s);
+        out = sample_recording::put_varint(out, sample_recording::zigzag(int64_t(value) - previous_value[s]));
+        used = static_cast<std::size_t>(out - buffer);
+        previous_time = time_uS;
+        previous_value[s] = value;
+        ++recorded;
+    }
+
+    // Records the first failure instead of throwing: encode() runs inside the ingest calls
+    void write_buffer() {
+        if (used > 0 && error == 0) {
+            errno = 0;
+            if (std::fwrite(buffer, 1, used, file) != used) error = errno != 0 ? errno : EIO;
+        }
+        used = 0;
+    }
+
+    mutable std::mutex mutex;
+    const std::string path;
+    std::FILE* file;
+    unsigned char buffer[BUFFER_BYTES];
+    std::size_t used = 0;
+    int64_t previous_time = 0;
+    int64_t previous_value[2] = {0, 0};
+    uint64_t recorded = 0;
+    int error = 0;  // errno of the first failed write, 0 while healthy
+};
+
+class SampleRecordingReader {
+public:
+    /**
+        Loads a whole recording into memory.
+        Throws std::system_error if it cannot be read, std::runtime_error if it is not a recording.
+    */
+    explicit SampleRecordingReader(const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) throw std::system_error(errno, std::generic_category(), "open " + path);
+        unsigned char chunk[64 * 1024];
+        for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0;) bytes.insert(bytes.end(), chunk, chunk + n);
+        std::fclose(file);
+
+        uint32_t version = 0;
+        if (bytes.size() >= sample_recording::HEADER_BYTES)
+            std::memcpy(&version, bytes.data() + sizeof(sample_recording::MAGIC), sizeof(version));
+        if (bytes.size() < sample_recording::HEADER_BYTES ||
+            std::memcmp(bytes.data(), sample_recording::MAGIC, sizeof(sample_recording::MAGIC)) != 0 ||
+            version != sample_recording::VERSION)
+            throw std::runtime_error(path + " is not a sample recording");
+        rewind();
+    }
+
+    // Decodes the next sample; false at the end of the recording
+    bool next(RecordedSample& sample) {
+        const unsigned char* in = cursor;
+        const unsigned char* end = bytes.data() + bytes.size();
+        uint64_t time_word, value_word;
+        if (!sample_recording::get_varint(in, end, time_word) || !sample_recording::get_varint(in, end, value_word)) return false;
+
+        const std::size_t s = static_cast<std::size_t>(time_word & 1);
+        previous_time += sample_recording::unzigzag(time_word >> 1);
+        previous_value[s] += sample_recording::unzigzag(value_word);
+        sample = {static_cast<SampleStream>(s), static_cast<int>(previous_value[s]), previous_time};
+        cursor = in;
+        return true;
+    }
+
+    // Starts decoding from the first sample again
+    void rewind() {
+        cursor = bytes.data() + sample_recording::HEADER_BYTES;
+        previous_time = 0;
+        previous_value[0] = previous_value[1] = 0;
+    }
+
+    std::size_t size_bytes() const { return bytes.size(); }
+
+private:
+    std::vector<unsigned char> bytes;
+    const unsigned char* cursor = nullptr;
+    int64_t previous_time = 0;
+    int64_t previous_value[2] = {0, 0};
+};
+
+struct ReplayResult {
+    uint64_t samples;
+    double seconds;  // wall time of the replay
+};
+
+/**
+    Feeds the rest of a recording through target, in recorded order.
+    @param speed - 0: as fast as possible; otherwise recorded time runs `speed` times faster than
+                   wall time (1: real time). Paced replays sleep only once they lead by over 200 us.
+*/
+template <typename Manager>
+ReplayResult ReplayRecording(SampleRecordingReader& reader, Manager& target, double speed = 0) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    uint64_t replayed = 0;
+    RecordedSample sample;
+    int64_t first_time_us = 0;
+
+    while (reader.next(sample)) {
+        if (speed > 0) {
+            if (replayed == 0) first_time_us = sample.time_uS;
+            const auto due = start + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double, std::micro>((sample.time_uS - first_time_us) / speed));
+            if (due - Clock::now() > std::chrono::microseconds(200)) std::this_thread::sleep_until(due);
+        }
+        if (sample.stream == SampleStream::Density) target.MeasureDensityReady(sample.value, sample.time_uS);
+        else target.MeasurePositionReady(sample.value, sample.time_uS);
+        ++replayed;
+    }
+    return {replayed, std::chrono::duration<double>(Clock::now() - start).count()};
+}
+
+#endif // SAMPLE_RECORDING_H
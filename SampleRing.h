@@ -0,0 +1,289 @@
+/**
+    SampleRing.h
+
+    Fixed-capacity, cache-line-aligned circular buffer of timestamped samples stored as a
+    structure of arrays (one timestamp array, one value array).
+
+    Features:
+    - All storage allocated once at construction, from the heap or a shared SampleArena;
+      push/pop never allocate
+    - Separate, 64-byte aligned timestamp and value arrays for contiguous scans
+    - Mirrored layout: every slot is also written `capacity` elements further on, so the live
+      window [oldest, newest] is always one contiguous run starting at times() / values().
+      Hot loops, binary searches and SIMD kernels can treat the buffer as a plain array.
+    - When full, push_back overwrites the oldest sample (bounded memory under bursts)
+    - Monotonic sequence numbers, so derived per-sample data can be kept in parallel arrays
+    - Seqlock-style snapshots: try_snapshot copies the window from another thread while the
+      single writer keeps pushing, and detects whether the writer lapped the copied slots
+    - External storage: arrays and indices may live in caller-owned memory such as a mapped
+      file (MappedRingFile.h); the ring then resumes from the indices it finds there. Slot and
+      index stores are ordered so a process dying between any two of them leaves indices that
+      cover only complete samples of the current lap
+
+    One thread (or one lock holder) may modify the ring; any number of threads may call
+    try_snapshot concurrently. All other accessors belong to the writer side.
+*/
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include "SampleArena.h"
+
+// Position of the live window, as plain 64-bit fields so it can be kept in a file
+struct SampleRingIndices {
+    std::uint64_t head;    // slot of the oldest sample, always < capacity
+    std::uint64_t count;   // live samples
+    std::uint64_t pushed;  // samples ever pushed
+};
+
+// Caller-owned ring storage: 2 * capacity timestamps and values, and the indices
+template <typename TimeT, typename ValueT>
+struct SampleRingStorage {
+    TimeT* times;
+    ValueT* values;
+    SampleRingIndices* indices;
+};
+
+template <typename TimeT, typename ValueT>
+class SampleRing {
+    static_assert(std::is_trivially_copyable<TimeT>::value && std::is_trivially_copyable<ValueT>::value,
+                  "SampleRing stores raw, uninitialized arrays");
+
+public:
+    static constexpr std::size_t ALIGNMENT = 64;
+
+    /**
+        @param capacity - Maximum number of samples held at once (at least 1)
+        @param arena - Carve the storage from this arena instead of the heap (must outlive the ring)
+    */
+    explicit SampleRing(std::size_t capacity, SampleArena* arena = nullptr)
+        : slots(capacity > 0 ? capacity : 1),
+          state(own_indices),
+          time_storage(allocate<TimeT>(2 * slots, arena)),
+          value_storage(allocate<ValueT>(2 * slots, arena)) {}
+
+    /**
+        Ring over external storage that outlives it. Indices that describe a valid window are
+        adopted as they are (the samples they cover are live again); anything else is reset to empty.
+    */
+    SampleRing(std::size_t capacity, const SampleRingStorage<TimeT, ValueT>& storage)
+        : slots(capacity > 0 ? capacity : 1),
+          state(*storage.indices),
+          time_storage(storage.times, FreeDeleter{false}),
+          value_storage(storage.values, FreeDeleter{false}) {
+        if (state.head >= slots || state.count > slots || state.pushed < state.count) state = SampleRingIndices{0, 0, 0};
+        published_first.store(first_sequence(), std::memory_order_relaxed);
+        published_end.store(state.pushed, std::memory_order_relaxed);
+        claimed_end.store(state.pushed, std::memory_order_relaxed);
+    }
+
+    // Bytes a ring of this capacity takes from a SampleArena
+    static constexpr std::size_t storage_bytes(std::size_t capacity) {
+        return aligned_bytes<TimeT>(2 * (capacity > 0 ? capacity : 1)) + aligned_bytes<ValueT>(2 * (capacity > 0 ? capacity : 1));
+    }
+
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    std::size_t size() const { return state.count; }
+    std::size_t capacity() const { return slots; }
+    bool empty() const { return state.count == 0; }
+    bool full() const { return state.count == slots; }
+
+    /**
+        Appends a sample at the newest end, overwriting the oldest sample if the ring is full.
+        @return true if an old sample had to be overwritten
+    */
+    bool push_back(TimeT time, ValueT value) {
+        bool overwrote = full();
+        if (overwrote) pop_front();
+
+        std::size_t slot = state.head + state.count;
+        if (slot >= slots) slot -= slots;
+
+        claim(state.pushed + 1);
+        // Write the slot and its mirror so any window starting in [0, slots) is contiguous
+        time_storage[slot] = time;
+        time_storage[slot + slots] = time;
+        value_storage[slot] = value;
+        value_storage[slot + slots] = value;
+        index_barrier();
+        ++state.count;
+        ++state.pushed;
+        published_end.store(state.pushed, std::memory_order_release);
+        return overwrote;
+    }
+
+    /**
+        Appends n samples in one pass, read through time_of(i) / value_of(i) for i in [0, n).
+        Writes at most two contiguous runs per array (plus mirrors) instead of n wrapped pushes.
+        Requires size() + n <= capacity(); evict first to make room.
+    */
+    template <typename TimeOf, typename ValueOf>
+    void append(std::size_t n, TimeOf time_of, ValueOf value_of) {
+        std::size_t slot = state.head + state.count;
+        if (slot >= slots) slot -= slots;
+
+        claim(state.pushed + n);
+        const std::size_t first_run = n < slots - slot ? n : slots - slot;
+        write_run(slot, 0, first_run, time_of, value_of);
+        write_run(0, first_run, n - first_run, time_of, value_of);
+
+        index_barrier();
+        state.count += n;
+        state.pushed += n;
+        published_end.store(state.pushed, std::memory_order_release);
+    }
+
+    /**
+        Drops the n oldest samples (n <= size()). The count shrinks before the head moves, so an
+        interruption in between leaves a window ending short of the newest sample rather than one
+        reaching past it into the previous lap; the slots are only reused after both.
+    */
+    void pop_front(std::size_t n = 1) {
+        std::uint64_t head = state.head + n;
+        if (head >= slots) head -= slots;
+        state.count -= n;
+        index_barrier();
+        state.head = head;
+        index_barrier();
+        published_first.store(first_sequence(), std::memory_order_release);
+    }
+
+    // Drops every sample; sample sequence s keeps living in slot s % capacity()
+    void clear() { pop_front(state.count); }
+
+    /**
+        Replaces every live timestamp t (and its mirror) with fn(t), e.g. to rebase a relative clock.
+        Concurrent try_snapshot callers are not protected from this; the owner must invalidate them.
+    */
+    template <typename Fn>
+    void rewrite_times(Fn fn) {
+        for (std::size_t i = 0; i < state.count; ++i) {
+            std::size_t slot = state.head + i;
+            if (slot >= slots) slot -= slots;
+            const TimeT time = fn(time_storage[slot]);
+            time_storage[slot] = time;
+            time_storage[slot + slots] = time;
+        }
+    }
+
+    /**
+        Copies the live window, oldest first, without synchronizing with the writer. The indices are
+        read first, the slots copied, and the copy is then validated: it is only torn if the writer
+        started on a sequence number one full lap past the oldest copied sample, since evictions
+        never touch slot contents. Safe to call from any thread concurrently with the writer.
+
+        @param times_out - Room for capacity() timestamps
+        @param values_out - Room for capacity() values
+        @param n - Receives the number of samples copied
+        @return false if the copy may be torn and must be retried
+    */
+    bool try_snapshot(TimeT* times_out, ValueT* values_out, std::size_t& n) const {
+        const std::uint64_t end = published_end.load(std::memory_order_acquire);
+        std::uint64_t first = published_first.load(std::memory_order_acquire);
+        // Evictions published after `end` was read can move first past it
+        if (first > end) first = end;
+
+        n = static_cast<std::size_t>(end - first);
+        const std::size_t slot = static_cast<std::size_t>(first % slots);
+        std::memcpy(times_out, time_storage.get() + slot, n * sizeof(TimeT));
+        std::memcpy(values_out, value_storage.get() + slot, n * sizeof(ValueT));
+
+        // Pairs with the release fence in claim(): if any copied byte came from a newer write,
+        // its claim is visible here
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return claimed_end.load(std::memory_order_relaxed) - first <= slots;
+    }
+
+    // Sequence number of the oldest live sample; sample i has sequence first_sequence() + i
+    std::uint64_t first_sequence() const { return state.pushed - state.count; }
+    // Sequence number the next push_back will get
+    std::uint64_t end_sequence() const { return state.pushed; }
+
+    // Contiguous views of the live samples, oldest first; valid for size() elements
+    const TimeT* times() const { return time_storage.get() + state.head; }
+    const ValueT* values() const { return value_storage.get() + state.head; }
+
+    TimeT time(std::size_t i) const { return times()[i]; }
+    ValueT value(std::size_t i) const { return values()[i]; }
+
+    TimeT front_time() const { return time(0); }
+    ValueT front_value() const { return value(0); }
+    TimeT back_time() const { return time(state.count - 1); }
+    ValueT back_value() const { return value(state.count - 1); }
+
+private:
+    // Compiler-only barrier between slot and index stores. A killed process still publishes every
+    // store it executed, so program order is all crash safety needs (power loss needs msync).
+    static void index_barrier() { std::atomic_signal_fence(std::memory_order_seq_cst); }
+
+    // Announces that slots up to sequence end - 1 are about to be written, before writing them
+    void claim(std::uint64_t end) {
+        claimed_end.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // Copies samples [source, source + n) into slots [slot, slot + n) and their mirrors
+    template <typename TimeOf, typename ValueOf>
+    void write_run(std::size_t slot, std::size_t source, std::size_t n, TimeOf& time_of, ValueOf& value_of) {
+        TimeT* times_out = time_storage.get() + slot;
+        ValueT* values_out = value_storage.get() + slot;
+        for (std::size_t i = 0; i < n; ++i) {
+            const TimeT time = time_of(source + i);
+            times_out[i] = time;
+            times_out[i + slots] = time;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            const ValueT value = value_of(source + i);
+            values_out[i] = value;
+            values_out[i + slots] = value;
+        }
+    }
+
+    // Frees heap storage; arena storage is released with the arena
+    struct FreeDeleter {
+        bool owned = true;
+        void operator()(void* p) const {
+            if (owned) std::free(p);
+        }
+    };
+
+    // std::aligned_alloc requires the size to be a multiple of the alignment
+    template <typename T>
+    static constexpr std::size_t aligned_bytes(std::size_t n) {
+        return (n * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    template <typename T>
+    static std::unique_ptr<T[], FreeDeleter> allocate(std::size_t n, SampleArena* arena) {
+        const std::size_t bytes = aligned_bytes<T>(n);
+        if (arena) return std::unique_ptr<T[], FreeDeleter>(static_cast<T*>(arena->allocate(bytes, ALIGNMENT)), FreeDeleter{false});
+        void* p = std::aligned_alloc(ALIGNMENT, bytes);
+        if (!p) throw std::bad_alloc();
+        return std::unique_ptr<T[], FreeDeleter>(static_cast<T*>(p));
+    }
+
+    std::size_t slots;
+    SampleRingIndices own_indices{0, 0, 0};
+    SampleRingIndices& state;  // own_indices, or the external storage's
+
+    // Snapshot indices: [published_first, published_end) is readable, and no slot of a sequence
+    // >= claimed_end has been touched yet
+    std::atomic<std::uint64_t> published_first{0};
+    std::atomic<std::uint64_t> published_end{0};
+    std::atomic<std::uint64_t> claimed_end{0};
+
+    std::unique_ptr<TimeT[], FreeDeleter> time_storage;
+    std::unique_ptr<ValueT[], FreeDeleter> value_storage;
+};
+
+#endif // SAMPLE_RING_H
@@ -7,84 +7,1520 @@
     arbitrary window of time configurable in SensorDataManager.h (default 5-seconds).
 
     Features:
-    - Efficient memory usage with timestamp-trimmed buffers (std::deque)
-    - Thread-safe insertion of density and position measurements via mutex locking
+    - Fixed, preallocated memory: timestamp-trimmed SoA ring buffers that never allocate after startup
+    - Thread-safe insertion of density and position measurements under per-stream mutexes,
+      per sample or per acquisition block
+    - Stale samples evicted in batches at ingest and exactly at query time, not on every sample
+    - Optional wait-free ingest through per-stream SPSC rings, drained by the query path
+    - Optional lock-free snapshot queries that scale across query threads
     - Interpolation of positions for non-aligned timestamps
+    - 64-bit timestamps in the API, stored compactly relative to a periodically rebased time base
     - Calculation of mean, min, and median densities in a specified position interval
+    - Incremental order statistics for registered position ranges, updated on ingest and eviction
+    - Density positions resolved once, when a position sample brackets them, for precomputed queries
+    - Position-bucket index over the resolved samples for range statistics without a scan
+    - Buffers optionally kept in a memory-mapped capture file and re-attached after a restart
+    - Optional ingest tap feeding a SampleRecorder
+    - Member templates of BasicSensorDataManager, explicitly instantiated at the end of the file
 */
 
 #include "SensorDataManager.h"
 #include "MedianStrategy.h"
+#include "SampleRecording.h"
 
-void SensorDataManager::MeasureDensityReady(int density, int time_uS) {
+#include <cstring>
+#include <stdexcept>
+
+// Shorthand for the out-of-class member definitions of BasicSensorDataManager
+#define SDM_TEMPLATE template <int WindowUs, int MaxDensityRateHz, int MaxPositionRateHz, typename TimeT, typename DensityT>
+#define SDM BasicSensorDataManager<WindowUs, MaxDensityRateHz, MaxPositionRateHz, TimeT, DensityT>
+
+SDM_TEMPLATE
+SDM::BasicSensorDataManager(IngestMode mode, QueryConcurrency concurrency, SampleArena* arena)
+    : density_buffer(window_capacity(MAX_DENSITY_RATE_HZ), arena),
+      position_buffer(window_capacity(MAX_POSITION_RATE_HZ), arena),
+      ingest_mode(mode), query_concurrency(concurrency) {}
+
+SDM_TEMPLATE
+SDM::BasicSensorDataManager(MappedRingFile& capture, IngestMode mode, QueryConcurrency concurrency)
+    : density_buffer(window_capacity(MAX_DENSITY_RATE_HZ), capture.ring<StoredTime, DensityT>(MappedRingFile::DENSITY)),
+      position_buffer(window_capacity(MAX_POSITION_RATE_HZ), capture.ring<StoredTime, int>(MappedRingFile::POSITION)),
+      ingest_mode(mode), query_concurrency(concurrency), capture_file(&capture) {
+    attach_capture();
+}
+
+SDM_TEMPLATE
+void SDM::attach_capture() {
+    /**
+        The rings resumed from the file's indices; everything derived from their contents is
+        rebuilt here with one pass over each window. Samples older than the window are left for
+        the first trim, which runs as soon as a new timestamp arrives. Registered ranges, the
+        resolved column and board detection start from scratch, as in a new manager.
+    */
+    const MappedRingLayout expected = CaptureLayout();
+    if (std::memcmp(&capture_file->header().layout, &expected, sizeof(expected)) != 0)
+        throw std::invalid_argument("capture file was opened with another manager's layout");
+
+    time_base_us.store(capture_file->header().time_base_us, std::memory_order_relaxed);
+    for (std::size_t i = 1; i < density_buffer.size(); ++i) {
+        if (density_buffer.time(i) < density_buffer.time(i - 1)) ++density_time_inversions;
+    }
+    for (std::size_t i = 1; i < position_buffer.size(); ++i) {
+        if (position_buffer.value(i) < position_buffer.value(i - 1)) ++position_descents;
+    }
+
+    int64_t newest_us = INT64_MIN / 2;
+    for (std::size_t i = 0; i < density_buffer.size(); ++i) newest_us = std::max<int64_t>(newest_us, density_buffer.time(i));
+    if (!position_buffer.empty()) newest_us = std::max<int64_t>(newest_us, position_buffer.back_time());
+    if (!density_buffer.empty() || !position_buffer.empty()) note_time(time_base() + newest_us);
+
+    metrics.density_depth.set(density_buffer.size());
+    metrics.position_depth.set(position_buffer.size());
+}
+
+SDM_TEMPLATE
+SDM::~BasicSensorDataManager() {
+    // Answer the queued asynchronous queries and updates before any buffer goes away; a shared
+    // pool keeps running, so wait for this manager's tasks on it
+    {
+        std::unique_lock<std::mutex> lock(async_mutex);
+        async_idle.wait(lock, [this] { return async_drains == 0 && !standing_round_scheduled; });
+    }
+    async_pool.reset();
+    delivery_pool.reset();
+
+    // Write the staged samples to a still-attached recorder
+    {
+        std::unique_lock<std::mutex> recording(recording_mutex, std::defer_lock);
+        {
+            std::scoped_lock lock(position_mutex, density_mutex);
+            recording.lock();
+            hand_over_staged();
+        }
+        write_handed_over(true);
+    }
+
+    // Finalization tasks on a board pool still reference this manager
+    std::unique_lock<std::mutex> lock(board_mutex);
+    board_finalized.wait(lock, [this] { return pending_boards == 0; });
+}
+
+SDM_TEMPLATE
+void SDM::MeasureDensityReady(int density, int64_t time_uS) {
     /**
         Callback for density data arrival.
-        Locks access to buffers, removes stale data, and appends the new density reading.
+        Locked mode: locks the density buffer only, appends the new density reading, and evicts
+        stale densities once they are TRIM_SLACK_US past the window.
+        LockFree mode: publishes the reading to the density ring without blocking; it is appended
+        to the buffer and trimmed by the next query.
     */
-    std::lock_guard<std::mutex> lock(data_mutex);
-    trim_old_data(time_uS);
-    density_buffer.emplace_back(time_uS, density);
+    metrics.density_ingest_calls.add(1);
+    CallTimer timer(metrics.density_ingest, metrics_sample_due());
+    if (ingest_mode == IngestMode::LockFree) {
+        if (!density_ring.try_push({density, time_uS}))
+            dropped_samples.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    note_time(time_uS);
+    if (needs_rebase(time_uS)) rebase_time_base();
+
+    TimedScopedLock lock(metrics.density_lock_wait, density_mutex);
+    append_density(to_stored(time_uS), density);
+    if (recorder) {
+        const SensorSample sample{density, time_uS};
+        stage_recorded(staged_densities, &sample, 1);
+    }
+    trim_densities_lazily();
 }
 
-void SensorDataManager::MeasurePositionReady(int position_mm, int time_uS) {
+SDM_TEMPLATE
+void SDM::MeasurePositionReady(int position_mm, int64_t time_uS) {
     /**
         Callback for position data arrival.
-        Locks access to buffers, removes stale data, and appends the new position reading.
+        Locked mode: locks the position buffer only and appends the new position reading. With
+        registered ranges, QueryEngine::Precomputed / Indexed or board segmentation the new position
+        also resolves pending density samples or ends a board, which needs both buffers, so both are
+        locked and trimmed exactly.
+        LockFree mode: publishes the reading to the position ring without blocking.
+    */
+    metrics.position_ingest_calls.add(1);
+    CallTimer timer(metrics.position_ingest, metrics_sample_due());
+    if (ingest_mode == IngestMode::LockFree) {
+        if (!position_ring.try_push({position_mm, time_uS}))
+            dropped_samples.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    note_time(time_uS);
+    if (needs_rebase(time_uS)) rebase_time_base();
+
+    const SensorSample sample{position_mm, time_uS};
+    if (!position_ingest_couples_streams()) {
+        TimedScopedLock lock(metrics.position_lock_wait, position_mutex);
+        append_position(to_stored(time_uS), position_mm);
+        if (recorder) stage_recorded(staged_positions, &sample, 1);
+        trim_positions_lazily();
+        return;
+    }
+
+    TimedScopedLock lock(metrics.position_lock_wait, position_mutex, density_mutex);
+    append_position(to_stored(time_uS), position_mm);
+    if (recorder) stage_recorded(staged_positions, &sample, 1);
+    detect_board_ends();
+    trim_old_data();
+    resolve_density_positions();
+}
+
+SDM_TEMPLATE
+void SDM::MeasureDensityBatch(const SensorSample* samples, std::size_t count) {
+    /**
+        Block callback for density data. One lock, one bulk copy into the ring, one trim against the
+        newest timestamp in the block (or one ring publication in LockFree mode).
     */
-    std::lock_guard<std::mutex> lock(data_mutex);
-    trim_old_data(time_uS);
-    position_buffer.emplace_back(time_uS, position_mm);
+    if (count == 0) return;
+    metrics.density_ingest_calls.add(1);
+    CallTimer timer(metrics.density_ingest, metrics_sample_due());
+
+    if (ingest_mode == IngestMode::LockFree) {
+        const std::size_t pushed = density_ring.try_push_bulk(samples, count);
+        if (pushed < count) dropped_samples.fetch_add(count - pushed, std::memory_order_relaxed);
+        return;
+    }
+
+    int64_t newest_us = INT64_MIN;
+    for (std::size_t i = 0; i < count; ++i) newest_us = std::max(newest_us, samples[i].time_uS);
+    note_time(newest_us);
+    if (needs_rebase(newest_us)) rebase_time_base();
+
+    TimedScopedLock lock(metrics.density_lock_wait, density_mutex);
+    append_density_block(samples, count);
+    if (recorder) stage_recorded(staged_densities, samples, count);
+    trim_densities_lazily();
 }
 
-void SensorDataManager::trim_old_data(int now_us) {
+SDM_TEMPLATE
+void SDM::MeasurePositionBatch(const SensorSample* samples, std::size_t count) {
     /**
-        Removes any measurements older than the sliding 5-second window from both buffers.
+        Block callback for position data; see MeasureDensityBatch.
+    */
+    if (count == 0) return;
+    metrics.position_ingest_calls.add(1);
+    CallTimer timer(metrics.position_ingest, metrics_sample_due());
+
+    if (ingest_mode == IngestMode::LockFree) {
+        const std::size_t pushed = position_ring.try_push_bulk(samples, count);
+        if (pushed < count) dropped_samples.fetch_add(count - pushed, std::memory_order_relaxed);
+        return;
+    }
+
+    int64_t newest_us = INT64_MIN;
+    for (std::size_t i = 0; i < count; ++i) newest_us = std::max(newest_us, samples[i].time_uS);
+    note_time(newest_us);
+    if (needs_rebase(newest_us)) rebase_time_base();
+
+    if (!position_ingest_couples_streams()) {
+        TimedScopedLock lock(metrics.position_lock_wait, position_mutex);
+        append_position_block(samples, count);
+        if (recorder) stage_recorded(staged_positions, samples, count);
+        trim_positions_lazily();
+        return;
+    }
+
+    TimedScopedLock lock(metrics.position_lock_wait, position_mutex, density_mutex);
+    append_position_block(samples, count);
+    if (recorder) stage_recorded(staged_positions, samples, count);
+    detect_board_ends();
+    trim_old_data();
+    resolve_density_positions();
+}
+
+SDM_TEMPLATE
+void SDM::append_density_block(const SensorSample* samples, std::size_t count) {
+    // Only the newest `capacity` samples of an oversized block would survive the overwrites anyway
+    if (count > density_buffer.capacity()) {
+        samples += count - density_buffer.capacity();
+        count = density_buffer.capacity();
+    }
+    while (density_buffer.size() + count > density_buffer.capacity()) evict_density_front();
+
+    // Timestamp inversions inside the block and against the current newest sample
+    for (std::size_t i = 0; i < count; ++i) {
+        const bool has_previous = i > 0 || !density_buffer.empty();
+        const StoredTime previous = i > 0 ? to_stored(samples[i - 1].time_uS) : (has_previous ? density_buffer.back_time() : 0);
+        if (has_previous && to_stored(samples[i].time_uS) < previous) ++density_time_inversions;
+    }
+
+    density_buffer.append(count, [&](std::size_t i) { return to_stored(samples[i].time_uS); },
+                                 [samples](std::size_t i) { return static_cast<DensityT>(samples[i].value); });
+}
+
+SDM_TEMPLATE
+void SDM::append_position_block(const SensorSample* samples, std::size_t count) {
+    if (count > position_buffer.capacity()) {
+        samples += count - position_buffer.capacity();
+        count = position_buffer.capacity();
+    }
+    while (position_buffer.size() + count > position_buffer.capacity()) evict_position_front();
+
+    // Position decreases (board reversals) inside the block and against the current newest sample
+    for (std::size_t i = 0; i < count; ++i) {
+        const bool has_previous = i > 0 || !position_buffer.empty();
+        const int previous_mm = i > 0 ? samples[i - 1].value : (has_previous ? position_buffer.back_value() : 0);
+        if (has_previous && samples[i].value < previous_mm) ++position_descents;
+    }
+
+    position_buffer.append(count, [&](std::size_t i) { return to_stored(samples[i].time_uS); },
+                                  [samples](std::size_t i) { return samples[i].value; });
+}
+
+SDM_TEMPLATE
+void SDM::append_density(StoredTime time_us, int density) {
+    // Full ring: evict explicitly so the counters stay consistent
+    if (density_buffer.full()) evict_density_front();
+    if (!density_buffer.empty() && time_us < density_buffer.back_time()) ++density_time_inversions;
+    density_buffer.push_back(time_us, static_cast<DensityT>(density));
+}
+
+SDM_TEMPLATE
+void SDM::append_position(StoredTime time_us, int position_mm) {
+    if (position_buffer.full()) evict_position_front();
+    if (!position_buffer.empty() && position_mm < position_buffer.back_value()) ++position_descents;
+    position_buffer.push_back(time_us, position_mm);
+}
+
+SDM_TEMPLATE
+void SDM::evict_density_front() {
+    // Forget the inversion between the evicted sample and its successor, if there was one
+    if (density_buffer.size() > 1 && density_buffer.time(1) < density_buffer.time(0)) --density_time_inversions;
+
+    // Take the sample back out of every registered range it was counted in
+    const uint64_t sequence = density_buffer.first_sequence();
+    if (sequence < resolved_end) {
+        const int pos = resolved_position(sequence);
+        const int density = density_buffer.front_value();
+        for (auto& range : registered_ranges) {
+            if (range.contains(pos)) range.remove(sequence, density);
+        }
+        if (index_positions) position_index->erase(sequence % density_buffer.capacity());
+    } else if (resolving_positions()) {
+        // Evicted before any position bracketed it
+        resolved_end = sequence + 1;
+    }
+
+    density_buffer.pop_front();
+}
+
+SDM_TEMPLATE
+void SDM::evict_position_front() {
+    if (position_buffer.size() > 1 && position_buffer.value(1) < position_buffer.value(0)) --position_descents;
+    position_buffer.pop_front();
+}
+
+SDM_TEMPLATE
+void SDM::RegisteredRange::add(uint64_t sequence, int density) {
+    sum += density;
+    ++count;
+    changed = true;
+    if (tree) {
+        tree->insert(density);
+        return;
+    }
+    heaps.insert(density);
+    // Monotonic queue: a newer, smaller-or-equal sample outlives every larger one before it
+    while (!window_min.empty() && window_min.back().second >= density) window_min.pop_back();
+    window_min.emplace_back(sequence, density);
+}
+
+SDM_TEMPLATE
+void SDM::RegisteredRange::remove(uint64_t sequence, int density) {
+    sum -= density;
+    --count;
+    changed = true;
+    if (tree) {
+        tree->erase(density);
+        return;
+    }
+    heaps.erase(density);
+    // Samples leave in arrival order, so the expired one is either at the front or already gone
+    if (!window_min.empty() && window_min.front().first == sequence) window_min.pop_front();
+}
+
+SDM_TEMPLATE
+void SDM::resolve_density_positions() {
+    /**
+        Walks the unresolved density samples in arrival order and fixes the position of each one that
+        is bracketed by the newest position sample (its interpolated position can no longer change),
+        storing it in the resolved column and adding it to every registered range that contains it.
+        Stops at the first sample that is still newer than all positions. Each sample is resolved
+        exactly once. Standing queries are then told about everything that entered or left their
+        ranges since the last publication (the evictions of the trim before this call included).
+    */
+    if (!resolving_positions()) return;
+    if (position_buffer.empty()) {
+        publish_standing_queries();
+        return;
+    }
+
+    const StoredTime newest_position_us = position_buffer.back_time();
+    const uint64_t first = density_buffer.first_sequence();
+    const uint64_t end = density_buffer.end_sequence();
+
+    // The compressed history keeps absolute timestamps, so it is unaffected by later rebases
+    std::unique_lock<std::mutex> history_lock;
+    if (history) history_lock = std::unique_lock<std::mutex>(history_mutex);
+    const int64_t base_us = time_base();
+
+    while (resolved_end < end) {
+        const std::size_t i = resolved_end - first;
+        const StoredTime timestamp = density_buffer.time(i);
+        if (timestamp > newest_position_us) break;
+
+        const int pos = interpolate_position(timestamp);
+        store_resolved_position(resolved_end, pos);
+        for (auto& range : registered_ranges) {
+            if (range.contains(pos)) range.add(resolved_end, density_buffer.value(i));
+        }
+        if (index_positions) position_index->insert(resolved_end % density_buffer.capacity(), pos, density_buffer.value(i));
+        if (zone_positions) add_to_zone(resolved_end, pos, density_buffer.value(i));
+        for (TrackedProfile& profile : tracked_profiles) {
+            if (!profile.grid.add(pos, density_buffer.value(i))) continue;
+            const std::size_t cell = static_cast<std::size_t>(int64_t(pos) - profile.grid.first_mm);
+            profile.dirty_first = std::min(profile.dirty_first, cell);
+            profile.dirty_end = std::max(profile.dirty_end, cell + 1);
+        }
+        if (history) history->append(base_us + timestamp, pos, density_buffer.value(i));
+        ++resolved_end;
+    }
+    publish_standing_queries();
+}
+
+SDM_TEMPLATE
+int SDM::RegisterDensityRange(int min_pos_mm, int max_pos_mm, MedianAlgorithm algorithm) {
+    /**
+        Adds a range and backfills it: from the samples already resolved (for other ranges or the
+        Precomputed engine), or, if nothing was being resolved, by resolving the whole current window.
+    */
+    std::scoped_lock lock(position_mutex, density_mutex);
+    if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+    trim_old_data();
+    // Bring the resolved column up to date first, so the backfill below covers every bracketed sample
+    resolve_density_positions();
+    const bool was_resolving = resolving_positions();
+
+    registered_ranges.emplace_back();
+    RegisteredRange& range = registered_ranges.back();
+    range.id = next_range_id++;
+    range.min_pos_mm = min_pos_mm;
+    range.max_pos_mm = max_pos_mm;
+    // Only the two incremental algorithms make sense here; anything else gets the count tree
+    if (algorithm != MedianAlgorithm::HeapMedian) range.tree = std::make_unique<OrderStatisticTree<DENSITY_DOMAIN>>();
+    registered_range_count.store(registered_ranges.size(), std::memory_order_relaxed);
+
+    if (!was_resolving) {
+        restart_position_resolution();
+        resolve_density_positions();
+        return range.id;
+    }
+
+    const uint64_t first = density_buffer.first_sequence();
+    for (uint64_t sequence = first; sequence < resolved_end; ++sequence) {
+        const int pos = resolved_position(sequence);
+        if (range.contains(pos)) range.add(sequence, density_buffer.value(sequence - first));
+    }
+    return range.id;
+}
+
+SDM_TEMPLATE
+void SDM::restart_position_resolution() {
+    // Nothing was resolved while resolution was off; start over at the oldest live sample
+    if (resolved_positions.empty()) resolved_positions.resize(2 * density_buffer.capacity());
+    resolved_end = density_buffer.first_sequence();
+}
+
+SDM_TEMPLATE
+void SDM::store_resolved_position(uint64_t sequence, int pos_mm) {
+    // Slot and mirror, as SampleRing does, so resolved_column() is one contiguous run
+    const std::size_t slot = sequence % density_buffer.capacity();
+    resolved_positions[slot] = pos_mm;
+    resolved_positions[slot + density_buffer.capacity()] = pos_mm;
+}
+
+SDM_TEMPLATE
+void SDM::UnregisterDensityRange(int range_id) {
+    std::lock_guard<std::mutex> lock(density_mutex);
+    for (RegisteredRange& range : registered_ranges) {
+        if (range.id != range_id || !range.subscriber) continue;
+        std::lock_guard<std::mutex> delivery(range.subscriber->mutex);
+        range.subscriber->cancelled = true;
+        --standing_query_count;
+    }
+    registered_ranges.erase(
+        std::remove_if(registered_ranges.begin(), registered_ranges.end(),
+                       [range_id](const RegisteredRange& range) { return range.id == range_id; }),
+        registered_ranges.end());
+    registered_range_count.store(registered_ranges.size(), std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+int SDM::SubscribeDensityRange(int min_pos_mm, int max_pos_mm, std::function<void(const DensityStats&)> on_update,
+                               MedianAlgorithm algorithm) {
+    /**
+        A registered range plus a subscriber: the range's add/remove flag it as changed, and the
+        resolve / lazy-trim steps that follow every such change publish it.
+    */
+    auto subscriber = std::make_shared<StandingQuery>();
+    subscriber->on_update = std::move(on_update);
+    delivery_workers();
+    {
+        // Every subscription fits in the ready list, so posting an update never allocates
+        std::lock_guard<std::mutex> lock(async_mutex);
+        standing_ready.reserve(++standing_subscriptions);
+    }
+
+    const int range_id = RegisterDensityRange(min_pos_mm, max_pos_mm, algorithm);
+    std::lock_guard<std::mutex> lock(density_mutex);
+    for (RegisteredRange& range : registered_ranges) {
+        if (range.id != range_id) continue;
+        range.subscriber = subscriber;
+        range.changed = false;
+        ++standing_query_count;
+        post_standing_update(subscriber, registered_range_stats(range));
+    }
+    return range_id;
+}
+
+SDM_TEMPLATE
+DensityStats SDM::registered_range_stats(const RegisteredRange& range) {
+    if (range.count == 0) return DensityStats{0, 0, 0};
+    DensityStats stats;
+    stats.mean = static_cast<int>(range.sum / range.count);
+    if (range.tree) {
+        stats.min = range.tree->min();
+        stats.median = range.tree->median();
+    } else {
+        stats.min = range.window_min.front().second;
+        stats.median = range.heaps.median();
+    }
+    return stats;
+}
+
+SDM_TEMPLATE
+void SDM::publish_standing_queries() {
+    if (standing_query_count == 0) return;
+    for (RegisteredRange& range : registered_ranges) {
+        if (!range.subscriber || !range.changed) continue;
+        range.changed = false;
+        post_standing_update(range.subscriber, registered_range_stats(range));
+    }
+}
+
+SDM_TEMPLATE
+void SDM::post_standing_update(const std::shared_ptr<StandingQuery>& subscriber, const DensityStats& stats) {
+    /**
+        Runs on the producer thread, so it only appends to the reserved ready list; a delivery task
+        (two pointers, stored inline by std::function) is submitted only when no round is scheduled.
+    */
+    {
+        std::lock_guard<std::mutex> lock(subscriber->mutex);
+        subscriber->latest = stats;
+        subscriber->pending = true;
+        // A running delivery loop picks the new statistics up before it exits
+        if (subscriber->delivering || subscriber->cancelled) return;
+        subscriber->delivering = true;
+    }
+    bool start_round;
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        standing_ready.push_back(subscriber);
+        start_round = !standing_round_scheduled;
+        standing_round_scheduled = true;
+    }
+    if (!start_round) return;
+    WorkerPool& pool = delivery_workers();
+    pool.submit([this, &pool] { deliver_standing_round(pool); });
+}
+
+SDM_TEMPLATE
+void SDM::deliver_standing_round(WorkerPool& pool) {
+    const WorkerPool* const outer = callback_pool();
+    callback_pool() = &pool;
+    std::vector<std::shared_ptr<StandingQuery>> round;
+    for (;;) {
+        round.clear();
+        {
+            std::lock_guard<std::mutex> lock(async_mutex);
+            if (standing_ready.empty()) {
+                // Notified under the lock: once the destructor sees no task left it destroys async_idle
+                standing_round_scheduled = false;
+                if (async_drains == 0) async_idle.notify_all();
+                break;
+            }
+            round.assign(standing_ready.begin(), standing_ready.end());
+            standing_ready.clear();
+        }
+        for (const std::shared_ptr<StandingQuery>& subscriber : round) deliver_standing_updates(*subscriber);
+    }
+    callback_pool() = outer;
+}
+
+SDM_TEMPLATE
+void SDM::deliver_standing_updates(StandingQuery& subscriber) {
+    std::unique_lock<std::mutex> lock(subscriber.mutex);
+    while (subscriber.pending && !subscriber.cancelled) {
+        const DensityStats stats = subscriber.latest;
+        subscriber.pending = false;
+        lock.unlock();
+        subscriber.on_update(stats);
+        metrics.standing_updates.add(1);
+        lock.lock();
+    }
+    subscriber.delivering = false;
+}
+
+SDM_TEMPLATE
+bool SDM::query_registered_range(int min_pos_mm, int max_pos_mm, int* mean_density, int* min_density, int* median_density) {
+    /**
+        Combines the range's maintained statistics with the not-yet-bracketed tail of the density
+        buffer, whose positions are interpolated (clamped) the same way a full scan would. The tail is
+        typically a few samples.
+        - OrderStatistic: the median of tree + tail is found by binary search over the value domain
+        - HeapMedian: the tail is inserted into the heaps, the median read, and the tail erased again
+    */
+    auto found = std::find_if(registered_ranges.begin(), registered_ranges.end(), [&](const RegisteredRange& range) {
+        return range.min_pos_mm == min_pos_mm && range.max_pos_mm == max_pos_mm;
+    });
+    if (found == registered_ranges.end()) return false;
+    RegisteredRange& range = *found;
+
+    // Unresolved tail; clamped into the tree's domain so both halves rank the same way
+    std::vector<int>& tail = thread_scratch().tail;
+    tail.clear();
+    int64_t tail_sum = 0;
+    for (std::size_t i = resolved_end - density_buffer.first_sequence(); i < density_buffer.size(); ++i) {
+        if (range.contains(interpolate_position(density_buffer.time(i)))) {
+            const int density = density_buffer.value(i);
+            tail.push_back(range.tree ? OrderStatisticTree<DENSITY_DOMAIN>::clamp(density) : density);
+            tail_sum += density;
+        }
+    }
+
+    const int count = range.count + static_cast<int>(tail.size());
+    if (count == 0) {
+        *mean_density = *min_density = *median_density = 0;
+        return true;
+    }
+
+    int median;
+    int min_val = tail.empty() ? INT_MAX : *std::min_element(tail.begin(), tail.end());
+
+    if (!range.tree) {
+        if (!range.window_min.empty()) min_val = std::min(min_val, range.window_min.front().second);
+        for (int density : tail) range.heaps.insert(density);
+        median = range.heaps.median();
+        for (int density : tail) range.heaps.erase(density);
+    } else if (tail.empty()) {
+        median = range.tree->median();
+        min_val = range.tree->min();
+    } else {
+        if (!range.tree->empty()) min_val = std::min(min_val, range.tree->min());
+        std::sort(tail.begin(), tail.end());
+
+        // Smallest value with more than count / 2 samples at or below it
+        const int k = count / 2;
+        int lo = 0, hi = DENSITY_DOMAIN - 1;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            int at_or_below = range.tree->count_not_above(mid) +
+                              static_cast<int>(std::upper_bound(tail.begin(), tail.end(), mid) - tail.begin());
+            if (at_or_below > k) hi = mid;
+            else lo = mid + 1;
+        }
+        median = lo;
+    }
+
+    *mean_density = static_cast<int>((range.sum + tail_sum) / count);
+    *min_density = min_val;
+    *median_density = median;
+    return true;
+}
+
+SDM_TEMPLATE
+void SDM::SetQueryEngine(QueryEngine engine) {
+    /**
+        Switching between the scanning engines is a plain store. Switching to or from Precomputed /
+        Indexed / ZoneMap turns ingest-time resolution (and the bucket index or zone maps) on or off
+        under both mutexes; turning it on resolves, and for Indexed / ZoneMap indexes, the current
+        window first.
+    */
+    auto resolves = [](QueryEngine e) {
+        return e == QueryEngine::Precomputed || e == QueryEngine::Indexed || e == QueryEngine::ZoneMap;
+    };
+    const bool precompute = resolves(engine);
+    if (!precompute && !resolves(query_engine.load(std::memory_order_relaxed))) {
+        query_engine.store(engine, std::memory_order_relaxed);
+        return;
+    }
+
+    std::scoped_lock lock(position_mutex, density_mutex);
+    if (precompute && !resolving_positions()) {
+        if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+        trim_old_data();
+        restart_position_resolution();
+    }
+    precompute_positions = precompute;
+    if (engine != QueryEngine::Indexed) index_positions = false;
+    if (engine != QueryEngine::ZoneMap) zone_positions = false;
+    resolve_density_positions();
+    if (engine == QueryEngine::Indexed && !index_positions) build_position_index();
+    if (engine == QueryEngine::ZoneMap && !zone_positions) build_density_zones();
+    query_engine.store(engine, std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+void SDM::build_position_index() {
+    // The index is rebuilt from scratch each time Indexed is selected; afterwards resolution and
+    // eviction keep it in step with the column
+    if (!position_index) position_index = std::make_unique<DensityPositionIndex>(density_buffer.capacity());
+    else position_index->clear();
+
+    const uint64_t first = density_buffer.first_sequence();
+    for (uint64_t sequence = first; sequence < resolved_end; ++sequence) {
+        position_index->insert(sequence % density_buffer.capacity(), resolved_position(sequence),
+                               density_buffer.value(sequence - first));
+    }
+    index_positions = true;
+}
+
+SDM_TEMPLATE
+void SDM::build_density_zones() {
+    // Like the bucket index, rebuilt from scratch each time ZoneMap is selected
+    if (density_zones.empty()) density_zones.resize(density_buffer.capacity() / ZONE_SAMPLES + 2);
+    for (DensityZone& zone : density_zones) zone.block = UINT64_MAX;
+
+    const uint64_t first = density_buffer.first_sequence();
+    for (uint64_t sequence = first; sequence < resolved_end; ++sequence) {
+        add_to_zone(sequence, resolved_position(sequence), density_buffer.value(sequence - first));
+    }
+    zone_positions = true;
+}
+
+SDM_TEMPLATE
+void SDM::add_to_zone(uint64_t sequence, int pos_mm, int density) {
+    // Samples resolve in sequence order, so a slot still holding another block starts over. A
+    // block entered part-way (the window began inside it) stays incomplete and is never used
+    // as a summary; queries filter it instead.
+    const uint64_t block = sequence / ZONE_SAMPLES;
+    DensityZone& zone = density_zones[block % density_zones.size()];
+    if (zone.block != block) zone = DensityZone{block, INT_MAX, INT_MIN, 0, 0, INT_MAX};
+    zone.min_pos_mm = std::min(zone.min_pos_mm, pos_mm);
+    zone.max_pos_mm = std::max(zone.max_pos_mm, pos_mm);
+    zone.sum += density;
+    ++zone.count;
+    zone.min_density = std::min(zone.min_density, density);
+}
+
+SDM_TEMPLATE
+void SDM::SetMedianAlgorithm(MedianAlgorithm algorithm) {
+    median_algorithm.store(algorithm, std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+void SDM::ProfileGrid::reset(int first, std::size_t cells) {
+    first_mm = first;
+    sums.assign(cells, 0);
+    counts.assign(cells, 0);
+    mins.assign(cells, INT_MAX);
+}
+
+SDM_TEMPLATE
+bool SDM::ProfileGrid::add(int pos_mm, int density) {
+    const int64_t cell = int64_t(pos_mm) - first_mm;
+    if (cell < 0 || cell >= static_cast<int64_t>(sums.size())) return false;
+    sums[cell] += density;
+    ++counts[cell];
+    mins[cell] = std::min(mins[cell], density);
+    return true;
+}
+
+SDM_TEMPLATE
+void SDM::ProfileGrid::write(std::size_t from, std::size_t to, int* mean_density, int* min_density, int* sample_counts) const {
+    // Same integer mean and empty-cell zeros as CalculateDensityValues
+    for (std::size_t cell = from; cell < to; ++cell) {
+        const int count = counts[cell];
+        mean_density[cell] = count > 0 ? static_cast<int>(sums[cell] / count) : 0;
+        if (min_density) min_density[cell] = count > 0 ? mins[cell] : 0;
+        if (sample_counts) sample_counts[cell] = count;
+    }
+}
+
+SDM_TEMPLATE
+void SDM::ResampleDensityProfile(int first_mm, std::size_t cells, int* mean_density, int* min_density, int* sample_counts) {
+    QueryScratch& scratch = thread_scratch();
+    ProfileGrid& grid = scratch.profile;
+    grid.reset(first_mm, cells);
+    std::vector<int>& sample_positions = scratch.sample_positions;
+
+    auto bin = [&](const DensityView& densities) {
+        for (std::size_t i = 0; i < densities.size; ++i) grid.add(sample_positions[i], densities.values[i]);
+    };
+
+    if (snapshot_query()) {
+        Snapshot& snapshot = thread_snapshot();
+        take_snapshot(snapshot);
+        sample_positions.resize(snapshot.density.size);
+        interpolate_all_positions(QueryEngine::MergeJoin, snapshot.density, snapshot.position, sample_positions.data());
+        bin(snapshot.density);
+    } else {
+        TimedScopedLock lock(metrics.query_lock_wait, position_mutex, density_mutex);
+        if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+        trim_old_data();
+        resolve_density_positions();
+        sample_positions.resize(density_buffer.size());
+        if (precompute_positions) precomputed_positions(sample_positions.data());
+        else interpolate_all_positions(QueryEngine::MergeJoin, density_view(), position_view(), sample_positions.data());
+        bin(density_view());
+    }
+    grid.write(0, cells, mean_density, min_density, sample_counts);
+}
+
+SDM_TEMPLATE
+int SDM::TrackDensityProfile(int first_mm, std::size_t cells) {
+    // Same start-up as RegisterDensityRange: take over what is resolved, or resolve the window
+    std::scoped_lock lock(position_mutex, density_mutex);
+    if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+    trim_old_data();
+    resolve_density_positions();
+    const bool was_resolving = resolving_positions();
+
+    tracked_profiles.emplace_back();
+    TrackedProfile& profile = tracked_profiles.back();
+    profile.id = next_profile_id++;
+    profile.grid.reset(first_mm, cells);
+    profile.dirty_first = 0;
+    profile.dirty_end = cells;
+    tracked_profile_count.store(tracked_profiles.size(), std::memory_order_relaxed);
+
+    const int id = profile.id;
+    if (!was_resolving) {
+        restart_position_resolution();
+        resolve_density_positions();
+        return id;
+    }
+    const uint64_t first = density_buffer.first_sequence();
+    for (uint64_t sequence = first; sequence < resolved_end; ++sequence) {
+        profile.grid.add(resolved_position(sequence), density_buffer.value(sequence - first));
+    }
+    return id;
+}
+
+SDM_TEMPLATE
+ProfileCells SDM::UpdateDensityProfile(int profile_id, int* mean_density, int* min_density, int* sample_counts) {
+    std::scoped_lock lock(position_mutex, density_mutex);
+    if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+    trim_old_data();
+    resolve_density_positions();
+
+    for (TrackedProfile& profile : tracked_profiles) {
+        if (profile.id != profile_id) continue;
+        const ProfileCells written{profile.dirty_first, std::max(profile.dirty_first, profile.dirty_end)};
+        profile.grid.write(written.first_cell, written.end_cell, mean_density, min_density, sample_counts);
+        profile.dirty_first = profile.grid.sums.size();
+        profile.dirty_end = 0;
+        return written;
+    }
+    return ProfileCells{0, 0};
+}
+
+SDM_TEMPLATE
+void SDM::UntrackDensityProfile(int profile_id) {
+    std::lock_guard<std::mutex> lock(density_mutex);
+    tracked_profiles.erase(
+        std::remove_if(tracked_profiles.begin(), tracked_profiles.end(),
+                       [profile_id](const TrackedProfile& profile) { return profile.id == profile_id; }),
+        tracked_profiles.end());
+    tracked_profile_count.store(tracked_profiles.size(), std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+void SDM::SetParallelQueries(WorkerPool* pool, std::size_t min_samples) {
+    parallel_min_samples.store(min_samples, std::memory_order_relaxed);
+    parallel_pool.store(pool, std::memory_order_release);
+}
+
+SDM_TEMPLATE
+void SDM::Maintain() {
+    // Samples stay staged if another Maintain is still writing; producers never wait for the recorder
+    std::unique_lock<std::mutex> recording(recording_mutex, std::defer_lock);
+    {
+        std::scoped_lock lock(position_mutex, density_mutex);
+        if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+        detect_board_ends();
+        trim_old_data();
+        resolve_density_positions();
+        if (recorder && recording.try_lock()) hand_over_staged();
+    }
+    if (recording.owns_lock()) write_handed_over(false);
+}
+
+SDM_TEMPLATE
+SensorMetricsSnapshot SDM::GetMetrics() const {
+    SensorMetricsSnapshot snapshot{};
+    snapshot.enabled = SENSOR_METRICS != 0;
+    snapshot.taken_at_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(MetricsClock::now().time_since_epoch()).count();
+    snapshot.density_ingest_calls = metrics.density_ingest_calls.value();
+    snapshot.position_ingest_calls = metrics.position_ingest_calls.value();
+    snapshot.queries = metrics.queries.value();
+    snapshot.density_ingest_ns = metrics.density_ingest.snapshot();
+    snapshot.position_ingest_ns = metrics.position_ingest.snapshot();
+    snapshot.query_ns = metrics.query.snapshot();
+    snapshot.density_lock_wait_ns = metrics.density_lock_wait.snapshot();
+    snapshot.position_lock_wait_ns = metrics.position_lock_wait.snapshot();
+    snapshot.query_lock_wait_ns = metrics.query_lock_wait.snapshot();
+    snapshot.query_window_samples = metrics.query_window_samples.snapshot();
+    snapshot.densities_trimmed = metrics.densities_trimmed.value();
+    snapshot.positions_trimmed = metrics.positions_trimmed.value();
+    snapshot.density_depth = metrics.density_depth.value();
+    snapshot.peak_density_depth = metrics.density_depth.max();
+    snapshot.position_depth = metrics.position_depth.value();
+    snapshot.peak_position_depth = metrics.position_depth.max();
+    snapshot.density_ring_depth = density_ring.size();
+    snapshot.position_ring_depth = position_ring.size();
+    snapshot.dropped_samples = DroppedSamples();
+    snapshot.async_queries = metrics.async_queries.value();
+    snapshot.async_rounds = metrics.async_rounds.value();
+    snapshot.standing_updates = metrics.standing_updates.value();
+    return snapshot;
+}
+
+SDM_TEMPLATE
+void SDM::EnableBoardSegmentation(int reset_drop_mm, WorkerPool* pool) {
+    std::scoped_lock lock(position_mutex, density_mutex);
+    board_reset_drop_mm = reset_drop_mm;
+    board_pool = pool;
+    board_scan_end = position_buffer.first_sequence();
+    board_first_density = density_buffer.first_sequence();
+    board_first_position = position_buffer.first_sequence();
+    segmenting_boards.store(true, std::memory_order_relaxed);
+    detect_board_ends();
+}
+
+SDM_TEMPLATE
+void SDM::detect_board_ends() {
+    /**
+        Compares every position sample added since the last scan with its predecessor. Freezing a
+        board evicts the positions before the reset, so indices restart at the new board each time.
+    */
+    if (!segmenting_boards.load(std::memory_order_relaxed)) return;
+
+    const uint64_t end = position_buffer.end_sequence();
+    uint64_t sequence = std::max(board_scan_end, position_buffer.first_sequence() + 1);
+    for (; sequence < end; ++sequence) {
+        const std::size_t i = static_cast<std::size_t>(sequence - position_buffer.first_sequence());
+        if (position_buffer.value(i) < position_buffer.value(i - 1) - board_reset_drop_mm) freeze_board(i);
+    }
+    board_scan_end = end;
+}
+
+SDM_TEMPLATE
+void SDM::freeze_board(std::size_t reset_index) {
+    /**
+        Copies the board's density samples (everything older than the new board's first position)
+        with positions interpolated against the board's own position samples only, so samples in the
+        gap before the reset are clamped to the board's last position instead of being dragged towards
+        the next board. Then evicts the board from the live buffers and hands the copy to finalization.
+    */
+    const StoredTime boundary_us = position_buffer.time(reset_index);
+    std::size_t density_count = 0;
+    while (density_count < density_buffer.size() && density_buffer.time(density_count) < boundary_us) ++density_count;
+
+    auto segment = std::make_shared<BoardSegment>();
+    segment->positions.resize(density_count);
+    segment->densities.assign(density_buffer.values(), density_buffer.values() + density_count);
+    interpolate_positions_merged(DensityView{density_buffer.times(), density_buffer.values(), density_count},
+                                 PositionView{position_buffer.times(), position_buffer.values(), reset_index},
+                                 segment->positions.data());
+
+    BoardSummary& summary = segment->summary;
+    summary.board_id = next_board_id++;
+    summary.start_time_uS = time_base() + position_buffer.front_time();
+    summary.end_time_uS = time_base() + boundary_us;
+    summary.sample_count = static_cast<int>(density_count);
+    summary.truncated = density_buffer.first_sequence() > board_first_density ||
+                        position_buffer.first_sequence() > board_first_position;
+
+    {
+        // Reserve the board's slot so lookups by id stay O(1) whatever order finalizations finish in
+        std::lock_guard<std::mutex> lock(board_mutex);
+        finished_boards.push_back(nullptr);
+        if (finished_boards.size() > MAX_RETAINED_BOARDS) {
+            finished_boards.pop_front();
+            ++first_retained_board;
+        }
+        ++pending_boards;
+    }
+
+    for (std::size_t i = 0; i < density_count; ++i) evict_density_front();
+    for (std::size_t i = 0; i < reset_index; ++i) evict_position_front();
+    board_first_density = density_buffer.first_sequence();
+    board_first_position = position_buffer.first_sequence();
+
+    if (board_pool) board_pool->submit([this, segment] { finalize_board(segment); });
+    else finalize_board(segment);
+}
+
+SDM_TEMPLATE
+void SDM::finalize_board(std::shared_ptr<BoardSegment> segment) {
+    /**
+        Sorts the samples by position (for range lookups) and computes the whole-board statistics
+        once; then the segment is published read-only.
+    */
+    const std::size_t n = segment->densities.size();
+    std::vector<std::pair<int, int>> samples(n);
+    for (std::size_t i = 0; i < n; ++i) samples[i] = {segment->positions[i], segment->densities[i]};
+    std::sort(samples.begin(), samples.end());
+
+    BoardSummary& summary = segment->summary;
+    DensityAccumulator totals{0, 0, INT_MAX};
+    for (std::size_t i = 0; i < n; ++i) {
+        segment->positions[i] = samples[i].first;
+        segment->densities[i] = samples[i].second;
+        totals.sum += samples[i].second;
+        totals.min = std::min(totals.min, samples[i].second);
+    }
+    totals.count = static_cast<int>(n);
+    summary.min_pos_mm = n > 0 ? segment->positions.front() : 0;
+    summary.max_pos_mm = n > 0 ? segment->positions.back() : 0;
+
+    std::vector<int> densities = segment->densities;
+    summary.stats = summarize_densities(densities, totals, median_algorithm);
+
+    std::lock_guard<std::mutex> lock(board_mutex);
+    if (summary.board_id >= first_retained_board) finished_boards[summary.board_id - first_retained_board] = std::move(segment);
+    --pending_boards;
+    board_finalized.notify_all();
+}
+
+SDM_TEMPLATE
+auto SDM::find_board(uint64_t board_id) const -> std::shared_ptr<const BoardSegment> {
+    std::lock_guard<std::mutex> lock(board_mutex);
+    if (board_id < first_retained_board || board_id - first_retained_board >= finished_boards.size()) return nullptr;
+    return finished_boards[board_id - first_retained_board];
+}
+
+SDM_TEMPLATE
+uint64_t SDM::BoardsDetected() const {
+    std::lock_guard<std::mutex> lock(board_mutex);
+    return first_retained_board + finished_boards.size();
+}
+
+SDM_TEMPLATE
+bool SDM::GetBoardSummary(uint64_t board_id, BoardSummary* summary) const {
+    const std::shared_ptr<const BoardSegment> segment = find_board(board_id);
+    if (!segment) return false;
+    *summary = segment->summary;
+    return true;
+}
+
+SDM_TEMPLATE
+void SDM::EnableCompressedHistory(int64_t history_us) {
+    std::scoped_lock lock(position_mutex, density_mutex);
+    if (history) {
+        std::lock_guard<std::mutex> history_lock(history_mutex);
+        history->set_window(history_us);
+        return;
+    }
+
+    // Take over what is already resolved, or start resolving at the oldest live sample; the
+    // resolve pass at the end adds the rest
+    if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+    trim_old_data();
+    const bool was_resolving = resolving_positions();
+    {
+        std::lock_guard<std::mutex> history_lock(history_mutex);
+        history = std::make_unique<CompressedHistory>(history_us);
+
+        // Backfill the samples resolved before the history existed
+        const uint64_t first = density_buffer.first_sequence();
+        const int64_t base_us = time_base();
+        for (uint64_t sequence = first; was_resolving && sequence < resolved_end; ++sequence) {
+            const std::size_t i = static_cast<std::size_t>(sequence - first);
+            history->append(base_us + density_buffer.time(i), resolved_position(sequence), density_buffer.value(i));
+        }
+    }
+    keeping_history.store(true, std::memory_order_relaxed);
+    if (!was_resolving) restart_position_resolution();
+    resolve_density_positions();
+}
+
+SDM_TEMPLATE
+bool SDM::CalculateHistoryDensityValues(int64_t window_us, int min_pos_mm, int max_pos_mm,
+                                        int* mean_density, int* min_density, int* median_density) {
+    /**
+        Catches the history up with everything ingested so far under both stream mutexes, then
+        releases them and computes under history_mutex alone (taken before the stream mutexes are
+        released, so no newer resolve pass can interleave with the scan).
+    */
+    std::unique_lock<std::mutex> history_lock;
+    {
+        std::scoped_lock lock(position_mutex, density_mutex);
+        if (!history) return false;
+        if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+        trim_old_data();
+        resolve_density_positions();
+        history_lock = std::unique_lock<std::mutex>(history_mutex);
+    }
+
+    const int64_t cutoff_us = CompressedHistory::window_start(history->newest_time(), window_us);
+
+    std::vector<int>& relevant_densities = thread_scratch().relevant_densities;
+    const DensityAccumulator stats = history->collect(min_pos_mm, max_pos_mm, cutoff_us, relevant_densities);
+    const DensityStats result = summarize_densities(relevant_densities, stats, median_algorithm);
+    *mean_density = result.mean;
+    *min_density = result.min;
+    *median_density = result.median;
+    return true;
+}
+
+SDM_TEMPLATE
+std::size_t SDM::HistorySamples() const {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    return history ? history->samples() : 0;
+}
+
+SDM_TEMPLATE
+std::size_t SDM::HistoryBytes() const {
+    std::lock_guard<std::mutex> lock(history_mutex);
+    return history ? history->packed_bytes() : 0;
+}
+
+SDM_TEMPLATE
+bool SDM::CalculateBoardDensityValues(uint64_t board_id, int min_pos_mm, int max_pos_mm,
+                                      int* mean_density, int* min_density, int* median_density) const {
+    // The segment is immutable, so it is read without any lock once found
+    const std::shared_ptr<const BoardSegment> segment = find_board(board_id);
+    if (!segment) return false;
+
+    const auto first = std::lower_bound(segment->positions.begin(), segment->positions.end(), min_pos_mm);
+    const auto last = std::upper_bound(first, segment->positions.end(), max_pos_mm);
+    std::vector<int>& relevant_densities = thread_scratch().relevant_densities;
+    relevant_densities.assign(segment->densities.begin() + (first - segment->positions.begin()),
+                              segment->densities.begin() + (last - segment->positions.begin()));
+
+    DensityAccumulator stats{0, static_cast<int>(relevant_densities.size()), INT_MAX};
+    for (int density : relevant_densities) {
+        stats.sum += density;
+        stats.min = std::min(stats.min, density);
+    }
+    const DensityStats result = summarize_densities(relevant_densities, stats, median_algorithm);
+    *mean_density = result.mean;
+    *min_density = result.min;
+    *median_density = result.median;
+    return true;
+}
+
+SDM_TEMPLATE
+std::size_t SDM::DroppedSamples() const {
+    return dropped_samples.load(std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+std::size_t SDM::UnrecordedSamples() const {
+    return unrecorded_samples.load(std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+void SDM::SetRecorder(SampleRecorder* tap) {
+    std::unique_lock<std::mutex> recording(recording_mutex, std::defer_lock);
+    {
+        std::scoped_lock lock(position_mutex, density_mutex);
+        if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+        recording.lock();
+        hand_over_staged();
+        recorder = tap;
+        if (tap) {
+            staged_densities.reserve(RECORD_STAGE_SAMPLES);
+            staged_positions.reserve(RECORD_STAGE_SAMPLES);
+            handed_densities.reserve(2 * RECORD_STAGE_SAMPLES);
+            handed_positions.reserve(2 * RECORD_STAGE_SAMPLES);
+        }
+    }
+
+    // Everything accepted so far belongs to the previous recorder
+    write_handed_over(true);
+    recording_target = tap;
+    handed_newest_density = handed_newest_position = INT64_MIN;
+}
+
+SDM_TEMPLATE
+void SDM::stage_recorded(std::vector<SensorSample>& staged, const SensorSample* samples, std::size_t count) {
+    // The stage was reserved when recording started; samples past a full stage are only counted
+    const std::size_t kept = std::min(count, RECORD_STAGE_SAMPLES - staged.size());
+    staged.insert(staged.end(), samples, samples + kept);
+    if (kept < count) unrecorded_samples.fetch_add(count - kept, std::memory_order_relaxed);
+}
+
+SDM_TEMPLATE
+void SDM::hand_over_staged() {
+    for (const SensorSample& sample : staged_densities) handed_newest_density = std::max(handed_newest_density, sample.time_uS);
+    for (const SensorSample& sample : staged_positions) handed_newest_position = std::max(handed_newest_position, sample.time_uS);
+    handed_densities.insert(handed_densities.end(), staged_densities.begin(), staged_densities.end());
+    handed_positions.insert(handed_positions.end(), staged_positions.begin(), staged_positions.end());
+    staged_densities.clear();
+    staged_positions.clear();
+}
+
+SDM_TEMPLATE
+void SDM::write_handed_over(bool everything) {
+    /**
+        Writes the handed-over samples merged by timestamp, each stream in its own order. Unless
+        everything is due, writing stops at the older of the two streams' newest timestamps: a later
+        sample could still be preceded by one the other stream has not delivered yet. A backlog
+        larger than one stage (a stream gone silent) is written out regardless.
+    */
+    std::vector<SensorSample>& densities = handed_densities;
+    std::vector<SensorSample>& positions = handed_positions;
+    if (!recording_target) {
+        densities.clear();
+        positions.clear();
+        return;
+    }
+    if (densities.size() + positions.size() > RECORD_STAGE_SAMPLES) everything = true;
+    const int64_t watermark = everything ? INT64_MAX : std::min(handed_newest_density, handed_newest_position);
+
+    std::size_t d = 0, p = 0;
+    for (;;) {
+        const bool density_due = d < densities.size() && densities[d].time_uS <= watermark;
+        const bool position_due = p < positions.size() && positions[p].time_uS <= watermark;
+        if (density_due && (!position_due || densities[d].time_uS <= positions[p].time_uS)) {
+            recording_target->record(SampleStream::Density, densities[d].value, densities[d].time_uS);
+            ++d;
+        } else if (position_due) {
+            recording_target->record(SampleStream::Position, positions[p].value, positions[p].time_uS);
+            ++p;
+        } else {
+            break;
+        }
+    }
+    densities.erase(densities.begin(), densities.begin() + d);
+    positions.erase(positions.begin(), positions.begin() + p);
+}
+
+SDM_TEMPLATE
+void SDM::drain_ingest_rings() {
+    /**
+        Moves all samples published to the SPSC rings into the buffers, then trims once using the
+        newest timestamp seen (the same cutoff the locked path would have reached), and resolves.
+        Must be called with both stream mutexes held; they also serialize the rings' consumer side.
     */
-    while (!density_buffer.empty() && density_buffer.front().first < now_us - WINDOW_US) {
-        density_buffer.pop_front();
+    bool drained = false;
+
+    density_ring.drain([&](const SensorSample& sample) {
+        note_time(sample.time_uS);
+        if (needs_rebase(sample.time_uS)) rebase_time_base_locked();
+        append_density(to_stored(sample.time_uS), sample.value);
+        if (recorder) stage_recorded(staged_densities, &sample, 1);
+        drained = true;
+    });
+    position_ring.drain([&](const SensorSample& sample) {
+        note_time(sample.time_uS);
+        if (needs_rebase(sample.time_uS)) rebase_time_base_locked();
+        append_position(to_stored(sample.time_uS), sample.value);
+        if (recorder) stage_recorded(staged_positions, &sample, 1);
+        drained = true;
+    });
+
+    if (!drained) return;
+    detect_board_ends();
+    trim_old_data();
+    resolve_density_positions();
+}
+
+SDM_TEMPLATE
+void SDM::note_time(int64_t time_us) {
+    int64_t latest = latest_time_us.load(std::memory_order_relaxed);
+    while (time_us > latest && !latest_time_us.compare_exchange_weak(latest, time_us, std::memory_order_relaxed)) {
     }
-    while (!position_buffer.empty() && position_buffer.front().first < now_us - WINDOW_US) {
-        position_buffer.pop_front();
+}
+
+SDM_TEMPLATE
+auto SDM::to_stored(int64_t time_us) const -> StoredTime {
+    // Saturates instead of wrapping; only samples far outside the window can hit the limits
+    const int64_t relative = time_us - time_base();
+    return static_cast<StoredTime>(std::clamp<int64_t>(relative, std::numeric_limits<StoredTime>::min(),
+                                                       std::numeric_limits<StoredTime>::max()));
+}
+
+SDM_TEMPLATE
+bool SDM::needs_rebase(int64_t time_us) const {
+    if (sizeof(StoredTime) >= sizeof(int64_t)) return false;
+    return time_us - time_base() > REBASE_AFTER_US;
+}
+
+SDM_TEMPLATE
+void SDM::rebase_time_base() {
+    std::scoped_lock lock(position_mutex, density_mutex);
+    rebase_time_base_locked();
+}
+
+SDM_TEMPLATE
+void SDM::rebase_time_base_locked() {
+    /**
+        Moves the time base to 2 * WINDOW_US before the newest timestamp and shifts every stored
+        timestamp by the same amount, so the live window keeps small relative values. Runs about once
+        every REBASE_AFTER_US of operation, or once after a forward jump of the clock. Everything
+        outside the window is evicted first, so no kept timestamp can leave the stored range.
+        time_base_generation is odd while the timestamps are rewritten so snapshot readers retry.
+    */
+    // Re-check under the locks: the other stream may have rebased while we waited
+    if (!needs_rebase(latest_time())) return;
+    trim_old_data();
+
+    const int64_t new_base = latest_time() - 2 * static_cast<int64_t>(WINDOW_US);
+    const int64_t delta = new_base - time_base();
+    auto shift = [delta](StoredTime stored) {
+        return static_cast<StoredTime>(std::clamp<int64_t>(stored - delta, std::numeric_limits<StoredTime>::min(),
+                                                           std::numeric_limits<StoredTime>::max()));
+    };
+
+    const uint32_t generation = time_base_generation.load(std::memory_order_relaxed);
+    time_base_generation.store(generation + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // A capture interrupted between here and the new base would pair rewritten times with the old base
+    if (capture_file) capture_file->header().rebasing = 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    density_buffer.rewrite_times(shift);
+    position_buffer.rewrite_times(shift);
+    time_base_us.store(new_base, std::memory_order_relaxed);
+    if (capture_file) {
+        capture_file->header().time_base_us = new_base;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        capture_file->header().rebasing = 0;
     }
+
+    time_base_generation.store(generation + 2, std::memory_order_release);
+}
+
+SDM_TEMPLATE
+int64_t SDM::window_cutoff(int64_t base_us) const {
+    // Cutoff of the sliding window in stored (base-relative) time
+    return latest_time() - WINDOW_US - base_us;
 }
 
-int SensorDataManager::interpolate_position(int time_us) {
+SDM_TEMPLATE
+void SDM::trim_old_data() {
+    /**
+        Removes any measurements older than the sliding 5-second window from both buffers.
+        Caller holds both stream mutexes.
+    */
+    trim_densities(window_cutoff(time_base()));
+    trim_positions(window_cutoff(time_base()));
+}
+
+SDM_TEMPLATE
+void SDM::trim_densities(int64_t cutoff_us) {
+    const std::size_t before = density_buffer.size();
+    while (!density_buffer.empty() && density_buffer.front_time() < cutoff_us) evict_density_front();
+    metrics.densities_trimmed.add(before - density_buffer.size());
+    metrics.density_depth.set(density_buffer.size());
+}
+
+SDM_TEMPLATE
+void SDM::trim_positions(int64_t cutoff_us) {
+    const std::size_t before = position_buffer.size();
+    while (!position_buffer.empty() && position_buffer.front_time() < cutoff_us) evict_position_front();
+    metrics.positions_trimmed.add(before - position_buffer.size());
+    metrics.position_depth.set(position_buffer.size());
+}
+
+SDM_TEMPLATE
+void SDM::trim_densities_lazily() {
+    /**
+        Ingest-side trim: one comparison per sample, and a batch eviction down to the exact window
+        only once the oldest density is TRIM_SLACK_US past it. Queries trim exactly before reading.
+    */
+    const int64_t cutoff_us = window_cutoff(time_base());
+    if (!density_buffer.empty() && density_buffer.front_time() < cutoff_us - TRIM_SLACK_US) {
+        trim_densities(cutoff_us);
+        publish_standing_queries();
+    } else {
+        metrics.density_depth.set(density_buffer.size());
+    }
+}
+
+SDM_TEMPLATE
+void SDM::trim_positions_lazily() {
+    const int64_t cutoff_us = window_cutoff(time_base());
+    if (!position_buffer.empty() && position_buffer.front_time() < cutoff_us - TRIM_SLACK_US) trim_positions(cutoff_us);
+    else metrics.position_depth.set(position_buffer.size());
+}
+
+// Linear interpolation between the bracketing position samples i - 1 and i; shared by all query
+// engines so they round identically.
+template <typename TimeT>
+static int lerp_position(const TimeT* times, const int* positions, std::size_t i, TimeT time_us) {
+    // Computes how far between the two known position timestamps before and after our target time_us falls.
+    // (differences taken in 64 bits so saturated outliers cannot overflow)
+    double ratio = (double)((int64_t)time_us - times[i - 1]) / ((int64_t)times[i] - times[i - 1]);
+    // Linearly interpolate the position of the board at time_us using the ratio
+    return static_cast<int>(positions[i - 1] + ratio * (positions[i] - positions[i - 1]));
+}
+
+SDM_TEMPLATE
+int SDM::interpolate_position(const PositionView& positions, StoredTime time_us) {
     /**
         Interpolates the board position at a given timestamp using the two nearest position samples.
         Falls back to bounds if requested time is outside the known range.
 
+        @param positions - Position samples to interpolate between
         @param time_us - The timestamp in microseconds to interpolate for.
         @return Estimated position in mm at the given timestamp.
     */
 
-    // Compare function used in std::lower_bound:
-    // Returns true if the entry timestamp is still less than the one we’re searching for.
-    auto compareTime = [](const std::pair<int, int>& entry, int timestamp) {
-        return entry.first < timestamp;
-    };
-
     // Return early if there’s no data
-    if (position_buffer.empty()) return -1;
+    if (positions.size == 0) return -1;
 
     // Clamp if the time is outside our known position range
-    if (time_us <= position_buffer.front().first) 
-        return position_buffer.front().second;
+    if (time_us <= positions.times[0])
+        return positions.values[0];
 
-    if (time_us >= position_buffer.back().first) 
-        return position_buffer.back().second;
+    if (time_us >= positions.times[positions.size - 1])
+        return positions.values[positions.size - 1];
 
-    // Find the pointer to the timestamp which is >= time_us in the position buffer
-    auto after = std::lower_bound(position_buffer.begin(), position_buffer.end(), time_us, compareTime);
-    // The pointer just before is the timestamp which is < time_us in the position buffer
-    auto before = after - 1;
+    // Find the first timestamp which is >= time_us in the (contiguous) position timestamp array;
+    // the entry just before it is the timestamp which is < time_us
+    const StoredTime* times = positions.times;
+    std::size_t after = std::lower_bound(times, times + positions.size, time_us) - times;
 
-    // Computes how far between the two known position timestamps before and after our target time_us falls.
-    double ratio = (double)(time_us - before->first) / (after->first - before->first);
-    // Linearly interpolate the position of the board at time_us using the ratio
-    return static_cast<int>(before->second + ratio * (after->second - before->second));
+    return lerp_position(times, positions.values, after, time_us);
 }
 
-void SensorDataManager::CalculateDensityValues(int min_pos_mm, int max_pos_mm, int* mean_density, int* min_density, int* median_density) {
+SDM_TEMPLATE
+void SDM::interpolate_positions_merged(const DensityView& densities, const PositionView& positions, int* positions_out) {
+    /**
+        Merge-join of the two time-sorted buffers. The `after` cursor only ever moves forward, so the
+        whole pass costs O(N + M) instead of one binary search per density sample. Clamping and the
+        lower_bound bracket choice mirror interpolate_position sample for sample.
+    */
+    const StoredTime* density_times = densities.times;
+    const std::size_t density_count = densities.size;
+
+    if (positions.size == 0) {
+        std::fill(positions_out, positions_out + density_count, -1);
+        return;
+    }
+
+    const StoredTime* position_times = positions.times;
+    const int* position_values = positions.values;
+    const std::size_t position_count = positions.size;
+    const StoredTime front_us = position_times[0];
+    const StoredTime back_us = position_times[position_count - 1];
+    std::size_t after = 0;
+    StoredTime previous_us = std::numeric_limits<StoredTime>::min();
+
+    for (std::size_t i = 0; i < density_count; ++i) {
+        const StoredTime timestamp = density_times[i];
+        int pos;
+        if (timestamp <= front_us) {
+            pos = position_values[0];
+        } else if (timestamp >= back_us) {
+            pos = position_values[position_count - 1];
+        } else {
+            // Out-of-order density sample: re-seat the cursor with a binary search
+            if (timestamp < previous_us)
+                after = std::lower_bound(position_times, position_times + position_count, timestamp) - position_times;
+            // Advance to the first position sample with timestamp >= this density sample
+            while (position_times[after] < timestamp) ++after;
+            pos = lerp_position(position_times, position_values, after, timestamp);
+        }
+        previous_us = timestamp;
+        positions_out[i] = pos;
+    }
+}
+
+SDM_TEMPLATE
+void SDM::interpolate_all_positions(QueryEngine engine, const DensityView& densities, const PositionView& positions,
+                                                  int* positions_out) {
+    if (engine == QueryEngine::BinarySearch) {
+        // Interpolate the position in mm of every density reading in the density buffer
+        for (std::size_t i = 0; i < densities.size; ++i) positions_out[i] = interpolate_position(positions, densities.times[i]);
+        return;
+    }
+    // MergeJoin, and RangeSearch's full-scan fallback: one linear pass over both buffers
+    interpolate_positions_merged(densities, positions, positions_out);
+}
+
+SDM_TEMPLATE
+auto SDM::thread_snapshot() -> Snapshot& {
+    static thread_local Snapshot snapshot;
+    return snapshot;
+}
+
+SDM_TEMPLATE
+auto SDM::thread_scratch() -> QueryScratch& {
+    static thread_local QueryScratch scratch;
+    return scratch;
+}
+
+SDM_TEMPLATE
+void SDM::take_snapshot(Snapshot& snapshot) {
+    /**
+        Copies the position buffer, then the density buffer, each validated by SampleRing::try_snapshot.
+        The two copies are taken a few microseconds apart; density samples newer than the newest
+        copied position are clamped to it exactly as they would be under the lock. If writers keep
+        lapping the copy (SNAPSHOT_ATTEMPTS times), the copy is taken under the stream mutexes instead.
+        The copies may still hold up to TRIM_SLACK_US of samples the producers have not evicted yet;
+        those are cut from the views, so the result matches an exactly trimmed buffer.
+    */
+    if (ingest_mode == IngestMode::LockFree && (density_ring.size() > 0 || position_ring.size() > 0)) {
+        TimedScopedLock lock(metrics.query_lock_wait, position_mutex, density_mutex);
+        drain_ingest_rings();
+    }
+
+    // Capacities are fixed, so this only allocates on a thread's first snapshot
+    snapshot.density_times.resize(density_buffer.capacity());
+    snapshot.densities.resize(density_buffer.capacity());
+    snapshot.position_times.resize(position_buffer.capacity());
+    snapshot.positions.resize(position_buffer.capacity());
+
+    std::size_t density_count = 0, position_count = 0;
+    int64_t base_us = 0;
+    auto copy = [&] {
+        // A time-base rebase rewrites every timestamp, so it invalidates the copy like a lapping writer
+        const uint32_t generation = time_base_generation.load(std::memory_order_acquire);
+        if (generation & 1) return false;
+        const bool copied =
+            position_buffer.try_snapshot(snapshot.position_times.data(), snapshot.positions.data(), position_count) &&
+            density_buffer.try_snapshot(snapshot.density_times.data(), snapshot.densities.data(), density_count);
+        base_us = time_base();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return copied && time_base_generation.load(std::memory_order_relaxed) == generation;
+    };
+
+    bool consistent = false;
+    for (int attempt = 0; attempt < SNAPSHOT_ATTEMPTS && !consistent; ++attempt) consistent = copy();
+    if (!consistent) {
+        TimedScopedLock lock(metrics.query_lock_wait, position_mutex, density_mutex);
+        copy();
+    }
+
+    // Drop the stale prefix exactly as trim_old_data would
+    const int64_t cutoff_us = window_cutoff(base_us);
+    std::size_t density_first = 0, position_first = 0;
+    while (density_first < density_count && snapshot.density_times[density_first] < cutoff_us) ++density_first;
+    while (position_first < position_count && snapshot.position_times[position_first] < cutoff_us) ++position_first;
+
+    snapshot.density = {snapshot.density_times.data() + density_first, snapshot.densities.data() + density_first,
+                        density_count - density_first};
+    snapshot.position = {snapshot.position_times.data() + position_first, snapshot.positions.data() + position_first,
+                         position_count - position_first};
+    snapshot.monotonic = std::is_sorted(snapshot.position.values, snapshot.position.values + snapshot.position.size) &&
+                         std::is_sorted(snapshot.density.times, snapshot.density.times + snapshot.density.size);
+}
+
+SDM_TEMPLATE
+void SDM::CalculateDensityValues(int min_pos_mm, int max_pos_mm, int* mean_density, int* min_density, int* median_density) {
     /**
         Asynchronous query function that computes the mean, min, and median density values for all
         density samples whose interpolated position falls within [min_pos_mm, max_pos_mm].
@@ -97,42 +1533,655 @@ void SensorDataManager::CalculateDensityValues(int min_pos_mm, int max_pos_mm, i
         @param min_density - Output pointer for the minimum density.
         @param median_density - Output pointer for the median density.
     */
+    metrics.queries.add(1);
+    CallTimer timer(metrics.query);
+    DensityStats stats;
+
+    if (snapshot_query()) {
+        // Compute on a private copy: no lock held while interpolating, filtering and ranking
+        Snapshot& snapshot = thread_snapshot();
+        take_snapshot(snapshot);
+        metrics.query_window_samples.record(snapshot.density.size);
+        WorkerPool* pool = parallel_pool_for(snapshot.density.size);
+        if (pool && !(query_engine == QueryEngine::RangeSearch && snapshot.monotonic)) {
+            stats = scan_parallel(*pool, snapshot.density, snapshot.position, nullptr, 0, min_pos_mm, max_pos_mm);
+        } else {
+            const DensityAccumulator matches = collect_density_range(snapshot.density, snapshot.position, snapshot.monotonic,
+                                                                     query_engine, min_pos_mm, max_pos_mm);
+            stats = summarize_densities(thread_scratch().relevant_densities, matches, median_algorithm);
+        }
+    } else {
+        // Lock access to both buffers
+        TimedScopedLock lock(metrics.query_lock_wait, position_mutex, density_mutex);
 
-    // Lock access to shared data
-    std::lock_guard<std::mutex> lock(data_mutex);
+        // Pick up anything the producers published without locking, evict what left the window
+        // since the last batch trim, and resolve registered ranges up to the newest position
+        if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+        trim_old_data();
+        resolve_density_positions();
+        metrics.query_window_samples.record(density_buffer.size());
 
-    // relevant_densities: Stores all the densities that fall within the requested board section
-    // sum, count: Used to compute the mean
-    // min_val: Used to track the minimum density value
-    std::vector<int> relevant_densities;
-    relevant_densities.reserve(density_buffer.size());
-    int sum = 0, count = 0, min_val = INT_MAX;
+        // Registered ranges are answered from their incrementally maintained statistics
+        if (query_registered_range(min_pos_mm, max_pos_mm, mean_density, min_density, median_density)) return;
 
-    // Iterate through all [timestamp, density] pairs in the density buffer
-    for (const auto& [timestamp, current_density] : density_buffer) {
-        // Interpolate the position in mm of this density reading
-        int pos = interpolate_position(timestamp);
-        // Only include this sample if the estimated position is inside the [min_pos_mm, max_pos_mm] interval
-        if (pos >= min_pos_mm && pos <= max_pos_mm) {
-            // Add to working set
-            relevant_densities.push_back(current_density);
-            sum += current_density;
-            min_val = std::min(min_val, current_density);
-            ++count;
+        // Indexed queries fall back to the precomputed scan when the index cannot see every sample
+        const bool indexed = index_positions && query_position_index(min_pos_mm, max_pos_mm, stats);
+        const bool monotonic = position_descents == 0 && density_time_inversions == 0;
+        WorkerPool* pool = indexed || zone_positions ? nullptr : parallel_pool_for(density_buffer.size());
+        if (pool && (precompute_positions || !(query_engine == QueryEngine::RangeSearch && monotonic))) {
+            const std::size_t resolved = precompute_positions ? static_cast<std::size_t>(resolved_end - density_buffer.first_sequence()) : 0;
+            stats = scan_parallel(*pool, density_view(), position_view(), precompute_positions ? resolved_column() : nullptr, resolved,
+                                  min_pos_mm, max_pos_mm);
+        } else if (!indexed) {
+            stats = summarize_densities(thread_scratch().relevant_densities, collect_locked_range(min_pos_mm, max_pos_mm),
+                                        median_algorithm);
         }
     }
 
-    if (count == 0) {
-        // If no densities matched the position interval, just set all stats to zero
-        *mean_density = *min_density = *median_density = 0;
+    *mean_density = stats.mean;
+    *min_density = stats.min;
+    *median_density = stats.median;
+}
+
+SDM_TEMPLATE
+DensityReport SDM::CalculateDensityReport(int min_pos_mm, int max_pos_mm, std::initializer_list<double> percentiles) {
+    if (percentiles.size() > MAX_REPORT_PERCENTILES) throw std::invalid_argument("too many percentiles");
+    for (double p : percentiles) {
+        if (!(p >= 0 && p <= 100)) throw std::invalid_argument("percentile outside [0, 100]");
+    }
+
+    metrics.queries.add(1);
+    CallTimer timer(metrics.query);
+    std::vector<int>& relevant_densities = thread_scratch().relevant_densities;
+
+    if (snapshot_query()) {
+        Snapshot& snapshot = thread_snapshot();
+        take_snapshot(snapshot);
+        metrics.query_window_samples.record(snapshot.density.size);
+        const DensityAccumulator matches = collect_density_range(snapshot.density, snapshot.position, snapshot.monotonic,
+                                                                 query_engine, min_pos_mm, max_pos_mm);
+        return report_densities(relevant_densities, matches, median_algorithm, percentiles);
+    }
+
+    TimedScopedLock lock(metrics.query_lock_wait, position_mutex, density_mutex);
+    if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+    trim_old_data();
+    resolve_density_positions();
+    metrics.query_window_samples.record(density_buffer.size());
+    return report_densities(relevant_densities, collect_locked_range(min_pos_mm, max_pos_mm), median_algorithm, percentiles);
+}
+
+SDM_TEMPLATE
+DensityAccumulator SDM::collect_locked_range(int min_pos_mm, int max_pos_mm) const {
+    if (zone_positions) return collect_zoned_range(min_pos_mm, max_pos_mm);
+    if (precompute_positions) return collect_precomputed_range(min_pos_mm, max_pos_mm);
+    return collect_density_range(density_view(), position_view(), position_descents == 0 && density_time_inversions == 0,
+                                 query_engine, min_pos_mm, max_pos_mm);
+}
+
+SDM_TEMPLATE
+DensityAccumulator SDM::collect_density_range(const DensityView& densities, const PositionView& positions, bool monotonic,
+                                              QueryEngine engine, int min_pos_mm, int max_pos_mm) {
+    // relevant_densities: Receives the densities that fall within the requested board section
+    // (compaction target, so sized for the whole buffer up front)
+    // sample_positions: Interpolated position of every density sample for the full-scan engines
+    const std::size_t n = densities.size;
+    QueryScratch& scratch = thread_scratch();
+    std::vector<int>& relevant_densities = scratch.relevant_densities;
+    relevant_densities.resize(n);
+    DensityAccumulator stats{0, 0, INT_MAX};
+    std::vector<int>& sample_positions = scratch.sample_positions;
+
+    if (engine == QueryEngine::RangeSearch && monotonic) {
+        // With a non-decreasing position track the interpolated position is non-decreasing in time,
+        // so the matching samples form one contiguous run of the density buffer. Find both ends by
+        // binary search (each probe is itself a binary search in the position buffer).
+        auto below_min = [&](StoredTime timestamp) { return interpolate_position(positions, timestamp) < min_pos_mm; };
+        auto not_above_max = [&](StoredTime timestamp) { return interpolate_position(positions, timestamp) <= max_pos_mm; };
+
+        const StoredTime* times = densities.times;
+        const StoredTime* first = std::partition_point(times, times + n, below_min);
+        const StoredTime* last = std::partition_point(first, times + n, not_above_max);
+
+        // Every sample of the run matches: plain copy and reduction, no position test
+        for (const DensityT* sample = densities.values + (first - times); sample != densities.values + (last - times); ++sample) {
+            const int density = *sample;
+            relevant_densities[stats.count++] = density;
+            stats.sum += density;
+            stats.min = std::min(stats.min, density);
+        }
+    } else {
+        // BinarySearch, MergeJoin, or RangeSearch after the board reversed (or data arrived out of
+        // order) inside the window: full scan
+        sample_positions.resize(n);
+        interpolate_all_positions(engine, densities, positions, sample_positions.data());
+
+        // Only include samples whose estimated position is inside the [min_pos_mm, max_pos_mm] interval:
+        // masked sum, masked min and compaction in one vectorized pass
+        stats = filter_reduce_densities(sample_positions.data(), densities.values, n, min_pos_mm, max_pos_mm,
+                                        relevant_densities.data());
+    }
+    return stats;
+}
+
+SDM_TEMPLATE
+DensityStats SDM::summarize_densities(std::vector<int>& relevant_densities, const DensityAccumulator& stats,
+                                      MedianAlgorithm algorithm) {
+    const int count = stats.count;
+    relevant_densities.resize(count);
+
+    // If no densities matched the position interval, just set all stats to zero
+    if (count == 0) return DensityStats{0, 0, 0};
+
+    // Compute the median density using the selected strategy (NthElement by default,
+    // which partially sorts the vector in average O(n) for efficient median extraction)
+    const int median = MedianStrategy::compute(relevant_densities, algorithm);
+
+    return DensityStats{static_cast<int>(stats.sum / count), stats.min, median};
+}
+
+SDM_TEMPLATE
+DensityStats SDM::scan_parallel(WorkerPool& pool, const DensityView& densities, const PositionView& positions,
+                                const int* resolved, std::size_t resolved_count, int min_pos_mm, int max_pos_mm) {
+    /**
+        Three parallel passes over the chunks, with short serial merges in between:
+        1. positions, filter and the chunk's sum / count / min / max (its matches are compacted to
+           the start of the chunk's own stretch of relevant_densities);
+        2. a histogram of each chunk's matches over [min, max] in PARALLEL_SELECT_BUCKETS buckets;
+           the merged counts give the bucket holding the median (element count / 2 of the sorted
+           matches) and its rank within that bucket;
+        3. unless a bucket is a single value, each chunk gathers its values of that bucket, and
+           nth_element picks the median among them (about count / PARALLEL_SELECT_BUCKETS values
+           for spread-out densities).
+    */
+    const std::size_t n = densities.size;
+    const std::size_t chunk_count = (n + PARALLEL_QUERY_CHUNK - 1) / PARALLEL_QUERY_CHUNK;
+    QueryScratch& scratch = thread_scratch();
+    std::vector<int>& matches = scratch.relevant_densities;
+    std::vector<int>& sample_positions = scratch.sample_positions;
+    std::vector<ParallelChunk>& chunks = scratch.parallel_chunks;
+    matches.resize(n);
+    if (resolved_count < n) sample_positions.resize(n);
+    chunks.resize(chunk_count);
+
+    pool.parallel_for(chunk_count, [&](std::size_t c) {
+        const std::size_t begin = c * PARALLEL_QUERY_CHUNK;
+        const std::size_t size = std::min(PARALLEL_QUERY_CHUNK, n - begin);
+        const int* chunk_positions;
+        if (begin + size <= resolved_count) {
+            chunk_positions = resolved + begin;
+        } else {
+            int* out = sample_positions.data() + begin;
+            for (std::size_t i = begin; i < begin + size; ++i) {
+                *out++ = i < resolved_count ? resolved[i] : interpolate_position(positions, densities.times[i]);
+            }
+            chunk_positions = sample_positions.data() + begin;
+        }
+        int* chunk_matches = matches.data() + begin;
+        const DensityAccumulator part = filter_reduce_densities(chunk_positions, densities.values + begin, size,
+                                                                min_pos_mm, max_pos_mm, chunk_matches);
+        int max = INT_MIN;
+        for (int i = 0; i < part.count; ++i) max = std::max(max, chunk_matches[i]);
+        chunks[c] = ParallelChunk{part, max, 0};
+    });
+
+    DensityAccumulator total{0, 0, INT_MAX};
+    int max = INT_MIN;
+    for (const ParallelChunk& chunk : chunks) {
+        total.sum += chunk.stats.sum;
+        total.count += chunk.stats.count;
+        total.min = std::min(total.min, chunk.stats.min);
+        max = std::max(max, chunk.max);
+    }
+    if (total.count == 0) return DensityStats{0, 0, 0};
+
+    // Bucket width 2^shift, the narrowest that fits [min, max] into the buckets
+    const uint64_t spread = static_cast<uint64_t>(int64_t(max) - total.min);
+    int shift = 0;
+    while ((spread >> shift) >= PARALLEL_SELECT_BUCKETS) ++shift;
+    auto bucket_of = [&](int density) { return static_cast<std::size_t>(static_cast<uint64_t>(int64_t(density) - total.min) >> shift); };
+
+    std::vector<uint32_t>& histograms = scratch.parallel_histograms;
+    histograms.assign(chunk_count * PARALLEL_SELECT_BUCKETS, 0);
+    pool.parallel_for(chunk_count, [&](std::size_t c) {
+        uint32_t* histogram = histograms.data() + c * PARALLEL_SELECT_BUCKETS;
+        const int* chunk_matches = matches.data() + c * PARALLEL_QUERY_CHUNK;
+        for (int i = 0; i < chunks[c].stats.count; ++i) ++histogram[bucket_of(chunk_matches[i])];
+    });
+
+    const std::size_t rank = static_cast<std::size_t>(total.count / 2);
+    std::size_t bucket = 0, below = 0, in_bucket = 0;
+    for (;; ++bucket) {
+        in_bucket = 0;
+        for (std::size_t c = 0; c < chunk_count; ++c) in_bucket += histograms[c * PARALLEL_SELECT_BUCKETS + bucket];
+        if (rank < below + in_bucket) break;
+        below += in_bucket;
+    }
+
+    int median;
+    if (shift == 0) {
+        // One density per bucket
+        median = static_cast<int>(total.min + static_cast<int64_t>(bucket));
+    } else {
+        std::size_t offset = 0;
+        for (std::size_t c = 0; c < chunk_count; ++c) {
+            chunks[c].selection_offset = offset;
+            offset += histograms[c * PARALLEL_SELECT_BUCKETS + bucket];
+        }
+        std::vector<int>& selection = scratch.parallel_selection;
+        selection.resize(in_bucket);
+        pool.parallel_for(chunk_count, [&](std::size_t c) {
+            const int* chunk_matches = matches.data() + c * PARALLEL_QUERY_CHUNK;
+            int* out = selection.data() + chunks[c].selection_offset;
+            for (int i = 0; i < chunks[c].stats.count; ++i) {
+                if (bucket_of(chunk_matches[i]) == bucket) *out++ = chunk_matches[i];
+            }
+        });
+        std::nth_element(selection.begin(), selection.begin() + static_cast<std::ptrdiff_t>(rank - below), selection.end());
+        median = selection[rank - below];
+    }
+    return DensityStats{static_cast<int>(total.sum / total.count), total.min, median};
+}
+
+SDM_TEMPLATE
+DensityReport SDM::report_densities(std::vector<int>& relevant_densities, const DensityAccumulator& stats,
+                                    MedianAlgorithm algorithm, std::initializer_list<double> percentiles) {
+    /**
+        One pass over the matches for max and variance (squared deviations from the exact mean, so
+        the sum of squares cannot overflow or cancel), then the median with the selected strategy
+        and the percentiles in ascending rank order: each nth_element call only works on the part
+        above the previous rank.
+    */
+    DensityReport report{};
+    report.percentile_count = percentiles.size();
+    const int count = stats.count;
+    relevant_densities.resize(count);
+    if (count == 0) return report;
+
+    report.count = count;
+    report.sum = stats.sum;
+    report.min = stats.min;
+    report.mean = static_cast<double>(stats.sum) / count;
+    int max = INT_MIN;
+    double squares = 0;
+    for (int density : relevant_densities) {
+        max = std::max(max, density);
+        const double deviation = density - report.mean;
+        squares += deviation * deviation;
+    }
+    report.max = max;
+    report.variance = squares / count;
+    report.median = MedianStrategy::compute(relevant_densities, algorithm);
+
+    // Requested percentiles in ascending rank order (a handful, so insertion sort)
+    std::size_t ranks[MAX_REPORT_PERCENTILES], order[MAX_REPORT_PERCENTILES];
+    std::size_t requested = 0;
+    for (double p : percentiles) {
+        ranks[requested] = std::min(static_cast<std::size_t>(p * count / 100), static_cast<std::size_t>(count - 1));
+        order[requested] = requested;
+        ++requested;
+    }
+    for (std::size_t k = 1; k < requested; ++k) {
+        for (std::size_t j = k; j > 0 && ranks[order[j - 1]] > ranks[order[j]]; --j) std::swap(order[j - 1], order[j]);
+    }
+
+    auto from = relevant_densities.begin();
+    for (std::size_t k = 0; k < requested; ++k) {
+        const auto nth = relevant_densities.begin() + static_cast<std::ptrdiff_t>(ranks[order[k]]);
+        if (nth >= from) {
+            std::nth_element(from, nth, relevant_densities.end());
+            from = nth + 1;
+        }
+        report.percentiles[order[k]] = *nth;
+    }
+    return report;
+}
+
+SDM_TEMPLATE
+DensityAccumulator SDM::collect_precomputed_range(int min_pos_mm, int max_pos_mm) const {
+    /**
+        One filter/reduce pass over the resolved (position, density) columns; no interpolation except
+        for the unresolved tail, i.e. the samples newer than the newest position sample (clamped to it)
+        and any that arrived out of order behind them.
+    */
+    const std::size_t n = density_buffer.size();
+    const std::size_t resolved = static_cast<std::size_t>(resolved_end - density_buffer.first_sequence());
+    std::vector<int>& relevant_densities = thread_scratch().relevant_densities;
+    relevant_densities.resize(n);
+
+    DensityAccumulator stats = filter_reduce_densities(resolved_column(), density_buffer.values(), resolved,
+                                                       min_pos_mm, max_pos_mm, relevant_densities.data());
+
+    for (std::size_t i = resolved; i < n; ++i) {
+        const int pos = interpolate_position(density_buffer.time(i));
+        if (pos < min_pos_mm || pos > max_pos_mm) continue;
+        const int density = density_buffer.value(i);
+        relevant_densities[stats.count++] = density;
+        stats.sum += density;
+        stats.min = std::min(stats.min, density);
+    }
+
+    return stats;
+}
+
+SDM_TEMPLATE
+bool SDM::query_position_index(int min_pos_mm, int max_pos_mm, DensityStats& stats) {
+    /**
+        Index walk for the resolved samples; the unresolved tail is interpolated and merged in as
+        extra values. Any sample outside the index domains (indexed or in the tail) means the index
+        would miss it, so the caller scans instead.
+    */
+    if (!position_index->exact()) return false;
+
+    std::vector<int>& tail = thread_scratch().tail;
+    tail.clear();
+    for (std::size_t i = resolved_end - density_buffer.first_sequence(); i < density_buffer.size(); ++i) {
+        const int pos = interpolate_position(density_buffer.time(i));
+        const int density = density_buffer.value(i);
+        if (pos < 0 || pos >= SENSOR_POSITION_DOMAIN_MM || density < 0 || density >= DENSITY_DOMAIN) return false;
+        if (pos >= min_pos_mm && pos <= max_pos_mm) tail.push_back(density);
+    }
+
+    const typename DensityPositionIndex::Stats found = position_index->query(min_pos_mm, max_pos_mm, tail.data(), tail.size());
+    if (found.count == 0) stats = DensityStats{0, 0, 0};
+    else stats = DensityStats{static_cast<int>(found.sum / found.count), found.min, found.median};
+    return true;
+}
+
+SDM_TEMPLATE
+DensityAccumulator SDM::collect_zoned_range(int min_pos_mm, int max_pos_mm) const {
+    /**
+        collect_precomputed_range with block skipping. Only blocks lying entirely within the resolved
+        part of the window have complete summaries; the partial blocks at either end of it go
+        through the filter like straddling blocks, and the unresolved tail is interpolated.
+    */
+    const uint64_t first = density_buffer.first_sequence();
+    const std::size_t n = density_buffer.size();
+    std::vector<int>& relevant_densities = thread_scratch().relevant_densities;
+    relevant_densities.resize(n);
+    const int* column = resolved_column();
+    const DensityT* values = density_buffer.values();
+
+    DensityAccumulator stats{0, 0, INT_MAX};
+    auto filter = [&](uint64_t from, uint64_t to) {
+        if (from >= to) return;
+        const std::size_t offset = static_cast<std::size_t>(from - first);
+        const DensityAccumulator part = filter_reduce_densities(column + offset, values + offset, static_cast<std::size_t>(to - from),
+                                                                min_pos_mm, max_pos_mm, relevant_densities.data() + stats.count);
+        stats.sum += part.sum;
+        stats.count += part.count;
+        stats.min = std::min(stats.min, part.min);
+    };
+
+    // Complete blocks: [first_block, end_block)
+    const uint64_t first_block = (first + ZONE_SAMPLES - 1) / ZONE_SAMPLES;
+    const uint64_t end_block = resolved_end / ZONE_SAMPLES;
+    if (first_block >= end_block) {
+        filter(first, resolved_end);
+    } else {
+        filter(first, first_block * ZONE_SAMPLES);
+        for (uint64_t block = first_block; block < end_block; ++block) {
+            const DensityZone& zone = density_zones[block % density_zones.size()];
+            if (zone.max_pos_mm < min_pos_mm || zone.min_pos_mm > max_pos_mm) continue;
+            if (zone.min_pos_mm < min_pos_mm || zone.max_pos_mm > max_pos_mm) {
+                filter(block * ZONE_SAMPLES, (block + 1) * ZONE_SAMPLES);
+                continue;
+            }
+            // Entirely in range: the summary has the reductions, the values are only needed for the median
+            const DensityT* block_values = values + (block * ZONE_SAMPLES - first);
+            std::copy(block_values, block_values + ZONE_SAMPLES, relevant_densities.data() + stats.count);
+            stats.sum += zone.sum;
+            stats.count += zone.count;
+            stats.min = std::min(stats.min, zone.min_density);
+        }
+        filter(end_block * ZONE_SAMPLES, resolved_end);
+    }
+
+    for (std::size_t i = static_cast<std::size_t>(resolved_end - first); i < n; ++i) {
+        const int pos = interpolate_position(density_buffer.time(i));
+        if (pos < min_pos_mm || pos > max_pos_mm) continue;
+        const int density = density_buffer.value(i);
+        relevant_densities[stats.count++] = density;
+        stats.sum += density;
+        stats.min = std::min(stats.min, density);
+    }
+
+    return stats;
+}
+
+SDM_TEMPLATE
+void SDM::precomputed_positions(int* positions_out) const {
+    const std::size_t n = density_buffer.size();
+    const std::size_t resolved = static_cast<std::size_t>(resolved_end - density_buffer.first_sequence());
+    std::copy(resolved_column(), resolved_column() + resolved, positions_out);
+    for (std::size_t i = resolved; i < n; ++i) positions_out[i] = interpolate_position(density_buffer.time(i));
+}
+
+SDM_TEMPLATE
+void SDM::CalculateDensityValuesBatch(const DensityRange* ranges, DensityStats* results, std::size_t range_count) {
+    /**
+        Batched form of CalculateDensityValues for consecutive board sections.
+
+        @param ranges - Position ranges to evaluate
+        @param results - One output per range
+        @param range_count - Number of ranges
+    */
+    if (range_count == 0) return;
+    // One query per range, one timing sample for the whole batch
+    metrics.queries.add(range_count);
+    CallTimer timer(metrics.query);
+
+    // Ranges not served by a registered range
+    QueryScratch& scratch = thread_scratch();
+    std::vector<std::size_t>& order = scratch.order;
+    order.clear();
+
+    // Interpolated position of every density sample, shared by all scanned ranges
+    std::vector<int>& sample_positions = scratch.sample_positions;
+
+    if (snapshot_query()) {
+        for (std::size_t r = 0; r < range_count; ++r) order.push_back(r);
+        Snapshot& snapshot = thread_snapshot();
+        take_snapshot(snapshot);
+        sample_positions.resize(snapshot.density.size);
+        interpolate_all_positions(query_engine, snapshot.density, snapshot.position, sample_positions.data());
+        scan_density_ranges(snapshot.density, sample_positions.data(), median_algorithm, ranges, results, order);
         return;
     }
 
-    // Compute the median density using the selected strategy (NthElement by default),
-    // which partially sorts the vector in average O(n) for efficient median extraction
-    int median = MedianStrategy::compute(relevant_densities, MedianAlgorithm::NthElement);
+    TimedScopedLock lock(metrics.query_lock_wait, position_mutex, density_mutex);
+    if (ingest_mode == IngestMode::LockFree) drain_ingest_rings();
+    trim_old_data();
+    resolve_density_positions();
 
-    *mean_density = sum / count;
-    *min_density = min_val;
-    *median_density = median;
-}
\ No newline at end of file
+    for (std::size_t r = 0; r < range_count; ++r) {
+        DensityStats& out = results[r];
+        if (query_registered_range(ranges[r].min_pos_mm, ranges[r].max_pos_mm, &out.mean, &out.min, &out.median)) continue;
+        // Indexed ranges cost O(log) each, so they are answered one by one instead of bucketed
+        if (index_positions && query_position_index(ranges[r].min_pos_mm, ranges[r].max_pos_mm, out)) continue;
+        order.push_back(r);
+    }
+    if (order.empty()) return;
+
+    sample_positions.resize(density_buffer.size());
+    if (precompute_positions) precomputed_positions(sample_positions.data());
+    else interpolate_all_positions(query_engine, density_view(), position_view(), sample_positions.data());
+    scan_density_ranges(density_view(), sample_positions.data(), median_algorithm, ranges, results, order);
+}
+
+SDM_TEMPLATE
+std::future<DensityStats> SDM::CalculateDensityValuesAsync(int min_pos_mm, int max_pos_mm) {
+    // From a callback on the query pool the future may be waited for by the very thread meant to
+    // answer it, so it is answered here instead
+    if (callback_pool() == &async_workers()) {
+        std::promise<DensityStats> answered;
+        DensityStats stats;
+        CalculateDensityValues(min_pos_mm, max_pos_mm, &stats.mean, &stats.min, &stats.median);
+        answered.set_value(stats);
+        return answered.get_future();
+    }
+
+    auto promise = std::make_shared<std::promise<DensityStats>>();
+    std::future<DensityStats> result = promise->get_future();
+    submit_async_query(min_pos_mm, max_pos_mm, [promise](const DensityStats& stats) { promise->set_value(stats); });
+    return result;
+}
+
+SDM_TEMPLATE
+void SDM::CalculateDensityValuesAsync(int min_pos_mm, int max_pos_mm, std::function<void(const DensityStats&)> on_done) {
+    submit_async_query(min_pos_mm, max_pos_mm, std::move(on_done));
+}
+
+SDM_TEMPLATE
+void SDM::submit_async_query(int min_pos_mm, int max_pos_mm, std::function<void(const DensityStats&)> on_done) {
+    WorkerPool& workers = async_workers();
+
+    bool start_drain;
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        async_queries.push_back({DensityRange{min_pos_mm, max_pos_mm}, std::move(on_done)});
+        // A busy worker picks the request up in its next round; only idle workers need waking
+        start_drain = async_drains < std::min(workers.thread_count(), ASYNC_QUERY_WORKERS);
+        if (start_drain) ++async_drains;
+    }
+    if (start_drain) workers.submit([this, &workers] { drain_async_queries(workers); });
+}
+
+SDM_TEMPLATE
+void SDM::SetAsyncWorkers(WorkerPool* pool, WorkerPool* delivery_pool) {
+    external_async_pool.store(pool, std::memory_order_release);
+    external_delivery_pool.store(delivery_pool, std::memory_order_release);
+}
+
+SDM_TEMPLATE
+WorkerPool& SDM::async_workers() {
+    if (WorkerPool* pool = external_async_pool.load(std::memory_order_acquire)) return *pool;
+    std::call_once(async_pool_started, [this] { async_pool = std::make_unique<WorkerPool>(ASYNC_QUERY_WORKERS); });
+    return *async_pool;
+}
+
+SDM_TEMPLATE
+WorkerPool& SDM::delivery_workers() {
+    if (WorkerPool* pool = external_delivery_pool.load(std::memory_order_acquire)) return *pool;
+    std::call_once(delivery_pool_started, [this] { delivery_pool = std::make_unique<WorkerPool>(STANDING_DELIVERY_WORKERS); });
+    return *delivery_pool;
+}
+
+SDM_TEMPLATE
+const WorkerPool*& SDM::callback_pool() {
+    static thread_local const WorkerPool* pool = nullptr;
+    return pool;
+}
+
+SDM_TEMPLATE
+void SDM::drain_async_queries(WorkerPool& pool) {
+    /**
+        Each round takes every queued request, folds identical ranges together and evaluates the
+        rest with one CalculateDensityValuesBatch call (one lock or snapshot for the whole round).
+        Callbacks run after the batch, outside every manager lock.
+    */
+    std::vector<AsyncQuery> round;
+    std::vector<DensityRange> ranges;
+    std::vector<std::size_t> range_of;
+    std::vector<DensityStats> results;
+
+    for (;;) {
+        round.clear();
+        {
+            // Notified under the lock: once the destructor sees no task left it destroys async_idle
+            std::lock_guard<std::mutex> lock(async_mutex);
+            if (async_queries.empty()) {
+                if (--async_drains == 0 && !standing_round_scheduled) async_idle.notify_all();
+                break;
+            }
+            round.swap(async_queries);
+        }
+
+        ranges.clear();
+        range_of.resize(round.size());
+        for (std::size_t i = 0; i < round.size(); ++i) {
+            const DensityRange& range = round[i].range;
+            const auto same = std::find_if(ranges.begin(), ranges.end(), [&](const DensityRange& other) {
+                return other.min_pos_mm == range.min_pos_mm && other.max_pos_mm == range.max_pos_mm;
+            });
+            range_of[i] = static_cast<std::size_t>(same - ranges.begin());
+            if (same == ranges.end()) ranges.push_back(range);
+        }
+
+        results.resize(ranges.size());
+        CalculateDensityValuesBatch(ranges.data(), results.data(), ranges.size());
+        metrics.async_rounds.add(1);
+        metrics.async_queries.add(round.size());
+        const WorkerPool* const outer = callback_pool();
+        callback_pool() = &pool;
+        for (std::size_t i = 0; i < round.size(); ++i) round[i].on_done(results[range_of[i]]);
+        callback_pool() = outer;
+    }
+}
+
+SDM_TEMPLATE
+void SDM::scan_density_ranges(const DensityView& densities, const int* sample_positions, MedianAlgorithm algorithm,
+                              const DensityRange* ranges, DensityStats* results, std::vector<std::size_t>& order) {
+    /**
+        Ranges are sorted by lower bound once; for each sample, upper_bound finds the last range that
+        starts at or below its position, and the walk back towards lower starts stops as soon as the
+        running maximum of the upper bounds drops below the position. For disjoint sections that is
+        one binary search and one hit per sample.
+    */
+    if (order.empty()) return;
+
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return ranges[a].min_pos_mm < ranges[b].min_pos_mm;
+    });
+
+    // sorted_mins / running_max: lower bounds in order, and the largest upper bound up to each index
+    QueryScratch& scratch = thread_scratch();
+    std::vector<int>& sorted_mins = scratch.sorted_mins;
+    std::vector<int>& running_max = scratch.running_max;
+    sorted_mins.resize(order.size());
+    running_max.resize(order.size());
+    for (std::size_t j = 0; j < order.size(); ++j) {
+        sorted_mins[j] = ranges[order[j]].min_pos_mm;
+        running_max[j] = std::max(j > 0 ? running_max[j - 1] : INT_MIN, ranges[order[j]].max_pos_mm);
+    }
+
+    // Per-range working sets, indexed like `order`; the inner arrays keep their capacity between calls
+    std::vector<std::vector<int>>& relevant_densities = scratch.range_densities;
+    if (relevant_densities.size() < order.size()) relevant_densities.resize(order.size());
+    for (std::size_t j = 0; j < order.size(); ++j) relevant_densities[j].clear();
+    std::vector<DensityAccumulator>& stats = scratch.range_stats;
+    stats.assign(order.size(), DensityAccumulator{0, 0, INT_MAX});
+
+    const std::size_t n = densities.size;
+    for (std::size_t i = 0; i < n; ++i) {
+        const int pos = sample_positions[i];
+        const int density = densities.values[i];
+        std::size_t j = std::upper_bound(sorted_mins.begin(), sorted_mins.end(), pos) - sorted_mins.begin();
+        while (j > 0 && running_max[j - 1] >= pos) {
+            --j;
+            if (ranges[order[j]].max_pos_mm < pos) continue;
+            relevant_densities[j].push_back(density);
+            stats[j].sum += density;
+            stats[j].min = std::min(stats[j].min, density);
+            ++stats[j].count;
+        }
+    }
+
+    for (std::size_t j = 0; j < order.size(); ++j) {
+        DensityStats& out = results[order[j]];
+        if (stats[j].count == 0) {
+            out.mean = out.min = out.median = 0;
+            continue;
+        }
+        out.mean = static_cast<int>(stats[j].sum / stats[j].count);
+        out.min = stats[j].min;
+        out.median = MedianStrategy::compute(relevant_densities[j], algorithm);
+    }
+}
+
+// Configurations available to applications (see the aliases in SensorDataManager.h)
+template class BasicSensorDataManager<>;
+template class BasicSensorDataManager<5'000'000, 20'000, 5'000, int32_t, uint16_t>;
+
+#undef SDM
+#undef SDM_TEMPLATE
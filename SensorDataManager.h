@@ -5,35 +5,337 @@
     asynchronous sensor data streams (density and position) in a longitudinal board scanning system.
 
     Features:
-    - Buffering of recent data in timestamp order using std::deque
-    - Thread safety through internal mutex protection
+    - Buffering of recent data in timestamp order in fixed-capacity SoA rings (SampleRing.h)
+    - Thread safety through one mutex per stream, so density and position producers never contend
+    - Lazy trimming: producers evict stale samples in batches, queries trim exactly
+    - Optional lock-free ingest through per-stream single-producer rings (SpscRing.h)
+    - Optional snapshot queries that copy the buffers without locking, so query threads
+      neither serialize with each other nor block ingest
     - Sliding window filtering and linear interpolation
-    - Statistical summary (mean, min, median) for density values in a position range
+    - 64-bit microsecond timestamps in the API; 32-bit (default) or 64-bit timestamp storage
+    - Statistical summary (mean, min, median) for density values in a position range,
+      filtered and reduced with runtime-dispatched SIMD kernels (DensityKernels.h)
+    - Registered ranges whose statistics are maintained incrementally (OrderStatisticTree.h)
+    - Standing queries: registered ranges that push their updated statistics to a callback as
+      samples enter and leave them
+    - Optional interpolated-position column resolved at ingest, so queries are a single
+      filter/reduce pass (QueryEngine::Precomputed)
+    - Optional 1 mm position-bucket index over the resolved samples, answering any range in time
+      independent of the sample count (QueryEngine::Indexed, PositionIndex.h)
+    - Optional zone maps over the resolved samples: per-block position bounds and density sums,
+      so a query reduces covered blocks from their summaries and filters only the edge blocks
+      (QueryEngine::ZoneMap)
+    - Optional board segmentation: position resets end a board, whose samples are frozen into an
+      immutable segment with statistics computed once in the background (WorkerPool.h)
+    - Density resampled onto a 1 mm position grid in one linear pass, one-shot over the window or
+      tracked incrementally as the board advances
+    - Optional parallel execution of queries over very large windows on a WorkerPool: chunked
+      filter/reduce and a histogram-guided parallel median selection
+    - Query working sets kept in per-thread scratch arrays, so steady-state queries do not allocate
+    - Asynchronous queries (future or completion callback) run on an internal worker pool; requests
+      queued while a worker is busy are coalesced into one batch query against the same buffers
+    - Optional memory-mapped capture file for both buffers (MappedRingFile.h): the window survives
+      a restart and is re-attached without copying
+    - Optional compressed long-window history of the resolved samples (CompressedHistory.h), for
+      trend queries over windows many times longer than the live buffers
+    - Optional recording of the ingested traffic into a delta-encoded binary log for replay
+      (SampleRecording.h)
+    - Built-in metrics (SensorMetrics.h, GetMetrics): call latency and lock wait histograms, buffer
+      depths, trim counts and window size per query, compiled out with -DSENSOR_METRICS=0
+    - Compile-time configuration: BasicSensorDataManager is templated on the window length, the
+      maximum sample rates the buffers are sized for, the stored timestamp type and the stored
+      density type (int, or uint16_t for 2-byte samples). SensorDataManager is the default setup.
 */
 
+#ifndef SENSOR_DATA_MANAGER_H
+#define SENSOR_DATA_MANAGER_H
+
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <algorithm>
 #include <vector>
 #include <queue>
 #include <cmath>
 #include <climits>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <future>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include "SpscRing.h"
+#include "SampleRing.h"
+#include "OrderStatisticTree.h"
+#include "PositionIndex.h"
+#include "MedianStrategy.h"
+#include "DensityKernels.h"
+#include "WorkerPool.h"
+#include "MappedRingFile.h"
+#include "CompressedHistory.h"
+#include "SensorMetrics.h"
+
+// Width of the timestamps kept in the sample buffers: 32 (default) stores them relative to a time
+// base that is rebased every ~18 minutes, so a window never wraps and memory stays at 4 bytes per
+// timestamp; 64 stores them relative to a base that never moves.
+#ifndef SENSOR_TIME_STORAGE_BITS
+#define SENSOR_TIME_STORAGE_BITS 32
+#endif
+
+// Board positions [0, SENSOR_POSITION_DOMAIN_MM) covered by the QueryEngine::Indexed bucket index
+// (one bucket per mm; default 8192 mm). Samples outside it make Indexed queries fall back to a scan.
+#ifndef SENSOR_POSITION_DOMAIN_MM
+#define SENSOR_POSITION_DOMAIN_MM 8192
+#endif
+
+// Stored timestamp type selected by SENSOR_TIME_STORAGE_BITS; default for BasicSensorDataManager
+using DefaultSensorTime = std::conditional_t<SENSOR_TIME_STORAGE_BITS == 64, int64_t, int32_t>;
+
+/**
+    Enum selecting how sensor callbacks hand samples to the manager.
+    - Locked: Each callback takes its stream's mutex and appends directly to that stream's buffer
+    - LockFree: Each stream writes into its own wait-free SPSC ring; queries drain the rings.
+      Requires exactly one producer thread per stream.
+*/
+enum class IngestMode {
+    Locked,
+    LockFree
+};
+
+/**
+    Enum selecting how queries synchronize with ingest and with each other.
+    - Exclusive: Each query holds both stream mutexes for its whole computation
+    - Snapshot: Each query copies both buffers into per-thread scratch arrays without taking
+      a mutex (seqlock-style validation, see SampleRing::try_snapshot) and computes on the copy,
+      so N query threads run in parallel and never delay a producer. Queries matching a registered
+      range, QueryEngine::Precomputed and Indexed queries, and the drain of non-empty ingest rings
+      in IngestMode::LockFree still take the lock.
+*/
+enum class QueryConcurrency {
+    Exclusive,
+    Snapshot
+};
+
+/**
+    Enum selecting how CalculateDensityValues aligns density samples with positions.
+    - BinarySearch: interpolate_position (std::lower_bound) per density sample, O(N log M)
+    - MergeJoin: single forward pass over both time-sorted buffers with two cursors, O(N + M)
+    - RangeSearch: while the position track is non-decreasing, binary-searches the density samples
+      whose interpolated position lies in the range and visits only those, O(log N log M + K).
+      Falls back to MergeJoin when the board reverses or timestamps arrive out of order.
+    - Precomputed: reads the position column resolved at ingest time (each density sample is
+      interpolated once, when the first position sample at or after it arrives), so the query is a
+      single filter/reduce pass over (position, density) pairs, O(N). Only the few samples newer than
+      the newest position are interpolated at query time.
+    - Indexed: like Precomputed, and each resolved sample is also entered into a 1 mm position-bucket
+      index (PositionIndex.h) with per-bucket sums and counts and per-block density counts. Mean,
+      min and median of a range come from O(log) index walks plus the range's two partial 64 mm
+      blocks, whatever the number of samples in the range. Needs positions in
+      [0, SENSOR_POSITION_DOMAIN_MM) and densities in [0, MEDIAN_HISTOGRAM_DOMAIN); while any live
+      sample lies outside, queries fall back to the Precomputed scan. The median algorithm setting
+      does not apply.
+    - ZoneMap: like Precomputed, and the resolved column is cut into blocks of ZONE_SAMPLES
+      consecutive samples, each summarized by its position bounds and its density sum and minimum.
+      A block whose positions all lie in the range contributes its summary and a plain copy of its
+      densities (for the median), a block disjoint from the range is skipped, and only blocks
+      straddling a bound are filtered sample by sample, so the filter work scales with the number
+      of edge blocks rather than the window. Pays off when positions advance roughly monotonically,
+      so that blocks span narrow position intervals.
+    BinarySearch, MergeJoin and RangeSearch produce identical results. Precomputed, Indexed and ZoneMap match
+    them too, except that a sample keeps the position it was resolved with after its bracketing
+    position sample leaves the window (the other engines clamp it to the oldest remaining position).
+*/
+enum class QueryEngine {
+    BinarySearch,
+    MergeJoin,
+    RangeSearch,
+    Precomputed,
+    Indexed,
+    ZoneMap
+};
+
+// One sensor reading as delivered in a block: density or position_mm, plus its timestamp
+struct SensorSample {
+    int value;
+    int64_t time_uS;
+};
+
+// Inclusive board position range [min_pos_mm, max_pos_mm] for batched queries
+struct DensityRange {
+    int min_pos_mm;
+    int max_pos_mm;
+};
+
+// Statistics of one position range, as returned through CalculateDensityValues' out-pointers
+struct DensityStats {
+    int mean;
+    int min;
+    int median;
+};
+
+// Grid cells [first_cell, end_cell) written by one UpdateDensityProfile call (empty if first == end)
+struct ProfileCells {
+    std::size_t first_cell;
+    std::size_t end_cell;
+};
+
+// Percentiles one CalculateDensityReport call can return
+constexpr std::size_t MAX_REPORT_PERCENTILES = 8;
+
+/**
+    Full statistics of one position range (CalculateDensityReport). Everything is 0 when count is 0.
+    Percentile p is element floor(p * count / 100) of the sorted densities (clamped to the last), so
+    p50 equals median.
+*/
+struct DensityReport {
+    int count;
+    int64_t sum;
+    double mean;
+    int min;
+    int max;
+    int median;
+    double variance;  // population variance (divided by count)
+    std::size_t percentile_count;
+    int percentiles[MAX_REPORT_PERCENTILES];  // in the order requested
+};
+
+/**
+    Copy of a manager's built-in metrics (GetMetrics). Histograms are in nanoseconds unless named
+    otherwise; counters only grow, so rates are differences between two snapshots over taken_at_ns.
+    Everything is zero, and enabled false, in a -DSENSOR_METRICS=0 build.
+*/
+struct SensorMetricsSnapshot {
+    bool enabled;
+    int64_t taken_at_ns;                       // steady clock
+    uint64_t density_ingest_calls;             // MeasureDensityReady / MeasureDensityBatch calls
+    uint64_t position_ingest_calls;            // MeasurePositionReady / MeasurePositionBatch calls
+    uint64_t queries;                          // CalculateDensityValues calls, plus one per range of each batch call
+    HistogramSnapshot density_ingest_ns;       // every SENSOR_METRICS_SAMPLE_PERIOD-th density ingest call per thread
+    HistogramSnapshot position_ingest_ns;      // likewise for position ingest
+    HistogramSnapshot query_ns;                // every CalculateDensityValues call and every batch call
+    HistogramSnapshot density_lock_wait_ns;    // contended acquisitions only: density ingest waiting for its mutex
+    HistogramSnapshot position_lock_wait_ns;   // position ingest waiting for its mutex(es)
+    HistogramSnapshot query_lock_wait_ns;      // queries (single and batch) waiting for both mutexes
+    HistogramSnapshot query_window_samples;    // density samples each query looked at
+    uint64_t densities_trimmed;                // samples that left the window
+    uint64_t positions_trimmed;
+    uint64_t density_depth, peak_density_depth;    // live samples after the latest trim, and the largest seen
+    uint64_t position_depth, peak_position_depth;
+    uint64_t density_ring_depth, position_ring_depth;  // LockFree samples not drained yet
+    uint64_t dropped_samples;
+    uint64_t async_queries;                    // CalculateDensityValuesAsync requests answered
+    uint64_t async_rounds;                     // batch queries that answered them (fewer = more coalescing)
+    uint64_t standing_updates;                 // SubscribeDensityRange callbacks invoked
+};
+
+// Ingest tap for recording traffic (SampleRecording.h)
+class SampleRecorder;
+
+// A finished board (see EnableBoardSegmentation): its time span, extent and whole-board statistics
+struct BoardSummary {
+    uint64_t board_id;
+    int64_t start_time_uS;  // first position sample of the board (oldest one kept if truncated)
+    int64_t end_time_uS;    // first position sample of the next board (exclusive)
+    int min_pos_mm;         // extent of the board's interpolated sample positions
+    int max_pos_mm;
+    int sample_count;       // density samples of the board
+    DensityStats stats;     // over every density sample of the board
+    bool truncated;         // the board's head left the window first; the fields above cover the rest only
+};
+
+/**
+    Sensor data manager with its storage layout fixed at compile time.
+
+    @tparam WindowUs - Sliding window length in microseconds
+    @tparam MaxDensityRateHz - Density rate the density buffer is sized for (capacity = window * rate + 25%)
+    @tparam MaxPositionRateHz - Position rate the position buffer is sized for
+    @tparam TimeT - Stored timestamp type: int32_t (compact, rebased) or int64_t
+    @tparam DensityT - Stored density type: int, or uint16_t for 2-byte samples (densities must fit)
+
+    Member definitions live in SensorDataManager.cpp; the configurations below are instantiated
+    there, and a new deployment configuration needs one more `template class` line at its end.
+*/
+template <int WindowUs = 5'000'000,
+          int MaxDensityRateHz = 20'000,
+          int MaxPositionRateHz = 5'000,
+          typename TimeT = DefaultSensorTime,
+          typename DensityT = int>
+class BasicSensorDataManager {
+    static_assert(WindowUs > 0 && MaxDensityRateHz > 0 && MaxPositionRateHz > 0, "window and rates must be positive");
+    static_assert(std::is_same<TimeT, int32_t>::value || std::is_same<TimeT, int64_t>::value,
+                  "timestamps are stored as int32_t or int64_t");
+    static_assert(std::is_same<DensityT, int>::value || std::is_same<DensityT, uint16_t>::value,
+                  "densities are stored as int or uint16_t (the DensityKernels column types)");
 
-class SensorDataManager {
     public:
+        /**
+            @param mode - Ingest path used by MeasureDensityReady / MeasurePositionReady
+            @param concurrency - How CalculateDensityValues / CalculateDensityValuesBatch read the buffers
+            @param arena - Carve the sample buffers from this arena (ArenaBytes() each) instead of the
+                           heap; it must outlive the manager
+        */
+        explicit BasicSensorDataManager(IngestMode mode = IngestMode::Locked,
+                                        QueryConcurrency concurrency = QueryConcurrency::Exclusive,
+                                        SampleArena* arena = nullptr);
+
+        /**
+            Keeps both sample buffers in a memory-mapped capture file instead of the heap. If the file
+            already holds a capture with this configuration's layout (a previous run), its window is
+            live again at once, without copying: queries see the old samples until they age out.
+            Timestamps must then come from a clock that keeps counting across restarts. Samples still
+            in the LockFree ingest rings at a crash are lost; anything appended to the buffers is not.
+            @param capture - File opened with CaptureLayout(); it must outlive the manager
+        */
+        explicit BasicSensorDataManager(MappedRingFile& capture, IngestMode mode = IngestMode::Locked,
+                                        QueryConcurrency concurrency = QueryConcurrency::Exclusive);
+
+        // Waits for boards still being finalized in the background
+        ~BasicSensorDataManager();
+
+        // Bytes one manager's sample buffers take from a SampleArena
+        static constexpr std::size_t ArenaBytes() {
+            return SampleRing<TimeT, DensityT>::storage_bytes(window_capacity(MaxDensityRateHz)) +
+                   SampleRing<TimeT, int>::storage_bytes(window_capacity(MaxPositionRateHz));
+        }
+
+        // Ring shape of this configuration, for opening a MappedRingFile
+        static constexpr MappedRingLayout CaptureLayout() {
+            return {sizeof(TimeT), sizeof(DensityT), window_capacity(MaxDensityRateHz), window_capacity(MaxPositionRateHz), WindowUs};
+        }
+
         /**
             Registers a new density measurement.
             @param density - Sensor reading (integer scale)
-            @param time_uS - Timestamp in microseconds
+            @param time_uS - Timestamp in microseconds (64-bit, e.g. a monotonic clock; never wraps)
         */
-        void MeasureDensityReady(int density, int time_uS);
+        void MeasureDensityReady(int density, int64_t time_uS);
 
         /**
             Registers a new board position measurement.
             @param position_mm - Board position in millimeters
-            @param time_uS - Timestamp in microseconds
+            @param time_uS - Timestamp in microseconds (64-bit)
+        */
+        void MeasurePositionReady(int position_mm, int64_t time_uS);
+
+        /**
+            Registers a block of density measurements (e.g. one DMA transfer) with a single lock
+            acquisition and a single trim. Equivalent to calling MeasureDensityReady per sample.
+            In LockFree mode the block is copied into the ring with one publication.
+
+            @param samples - samples[0 .. count) as {density, time_uS}, in acquisition order
+            @param count - Number of samples
+        */
+        void MeasureDensityBatch(const SensorSample* samples, std::size_t count);
+
+        /**
+            Registers a block of position measurements; see MeasureDensityBatch.
+            @param samples - samples[0 .. count) as {position_mm, time_uS}, in acquisition order
+            @param count - Number of samples
         */
-        void MeasurePositionReady(int position_mm, int time_uS);
+        void MeasurePositionBatch(const SensorSample* samples, std::size_t count);
 
         /**
             Computes mean, min, and median of density values whose interpolated positions
@@ -43,19 +345,796 @@ class SensorDataManager {
         */
         void CalculateDensityValues(int min_pos_mm, int max_pos_mm, int* mean_density, int* min_density, int* median_density);
 
+        /**
+            CalculateDensityValues with the full DensityReport: count, 64-bit sum, exact mean, min,
+            max, median, variance and the requested percentiles, all from one filter pass over the
+            window and one pass over the matching densities (the percentiles are selected in one
+            chain of nth_element calls over shrinking subranges). Uses the selected engine's scan;
+            registered ranges and the Indexed bucket index are not consulted, so the report covers
+            the same samples Precomputed would. The median follows SetMedianAlgorithm. Does not
+            allocate in steady state.
+
+            @param percentiles - Percentiles to report, each in [0, 100], at most MAX_REPORT_PERCENTILES
+                                 (throws std::invalid_argument otherwise)
+        */
+        DensityReport CalculateDensityReport(int min_pos_mm, int max_pos_mm, std::initializer_list<double> percentiles = {10, 90});
+
+        /**
+            Resamples the window onto a 1 mm position grid: cell c receives the statistics of the
+            densities whose interpolated position is first_mm + c, i.e. what CalculateDensityValues(
+            first_mm + c, first_mm + c, ...) returns for mean and min (0 for an empty cell). One pass
+            interpolates every sample (merge join, the interpolate_position semantics; the resolved
+            column with Precomputed, Indexed and ZoneMap) and one pass bins it, instead of one
+            window scan per cell. Outputs are plain int arrays of `cells` values.
+            @param mean_density - Receives the mean density per cell
+            @param min_density - Receives the minimum density per cell, or null
+            @param sample_counts - Receives the number of samples per cell, or null
+        */
+        void ResampleDensityProfile(int first_mm, std::size_t cells, int* mean_density, int* min_density = nullptr,
+                                    int* sample_counts = nullptr);
+
+        /**
+            Incremental form of ResampleDensityProfile for rasterizing a board as it is scanned: a
+            tracked grid of `cells` 1 mm cells from first_mm on, into which every density sample is
+            binned once its position is resolved (as for RegisterDensityRange; position ingest then
+            takes both stream mutexes). Samples stay in the grid after they leave the window, so it
+            accumulates the whole board; track a new profile per board. The resolved samples of the
+            current window are binned right away.
+            @return Id to pass to UpdateDensityProfile and UntrackDensityProfile
+        */
+        int TrackDensityProfile(int first_mm, std::size_t cells);
+
+        /**
+            Brings a tracked profile up to date and writes the cells that changed since the previous
+            update of this profile (all cells on the first update) into the caller's arrays, which
+            must hold the profile's `cells` values and are otherwise left untouched, so a caller
+            keeping its arrays between updates always holds the full profile.
+            @param min_density, sample_counts - As for ResampleDensityProfile; may be null
+            @return The cells written; {0, 0} for an unknown id
+        */
+        ProfileCells UpdateDensityProfile(int profile_id, int* mean_density, int* min_density = nullptr,
+                                          int* sample_counts = nullptr);
+
+        // Stops binning into a tracked profile and frees it
+        void UntrackDensityProfile(int profile_id);
+
+        /**
+            Computes CalculateDensityValues for many position ranges under a single lock. Each density
+            sample's position is interpolated once and the sample is bucketed into every range that
+            contains it (ranges may overlap and come in any order). Registered ranges are answered
+            from their incremental statistics.
+
+            @param ranges - ranges[0 .. range_count) to evaluate
+            @param results - Receives one DensityStats per range, in the same order
+            @param range_count - Number of ranges
+        */
+        void CalculateDensityValuesBatch(const DensityRange* ranges, DensityStats* results, std::size_t range_count);
+
+        /**
+            Asynchronous CalculateDensityValues: returns at once, the statistics are computed on the
+            pool given to SetAsyncWorkers, or else on an internal pool of ASYNC_QUERY_WORKERS threads
+            (started by the first asynchronous query). Up to ASYNC_QUERY_WORKERS workers answer one
+            manager's requests at a time. Requests that queue up while the workers are busy are answered together by one
+            CalculateDensityValuesBatch call, so they see the same buffer state, identical ranges are
+            computed once and overlapping ranges share the interpolation pass.
+
+            @return Future receiving the range's statistics
+        */
+        std::future<DensityStats> CalculateDensityValuesAsync(int min_pos_mm, int max_pos_mm);
+
+        /**
+            Same, completing through a callback instead of a future.
+            @param on_done - Invoked once on a pool thread with the statistics; must not throw or
+                             destroy the manager. It may call the synchronous query methods. A
+                             future it requests from a manager on the same pool is answered on the
+                             spot, since waiting for the pool's threads from one of them could
+                             deadlock it; a result it waits for by other means is its own risk
+        */
+        void CalculateDensityValuesAsync(int min_pos_mm, int max_pos_mm, std::function<void(const DensityStats&)> on_done);
+
+        // Threads of the internal asynchronous query pool, and the most workers of any pool that
+        // answer one manager's asynchronous queries at a time
+        static constexpr std::size_t ASYNC_QUERY_WORKERS = 2;
+
+        /**
+            Runs asynchronous queries on pool and standing query updates on delivery_pool instead
+            of the internal pools, which are then never started (thread-safe; tasks already queued
+            finish where they are). ShardedSensorDataManager passes its shared pools to every lane,
+            so lanes add no threads of their own.
+            @param pool - Pool for asynchronous queries, or null for the internal one
+            @param delivery_pool - Pool for SubscribeDensityRange updates, or null for the internal
+                                   one; best not pool, so a slow subscriber never holds up queries
+            Both must stay alive until the manager is destroyed, which waits for its tasks on them.
+        */
+        void SetAsyncWorkers(WorkerPool* pool, WorkerPool* delivery_pool = nullptr);
+
+        // Threads of the internal standing query delivery pool
+        static constexpr std::size_t STANDING_DELIVERY_WORKERS = 1;
+
+        /**
+            Runs CalculateDensityValues in parallel on pool whenever the window holds at least
+            min_samples density samples (thread-safe). The window is split into chunks of
+            PARALLEL_QUERY_CHUNK samples that the caller and the pool's workers claim one at a time
+            (WorkerPool::parallel_for), so a busy or slow worker never holds up the rest. Each chunk
+            interpolates and filters its samples and reduces its sum, count, min and max; a second
+            pass builds per-chunk density histograms, and the median is selected within the one
+            merged bucket that holds it. Results are identical to the serial engines; the median
+            algorithm setting does not apply. Smaller windows, RangeSearch over a monotonic window,
+            ZoneMap, Indexed queries the index can answer and registered ranges stay serial.
+            @param pool - Pool to run on, or null for serial queries only; must stay alive until
+                          parallel queries are turned off and no query is running, or the manager is gone
+            @param min_samples - Window size from which queries go parallel
+        */
+        void SetParallelQueries(WorkerPool* pool, std::size_t min_samples = PARALLEL_QUERY_MIN_SAMPLES);
+
+        // Default SetParallelQueries threshold and the chunk size parallel queries split the window into
+        static constexpr std::size_t PARALLEL_QUERY_MIN_SAMPLES = 1 << 17;
+        static constexpr std::size_t PARALLEL_QUERY_CHUNK = 1 << 15;
+
+        /**
+            Drains the ingest rings, evicts everything older than the window and resolves pending
+            density positions, so the next query has nothing to catch up on. Queries do this
+            themselves; calling it periodically (as ShardedSensorDataManager's workers do) keeps that
+            work off the query path and keeps LockFree rings from filling up between queries.
+        */
+        void Maintain();
+
+        /**
+            Number of samples rejected in LockFree mode because a ring was full
+            (i.e. no query drained it for longer than INGEST_RING_CAPACITY samples).
+        */
+        std::size_t DroppedSamples() const;
+
+        // Accepted samples left out of the recording because Maintain() ran too rarely (see SetRecorder)
+        std::size_t UnrecordedSamples() const;
+
+        /**
+            Logs every sample the manager accepts from now on into recorder (null stops recording),
+            so the recording replays the traffic the buffers actually saw. Samples a full LockFree
+            ring drops are not recorded. Accepted samples are staged per stream under that stream's
+            mutex (LockFree samples when the rings are drained); producers never touch the
+            recorder. Maintain() hands both stages over and writes them merged by timestamp after
+            releasing the stream mutexes, holding back samples newer than the other stream's
+            newest until that stream catches up; SetRecorder and the destructor write everything.
+            A stage holds RECORD_STAGE_SAMPLES (65536) samples, so call Maintain() well within that
+            (ShardedSensorDataManager does every 10 ms); UnrecordedSamples() counts the samples a
+            full stage could not take. Block calls are recorded sample by sample. The recorder must
+            stay alive until recording is stopped or the manager is destroyed.
+        */
+        void SetRecorder(SampleRecorder* recorder);
+
+        // Scrapes the built-in metrics (thread-safe, lock-free); see SensorMetricsSnapshot
+        SensorMetricsSnapshot GetMetrics() const;
+
+        /**
+            Selects the engine used by subsequent CalculateDensityValues calls (thread-safe).
+            Selecting Precomputed, Indexed or ZoneMap resolves the positions of the current window once
+            and from then on resolves new density samples as position samples arrive (position ingest
+            then takes both stream mutexes); Indexed also builds its bucket index, and ZoneMap its
+            block summaries, from the current window.
+            Selecting another engine stops that maintenance.
+            @param engine - Value from the QueryEngine enum (default: BinarySearch)
+        */
+        void SetQueryEngine(QueryEngine engine);
+
+        /**
+            Selects the MedianStrategy algorithm used when a query scans the buffers (thread-safe).
+            @param algorithm - Value from the MedianAlgorithm enum (default: NthElement)
+        */
+        void SetMedianAlgorithm(MedianAlgorithm algorithm);
+
+        /**
+            Registers a position range whose statistics are maintained incrementally. Each density
+            sample is added to the range once a later position sample brackets it, and removed when it
+            leaves the window. CalculateDensityValues calls for exactly [min_pos_mm, max_pos_mm] are
+            then answered from that state plus the few samples not bracketed yet, instead of a full scan.
+            - OrderStatistic: Fenwick count tree, O(log DENSITY_DOMAIN) median/min. Densities are
+              clamped to [0, DENSITY_DOMAIN) for min/median.
+            - HeapMedian: StreamingMedian two-heap median with lazy expiry plus a sliding-window
+              minimum; works for any int density.
+            Other algorithms are treated as OrderStatistic.
+
+            A sample keeps the position it was resolved with, even if its bracketing position sample
+            leaves the window before it does.
+
+            @param min_pos_mm - Lower bound of board position range
+            @param max_pos_mm - Upper bound of board position range
+            @param algorithm - Incremental structure backing the range
+            @return Id to pass to UnregisterDensityRange
+        */
+        int RegisterDensityRange(int min_pos_mm, int max_pos_mm, MedianAlgorithm algorithm = MedianAlgorithm::OrderStatistic);
+
+        /**
+            Stops maintaining a range registered with RegisterDensityRange.
+            @param range_id - Id returned by RegisterDensityRange
+        */
+        void UnregisterDensityRange(int range_id);
+
+        /**
+            Standing query: registers [min_pos_mm, max_pos_mm] as with RegisterDensityRange and pushes
+            the range's statistics to on_update whenever a density sample enters the range (its
+            position is bracketed) or leaves it (trimmed from the window), instead of the caller
+            polling. The statistics cover the bracketed samples the range maintains; an on-demand
+            CalculateDensityValues adds the few not bracketed yet. The current statistics are pushed
+            once right away.
+
+            The ingest, query or Maintain call that changed the range computes the new statistics
+            (O(log DENSITY_DOMAIN)) and queues the subscription without allocating; a delivery pool
+            separate from the asynchronous query pool (STANDING_DELIVERY_WORKERS threads, or the
+            SetAsyncWorkers one) invokes on_update, so a slow subscriber never delays a query. Calls for one subscription never overlap and see the statistics in order; a
+            change made while a call is queued or running replaces the pending statistics, so a slow
+            subscriber gets the newest state rather than a backlog. Samples arriving in
+            IngestMode::LockFree are counted when a query or Maintain drains them.
+
+            @param on_update - Invoked on the delivery pool; must not throw or destroy the manager.
+                               It may call any query method and wait for asynchronous results
+            @return Id to pass to UnregisterDensityRange, which also ends the updates (an
+                    invocation already running may still finish)
+        */
+        int SubscribeDensityRange(int min_pos_mm, int max_pos_mm, std::function<void(const DensityStats&)> on_update,
+                                  MedianAlgorithm algorithm = MedianAlgorithm::OrderStatistic);
+
+        /**
+            Splits the streams into boards. A position sample more than reset_drop_mm below its
+            predecessor starts a new board; the previous board's density samples (those older than
+            the new board's first position sample) are positioned against that board's own position
+            samples, frozen into an immutable segment and evicted, so the live buffers and every
+            live query only cover the board currently being scanned. The segment's statistics are
+            computed once, on the pool if one is given (otherwise inside the ingest call that
+            detected the reset). Boards are numbered from 0; the newest MAX_RETAINED_BOARDS are kept.
+            Position ingest takes both stream mutexes from now on. Call once.
+            A board still being scanned is trimmed like any other data: one that takes longer than
+            the window (or overflows the buffers) loses its oldest samples before its reset arrives.
+            Its summary then has truncated set, and its start, sample count and statistics describe
+            only the samples still in the window.
+
+            @param reset_drop_mm - Position drop that marks a board change (positive)
+            @param pool - Worker pool for the finalization, or null; must outlive the manager
+        */
+        void EnableBoardSegmentation(int reset_drop_mm, WorkerPool* pool = nullptr);
+
+        // Number of boards detected so far; ids below it are finished or still being finalized
+        uint64_t BoardsDetected() const;
+
+        /**
+            Looks up a finished board in O(1).
+            @return false if the board is unknown, still being finalized or no longer retained
+        */
+        bool GetBoardSummary(uint64_t board_id, BoardSummary* summary) const;
+
+        /**
+            CalculateDensityValues over a finished board's frozen samples, in O(log n + K) for the K
+            samples in range (the segment is sorted by position).
+            @return false if the board is not available; see GetBoardSummary
+        */
+        bool CalculateBoardDensityValues(uint64_t board_id, int min_pos_mm, int max_pos_mm,
+                                         int* mean_density, int* min_density, int* median_density) const;
+
+        // Finished boards kept for lookups
+        static constexpr std::size_t MAX_RETAINED_BOARDS = 256;
+
+        /**
+            Keeps every density sample, once its position is resolved, in a compressed history
+            covering the last history_us microseconds (CompressedHistory.h: bit-packed blocks of 256
+            samples with per-block summaries, a few bytes per sample), for trend queries over windows
+            far longer than WindowUs. Sample positions are resolved at ingest from now on, as with
+            RegisterDensityRange (position ingest takes both stream mutexes, snapshot queries copy
+            under the mutexes); the current window is added first. Samples evicted before any
+            position brackets them, or frozen into a board segment, are not kept. Calling it again
+            changes the history length and keeps the history.
+            @param history_us - History length, measured back from the newest kept sample
+        */
+        void EnableCompressedHistory(int64_t history_us);
+
+        /**
+            CalculateDensityValues over the compressed history: the kept samples of the last
+            window_us microseconds (before the newest kept one) in [min_pos_mm, max_pos_mm]. Blocks
+            outside the range or the window are skipped on their summaries, blocks entirely inside
+            use their summary sums; only blocks straddling a bound are filtered sample by sample.
+            Brings the history up to date under both stream mutexes, then computes under the
+            history's own lock, so ingest is not held up by the scan.
+            @param window_us - How far back to look; longer than the history length means all of it
+            @return false if EnableCompressedHistory was not called
+        */
+        bool CalculateHistoryDensityValues(int64_t window_us, int min_pos_mm, int max_pos_mm,
+                                           int* mean_density, int* min_density, int* median_density);
+
+        // Samples currently kept in the compressed history, and their packed size in bytes
+        std::size_t HistorySamples() const;
+        std::size_t HistoryBytes() const;
+
     private:
-        // Buffers storing recent (timestamp, value) pairs
-        std::deque<std::pair<int, int>> density_buffer;   // {time_uS, density}
-        std::deque<std::pair<int, int>> position_buffer;  // {time_uS, position_mm}
+        // Sliding window length for keeping recent data (default: 5 seconds)
+        static constexpr int WINDOW_US = WindowUs;
+
+        // Highest sample rates the buffers are sized for; the ring overwrites its oldest sample
+        // if a stream exceeds this for a whole window.
+        static constexpr int MAX_DENSITY_RATE_HZ = MaxDensityRateHz;
+        static constexpr int MAX_POSITION_RATE_HZ = MaxPositionRateHz;
+
+        // Samples in one window at the given rate, plus 25% headroom for jitter
+        static constexpr std::size_t window_capacity(int rate_hz) {
+            return static_cast<std::size_t>(static_cast<int64_t>(WINDOW_US) * rate_hz / 1'000'000 * 5 / 4 + 1);
+        }
+
+        // Stored timestamp: microseconds relative to time_base_us
+        using StoredTime = TimeT;
+
+        // Compact storage rebases once stored times pass 2^30 us (~18 min): far from the 32-bit
+        // limit, so a whole window always fits and comparisons stay plain signed compares
+        static constexpr int64_t REBASE_AFTER_US = int64_t(1) << 30;
+        static_assert(sizeof(TimeT) == 8 || int64_t(WindowUs) * 4 <= REBASE_AFTER_US,
+                      "window too long for 32-bit timestamps; use int64_t");
+
+        // Buffers storing recent samples as separate timestamp / value arrays, oldest first
+        SampleRing<StoredTime, DensityT> density_buffer;  // {time_uS, density}
+        SampleRing<StoredTime, int> position_buffer;      // {time_uS, position_mm}
+
+        // Absolute time of stored timestamp 0, moved by rebase_time_base_locked (under both mutexes).
+        // time_base_generation is odd while stored timestamps are being rewritten.
+        std::atomic<int64_t> time_base_us{0};
+        std::atomic<uint32_t> time_base_generation{0};
+
+        // One mutex per stream. density_mutex also guards the registered-range state below;
+        // code that needs both takes them together with std::scoped_lock.
+        std::mutex density_mutex;
+        std::mutex position_mutex;
+
+        // Newest timestamp ingested on either stream; the window ends here. Starts far enough from
+        // INT64_MIN that window arithmetic on it cannot overflow.
+        std::atomic<int64_t> latest_time_us{INT64_MIN / 2};
+
+        // Producers evict stale samples only once the oldest one is this far past the window, then
+        // down to the exact window in one batch; queries always trim exactly first
+        static constexpr int TRIM_SLACK_US = 100'000;
+
+        // Lock-free staging rings, only used in IngestMode::LockFree.
+        // 65536 slots is ~3.5 s of density input at 18 kHz between two queries.
+        static constexpr std::size_t INGEST_RING_CAPACITY = 1 << 16;
+        IngestMode ingest_mode;
+        SpscRing<SensorSample, INGEST_RING_CAPACITY> density_ring;
+        SpscRing<SensorSample, INGEST_RING_CAPACITY> position_ring;
+        std::atomic<std::size_t> dropped_samples{0};
+
+        // SetParallelQueries settings (atomic so snapshot queries can read them unlocked)
+        std::atomic<WorkerPool*> parallel_pool{nullptr};
+        std::atomic<std::size_t> parallel_min_samples{PARALLEL_QUERY_MIN_SAMPLES};
+
+        // Engine used by CalculateDensityValues (atomic so snapshot queries can read it unlocked)
+        std::atomic<QueryEngine> query_engine{QueryEngine::BinarySearch};
+
+        // Median algorithm used by scanning queries
+        std::atomic<MedianAlgorithm> median_algorithm{MedianAlgorithm::NthElement};
+
+        // Query synchronization mode, fixed at construction
+        const QueryConcurrency query_concurrency;
+
+        // Capture file holding both buffers, or null for heap / arena storage
+        MappedRingFile* capture_file = nullptr;
+
+        // Recording tap (null: not recording); written under both stream mutexes, read under either
+        SampleRecorder* recorder = nullptr;
+
+        // Double-buffered recording. Each stream stages its accepted samples under its own mutex,
+        // in room reserved when recording starts (~3.6 s of density at 18 kHz), so ingest never
+        // allocates or writes. Maintain moves both stages into the handed-over buffers under both
+        // stream mutexes and recording_mutex, then writes them under recording_mutex alone.
+        static constexpr std::size_t RECORD_STAGE_SAMPLES = 1 << 16;
+        std::vector<SensorSample> staged_densities;
+        std::vector<SensorSample> staged_positions;
+        std::atomic<std::size_t> unrecorded_samples{0};
+
+        // Written side of the recording, guarded by recording_mutex
+        std::mutex recording_mutex;
+        SampleRecorder* recording_target = nullptr;
+        std::vector<SensorSample> handed_densities;
+        std::vector<SensorSample> handed_positions;
+        int64_t handed_newest_density = INT64_MIN;
+        int64_t handed_newest_position = INT64_MIN;
+
+        // Snapshot attempts before a query gives up and copies under the mutexes (only reached if
+        // writers lap a whole ring during one copy)
+        static constexpr int SNAPSHOT_ATTEMPTS = 8;
+
+        // Adjacent pairs currently in the buffers that break the RangeSearch preconditions:
+        // position decreasing over time (board reversal) and density timestamps going backwards.
+        // Maintained in O(1) on every append and eviction.
+        int position_descents = 0;
+        int density_time_inversions = 0;
+
+        // Value domain of the registered-range count trees; shares the Histogram median's
+        // compile-time domain (default 4096, a 12-bit density scale)
+        static constexpr int DENSITY_DOMAIN = MEDIAN_HISTOGRAM_DOMAIN;
+
+        // Delivery state of one SubscribeDensityRange subscription, shared with the pool tasks that
+        // deliver its updates; the fields below on_update are guarded by mutex
+        struct StandingQuery {
+            std::function<void(const DensityStats&)> on_update;
+            std::mutex mutex;
+            DensityStats latest{};
+            bool pending = false;     // latest not delivered yet
+            bool delivering = false;  // a pool task owns the delivery loop
+            bool cancelled = false;
+        };
+
+        // Incrementally maintained statistics for one registered position range
+        struct RegisteredRange {
+            int id;
+            int min_pos_mm;
+            int max_pos_mm;
+            int64_t sum = 0;
+            int count = 0;
+
+            // OrderStatistic backing (null for HeapMedian ranges)
+            std::unique_ptr<OrderStatisticTree<DENSITY_DOMAIN>> tree;
+
+            // HeapMedian backing: streaming median and a monotonic {sequence, density} queue for the minimum
+            StreamingMedian heaps;
+            std::deque<std::pair<uint64_t, int>> window_min;
+
+            // Standing query fed by this range (null for plain registered ranges), and whether
+            // samples entered or left since its last update
+            std::shared_ptr<StandingQuery> subscriber;
+            bool changed = false;
+
+            bool contains(int pos) const { return pos >= min_pos_mm && pos <= max_pos_mm; }
+            void add(uint64_t sequence, int density);
+            void remove(uint64_t sequence, int density);
+        };
+        std::vector<RegisteredRange> registered_ranges;
+        int next_range_id = 0;
+        // Registered ranges with a subscriber (under density_mutex)
+        std::size_t standing_query_count = 0;
+        // registered_ranges.size(), readable without locking by producers and snapshot queries
+        std::atomic<std::size_t> registered_range_count{0};
+
+        // Per-cell accumulators of a 1 mm density grid
+        struct ProfileGrid {
+            int first_mm = 0;
+            std::vector<int64_t> sums;
+            std::vector<int> counts, mins;
+
+            void reset(int first, std::size_t cells);
+            // Bins one sample; false if its position is off the grid
+            bool add(int pos_mm, int density);
+            // Writes cells [from, to) to the output arrays (min / count arrays may be null)
+            void write(std::size_t from, std::size_t to, int* mean_density, int* min_density, int* sample_counts) const;
+        };
+
+        // TrackDensityProfile state (under density_mutex, fed by resolve_density_positions); the
+        // cells changed since the last update are [dirty_first, dirty_end)
+        struct TrackedProfile {
+            int id;
+            ProfileGrid grid;
+            std::size_t dirty_first, dirty_end;
+        };
+        std::vector<TrackedProfile> tracked_profiles;
+        int next_profile_id = 0;
+        // tracked_profiles.size(), readable without locking
+        std::atomic<std::size_t> tracked_profile_count{0};
+
+        // Resolved position of every bracketed density sample, stored at sequence % capacity and
+        // mirrored `capacity` slots further on like the SampleRing arrays, so the column for the live
+        // window is contiguous and lines up with density_buffer.values(). Density samples with
+        // sequence < resolved_end are resolved and counted in the ranges. Maintained while a range
+        // is registered or QueryEngine::Precomputed is selected; allocated the first time.
+        std::vector<int> resolved_positions;
+        uint64_t resolved_end = 0;
+
+        // Compressed history fed by resolve_density_positions, allocated by EnableCompressedHistory.
+        // history_mutex guards its contents and is taken after the stream mutexes; keeping_history
+        // is readable without locking by producers and snapshot queries.
+        std::unique_ptr<CompressedHistory> history;
+        mutable std::mutex history_mutex;
+        std::atomic<bool> keeping_history{false};
+
+        // QueryEngine::Precomputed or Indexed is selected, and for Indexed, resolved samples are
+        // entered into position_index (both written under both mutexes)
+        bool precompute_positions = false;
+        bool index_positions = false;
+
+        // Bucket index behind QueryEngine::Indexed, keyed by density slot (sequence % capacity);
+        // allocated the first time Indexed is selected
+        using DensityPositionIndex = PositionIndex<SENSOR_POSITION_DOMAIN_MM, DENSITY_DOMAIN>;
+        std::unique_ptr<DensityPositionIndex> position_index;
+
+        // Samples per zone-map block; block b holds density sequences [b * ZONE_SAMPLES, (b + 1) * ZONE_SAMPLES)
+        static constexpr std::size_t ZONE_SAMPLES = 256;
+
+        // Summary of one block of the resolved column, for QueryEngine::ZoneMap
+        struct DensityZone {
+            uint64_t block;  // block number the summary belongs to (slots are reused)
+            int min_pos_mm, max_pos_mm;
+            int64_t sum;
+            int count;
+            int min_density;
+        };
+
+        // Zone maps behind QueryEngine::ZoneMap, keyed by block % size(); sized so every block
+        // overlapping the live window has its own slot. Maintained by resolve_density_positions while
+        // zone_positions is set (both written under both mutexes); allocated the first time.
+        std::vector<DensityZone> density_zones;
+        bool zone_positions = false;
+
+        // Built-in instrumentation, recorded with relaxed atomics (no-ops with -DSENSOR_METRICS=0)
+        struct Metrics {
+            LatencyHistogram density_ingest, position_ingest, query;
+            LatencyHistogram density_lock_wait, position_lock_wait, query_lock_wait;
+            LatencyHistogram query_window_samples;
+            Counter density_ingest_calls, position_ingest_calls, queries;
+            Counter async_queries, async_rounds, standing_updates;
+            Counter densities_trimmed, positions_trimmed;
+            Gauge density_depth, position_depth;  // written under the stream's mutex
+        };
+        Metrics metrics;
+
+        // A finished board: summary plus its samples sorted by position (immutable once published)
+        struct BoardSegment {
+            BoardSummary summary;
+            std::vector<int> positions;
+            std::vector<int> densities;
+        };
+
+        // Board segmentation state; the detection fields are written under both stream mutexes,
+        // board_mutex guards the finished boards and the pending count
+        std::atomic<bool> segmenting_boards{false};
+        int board_reset_drop_mm = 0;
+        WorkerPool* board_pool = nullptr;
+        uint64_t board_scan_end = 0;  // position sequence up to which resets have been looked for
+        // Sequences of the current board's first samples; trimming past them truncates the board
+        uint64_t board_first_density = 0;
+        uint64_t board_first_position = 0;
+        uint64_t next_board_id = 0;
+        mutable std::mutex board_mutex;
+        std::condition_variable board_finalized;
+        std::deque<std::shared_ptr<const BoardSegment>> finished_boards;  // null while pending
+        uint64_t first_retained_board = 0;
+        std::size_t pending_boards = 0;
+
+        // One queued CalculateDensityValuesAsync request
+        struct AsyncQuery {
+            DensityRange range;
+            std::function<void(const DensityStats&)> on_done;
+        };
+
+        // Asynchronous work, guarded by async_mutex: requests waiting for a worker and the number of
+        // workers draining them; subscriptions with an update to deliver (reserved for every
+        // subscription made) and whether a delivery round is scheduled. async_idle is signalled
+        // when no drain or round is left. The internal pools are declared after everything their
+        // tasks touch, so they are joined first on destruction.
+        std::mutex async_mutex;
+        std::condition_variable async_idle;
+        std::vector<AsyncQuery> async_queries;
+        std::size_t async_drains = 0;
+        std::vector<std::shared_ptr<StandingQuery>> standing_ready;
+        std::size_t standing_subscriptions = 0;
+        bool standing_round_scheduled = false;
+        std::atomic<WorkerPool*> external_async_pool{nullptr};
+        std::atomic<WorkerPool*> external_delivery_pool{nullptr};
+        std::once_flag async_pool_started, delivery_pool_started;
+        std::unique_ptr<WorkerPool> async_pool, delivery_pool;
+
+        // Read-only view of live samples, oldest first: a buffer itself or a snapshot copy of it
+        template <typename ValueT>
+        struct SampleView {
+            const StoredTime* times;
+            const ValueT* values;
+            std::size_t size;
+        };
+        using DensityView = SampleView<DensityT>;
+        using PositionView = SampleView<int>;
+
+        // Per-thread copy of both buffers used by snapshot queries; the arrays grow to the buffer
+        // capacities once and are then reused
+        struct Snapshot {
+            std::vector<StoredTime> density_times, position_times;
+            std::vector<DensityT> densities;
+            std::vector<int> positions;
+            DensityView density;
+            PositionView position;
+            bool monotonic;  // RangeSearch preconditions hold for the copy
+        };
+
+        // Partial result of one chunk of a parallel query; its matches are at the chunk's own offset
+        // of relevant_densities
+        struct ParallelChunk {
+            DensityAccumulator stats;
+            int max;
+            std::size_t selection_offset;  // where its values of the median's bucket are gathered
+        };
+
+        // Histogram buckets the parallel median selection narrows the density range to
+        static constexpr std::size_t PARALLEL_SELECT_BUCKETS = 1024;
+
+        // Per-thread query working sets. Each array grows to the largest query the thread has run
+        // and keeps its capacity, so steady-state queries do not touch the heap.
+        struct QueryScratch {
+            std::vector<int> relevant_densities;  // filter compaction target, then median input
+            std::vector<int> sample_positions;    // interpolated position of every density sample
+            std::vector<int> tail;                // unresolved samples merged into maintained statistics
+            std::vector<std::size_t> order;       // batch ranges left for the scan
+            std::vector<int> sorted_mins, running_max;
+            std::vector<std::vector<int>> range_densities;  // per-range working sets of a batch scan
+            std::vector<DensityAccumulator> range_stats;
+            std::vector<ParallelChunk> parallel_chunks;  // per-chunk partials of a parallel query
+            std::vector<uint32_t> parallel_histograms;   // PARALLEL_SELECT_BUCKETS counts per chunk
+            std::vector<int> parallel_selection;         // the median's bucket, gathered from every chunk
+            ProfileGrid profile;                         // ResampleDensityProfile accumulators
+        };
+
+    // Restores the derived state (time base, newest time, monotonicity counters) of an adopted capture
+    void attach_capture();
+
+    // Raises latest_time_us to time_us if it is newer
+    void note_time(int64_t time_us);
+    int64_t latest_time() const { return latest_time_us.load(std::memory_order_relaxed); }
+    int64_t time_base() const { return time_base_us.load(std::memory_order_relaxed); }
+
+    // API timestamp to stored timestamp (caller holds a stream mutex, so the base is stable)
+    StoredTime to_stored(int64_t time_us) const;
+
+    // Whether time_us is too far past the time base for compact storage
+    bool needs_rebase(int64_t time_us) const;
+
+    // Moves the time base close to the newest timestamp; the _locked form requires both mutexes
+    void rebase_time_base();
+    void rebase_time_base_locked();
+
+    // Start of the sliding window in stored time for the given base
+    int64_t window_cutoff(int64_t base_us) const;
+
+    // Evicts everything older than the window from both buffers (caller holds both mutexes)
+    void trim_old_data();
+
+    // Per-stream eviction of samples older than cutoff_us (caller holds that stream's mutex)
+    void trim_densities(int64_t cutoff_us);
+    void trim_positions(int64_t cutoff_us);
 
-        // Mutex guarding access to both buffers
-        std::mutex data_mutex;
+    // Ingest-side batch trims, see TRIM_SLACK_US (caller holds that stream's mutex)
+    void trim_densities_lazily();
+    void trim_positions_lazily();
 
-    // Sliding window length for keeping recent data (default: 5 seconds)
-    static constexpr int WINDOW_US = 5'000'000;  // 5 seconds in microseconds
+    // Moves everything queued in the ingest rings into the buffers (caller holds both mutexes)
+    void drain_ingest_rings();
 
-    // Sliding window length for keeping recent data (default: 5 seconds)
-    void trim_old_data(int now_us);
+    // Stages accepted samples for the recorder (caller holds that stream's mutex)
+    void stage_recorded(std::vector<SensorSample>& staged, const SensorSample* samples, std::size_t count);
+
+    // Moves both stages to the handed-over buffers (caller holds both stream mutexes and recording_mutex)
+    void hand_over_staged();
+
+    // Writes the handed-over samples merged by timestamp (caller holds recording_mutex)
+    void write_handed_over(bool everything);
+
+    // Appends a sample and updates the monotonicity counters (caller holds that stream's mutex)
+    void append_density(StoredTime time_us, int density);
+    void append_position(StoredTime time_us, int position_mm);
+
+    // Block forms of append_*: evict once to make room, then bulk-copy (caller holds that stream's mutex)
+    void append_density_block(const SensorSample* samples, std::size_t count);
+    void append_position_block(const SensorSample* samples, std::size_t count);
+
+    // Drops the oldest sample and updates the monotonicity counters (caller holds that stream's mutex)
+    void evict_density_front();
+    void evict_position_front();
+
+    // Whether density positions are being resolved at ingest (caller holds density_mutex)
+    bool resolving_positions() const {
+        return precompute_positions || !registered_ranges.empty() || history != nullptr || !tracked_profiles.empty();
+    }
+
+    // Same decision for producers choosing their lock path, without any mutex
+    bool resolving_positions_unlocked() const {
+        const QueryEngine engine = query_engine.load(std::memory_order_relaxed);
+        return registered_range_count.load(std::memory_order_relaxed) != 0 || keeping_history.load(std::memory_order_relaxed) ||
+               tracked_profile_count.load(std::memory_order_relaxed) != 0 ||
+               engine == QueryEngine::Precomputed || engine == QueryEngine::Indexed || engine == QueryEngine::ZoneMap;
+    }
+
+    // Fills position_index from the resolved column (caller holds both mutexes)
+    void build_position_index();
+
+    // Fills density_zones from the resolved column, and adds one resolved sample to its block's zone
+    // (caller holds both mutexes)
+    void build_density_zones();
+    void add_to_zone(uint64_t sequence, int pos_mm, int density);
+
+    // Whether position ingest must take both mutexes (resolution or board detection), without locking
+    bool position_ingest_couples_streams() const {
+        return resolving_positions_unlocked() || segmenting_boards.load(std::memory_order_relaxed);
+    }
+
+    // Looks for board resets in the position samples added since the last call, and freezes every
+    // board they end (caller holds both mutexes)
+    void detect_board_ends();
+
+    // Freezes the board whose positions are the live position samples [0, reset_index) and evicts it
+    void freeze_board(std::size_t reset_index);
+
+    // Queues an asynchronous request and wakes a worker if one is free
+    void submit_async_query(int min_pos_mm, int max_pos_mm, std::function<void(const DensityStats&)> on_done);
+
+    // Worker loop on pool: answers every queued request with one batch query, until the queue stays empty
+    void drain_async_queries(WorkerPool& pool);
+
+    // The SetAsyncWorkers pools, or else the internal ones, started on first use
+    WorkerPool& async_workers();
+    WorkerPool& delivery_workers();
+
+    // Pool whose callbacks this thread is running (on_done or on_update), or null
+    static const WorkerPool*& callback_pool();
+
+    // Statistics of the bracketed samples a registered range maintains
+    static DensityStats registered_range_stats(const RegisteredRange& range);
+
+    // Hands the new statistics of every changed subscribed range to its subscriber (caller holds density_mutex)
+    void publish_standing_queries();
+
+    // Stores stats as the subscription's pending update and queues the subscription for delivery
+    // unless it is queued or being delivered already
+    void post_standing_update(const std::shared_ptr<StandingQuery>& subscriber, const DensityStats& stats);
+
+    // Delivery task on pool: delivers every queued subscription, until none is left
+    void deliver_standing_round(WorkerPool& pool);
+
+    // Invokes the subscription's callback until no update is pending
+    void deliver_standing_updates(StandingQuery& subscriber);
+
+    // Sorts a frozen board, computes its statistics and publishes it (no stream mutex needed)
+    void finalize_board(std::shared_ptr<BoardSegment> segment);
+
+    // The board's segment if it is finished and retained, else null
+    std::shared_ptr<const BoardSegment> find_board(uint64_t board_id) const;
+
+    // Starts resolving from the oldest density sample when resolution was off (caller holds both mutexes)
+    void restart_position_resolution();
+
+    // Resolved position of a density sample by sequence number, and its mirrored store
+    int resolved_position(uint64_t sequence) const { return resolved_positions[sequence % density_buffer.capacity()]; }
+    void store_resolved_position(uint64_t sequence, int pos_mm);
+
+    // Resolved column for the live density samples, oldest first; valid for resolved_end - first_sequence() values
+    const int* resolved_column() const { return resolved_positions.data() + density_buffer.first_sequence() % density_buffer.capacity(); }
+
+    // Resolves the positions of newly bracketed density samples into the column and the registered ranges
+    // (caller holds both mutexes)
+    void resolve_density_positions();
+
+    // Position of every live density sample for QueryEngine::Precomputed: the resolved column plus the
+    // interpolated unresolved tail (caller holds both mutexes, positions resolved)
+    void precomputed_positions(int* positions_out) const;
+
+    // Filter pass of QueryEngine::Precomputed: the matches go to the thread's relevant_densities
+    // (caller holds both mutexes, positions resolved)
+    DensityAccumulator collect_precomputed_range(int min_pos_mm, int max_pos_mm) const;
+
+    // Filter pass of QueryEngine::ZoneMap, likewise (caller holds both mutexes, zones built)
+    DensityAccumulator collect_zoned_range(int min_pos_mm, int max_pos_mm) const;
+
+    // Filter pass of the locked query path for the selected engine, likewise (caller holds both mutexes)
+    DensityAccumulator collect_locked_range(int min_pos_mm, int max_pos_mm) const;
+
+    /**
+        CalculateDensityValues with QueryEngine::Indexed (caller holds both mutexes, positions resolved)
+        @return false if some live sample lies outside the index domains; stats is then untouched
+    */
+    bool query_position_index(int min_pos_mm, int max_pos_mm, DensityStats& stats);
+
+    // Answers a query from a registered range if [min_pos_mm, max_pos_mm] is one; false otherwise
+    bool query_registered_range(int min_pos_mm, int max_pos_mm, int* mean_density, int* min_density, int* median_density);
+
+    // Views of the live buffers (caller holds both mutexes)
+    DensityView density_view() const { return {density_buffer.times(), density_buffer.values(), density_buffer.size()}; }
+    PositionView position_view() const { return {position_buffer.times(), position_buffer.values(), position_buffer.size()}; }
+
+    // Copies both buffers into snapshot (draining LockFree rings first, under the lock)
+    void take_snapshot(Snapshot& snapshot);
+
+    // This thread's snapshot scratch
+    static Snapshot& thread_snapshot();
+
+    // This thread's query scratch
+    static QueryScratch& thread_scratch();
 
     /**
         Linearly interpolates the board position at a given timestamp
@@ -64,5 +1143,73 @@ class SensorDataManager {
         @param time_us - Timestamp in microseconds
         @return Interpolated position in millimeters
     */
-    int interpolate_position(int time_us);
-};
\ No newline at end of file
+    int interpolate_position(StoredTime time_us) const { return interpolate_position(position_view(), time_us); }
+
+    // Same, over any position view
+    static int interpolate_position(const PositionView& positions, StoredTime time_us);
+
+    /**
+        Writes the interpolated position of every density sample (oldest first) to positions_out,
+        resolving them with a two-cursor merge over the density and position views.
+        Results match interpolate_position exactly.
+
+        @param positions_out - Room for densities.size values
+    */
+    static void interpolate_positions_merged(const DensityView& densities, const PositionView& positions, int* positions_out);
+
+    // Fills positions_out for every density sample with the given full-scan engine
+    static void interpolate_all_positions(QueryEngine engine, const DensityView& densities, const PositionView& positions,
+                                          int* positions_out);
+
+    /**
+        Full-scan filter pass: the densities whose interpolated position lies in [min_pos_mm, max_pos_mm]
+        go to the thread's relevant_densities.
+        @param monotonic - No board reversal and no out-of-order density timestamps in the views
+                           (enables the RangeSearch run search)
+    */
+    static DensityAccumulator collect_density_range(const DensityView& densities, const PositionView& positions, bool monotonic,
+                                                    QueryEngine engine, int min_pos_mm, int max_pos_mm);
+
+    // The parallel query pool if a window of `samples` density samples should use it, else null
+    WorkerPool* parallel_pool_for(std::size_t samples) const {
+        WorkerPool* pool = parallel_pool.load(std::memory_order_acquire);
+        return pool && samples >= parallel_min_samples.load(std::memory_order_relaxed) ? pool : nullptr;
+    }
+
+    /**
+        Parallel mean / min / median of the densities whose position lies in [min_pos_mm, max_pos_mm]
+        (SetParallelQueries). Uses the thread's relevant_densities, sample_positions and parallel_* arrays.
+        @param resolved - Position of each of the first resolved_count samples (the Precomputed column);
+                          later samples are interpolated with binary search
+    */
+    static DensityStats scan_parallel(WorkerPool& pool, const DensityView& densities, const PositionView& positions,
+                                      const int* resolved, std::size_t resolved_count, int min_pos_mm, int max_pos_mm);
+
+    // Mean / min / median from a filter pass: relevant_densities holds stats.count matches (consumed)
+    static DensityStats summarize_densities(std::vector<int>& relevant_densities, const DensityAccumulator& stats,
+                                            MedianAlgorithm algorithm);
+
+    // DensityReport from a filter pass, likewise (percentiles already validated)
+    static DensityReport report_densities(std::vector<int>& relevant_densities, const DensityAccumulator& stats,
+                                          MedianAlgorithm algorithm, std::initializer_list<double> percentiles);
+
+    /**
+        Full-scan part of CalculateDensityValuesBatch for the ranges listed in `order`
+        @param sample_positions - Position of every density sample in `densities`
+    */
+    static void scan_density_ranges(const DensityView& densities, const int* sample_positions, MedianAlgorithm algorithm,
+                                    const DensityRange* ranges, DensityStats* results, std::vector<std::size_t>& order);
+
+    // Whether a query runs on a lock-free snapshot (Snapshot mode, no registered range, not Precomputed)
+    bool snapshot_query() const {
+        return query_concurrency == QueryConcurrency::Snapshot && !resolving_positions_unlocked();
+    }
+};
+
+// Default configuration: 5 s window, 20 kHz / 5 kHz buffers, int densities
+using SensorDataManager = BasicSensorDataManager<>;
+
+// Same window with 2-byte densities and 4-byte timestamps (6 bytes per density sample)
+using CompactSensorDataManager = BasicSensorDataManager<5'000'000, 20'000, 5'000, int32_t, uint16_t>;
+
+#endif // SENSOR_DATA_MANAGER_H
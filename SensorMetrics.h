@@ -0,0 +1,223 @@
+/**
+    SensorMetrics.h
+
+    Built-in hot-path instrumentation for SensorDataManager: per-call latency, lock wait, buffer
+    depth and trim counters, kept in relaxed atomics and read through a plain-struct snapshot.
+
+    Features:
+    - LatencyHistogram: log2-bucketed nanosecond histogram (count, sum, 40 buckets up to ~18 min),
+      one relaxed fetch_add per field and record
+    - Gauge: single-writer current value plus peak, relaxed stores only
+    - Counter: relaxed monotonic count (rates come from the difference between two snapshots)
+    - CallTimer: RAII call latency into a histogram; metrics_sample_due() picks one call in
+      SENSOR_METRICS_SAMPLE_PERIOD on the calling thread, for paths too short to time every call
+    - TimedScopedLock: std::scoped_lock that records how long a contended acquisition waited; an
+      uncontended acquisition (try_lock succeeds) records nothing and reads no clock
+    - Compile with -DSENSOR_METRICS=0 to turn every recording into a no-op: the types become empty,
+      TimedScopedLock is a plain std::scoped_lock, and snapshots report enabled == false
+
+    Each instrument is 64-byte aligned, so producers and query threads recording into different
+    instruments do not share cache lines.
+*/
+
+#ifndef SENSOR_METRICS_H
+#define SENSOR_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// 1 (default): record metrics; 0: compile all instrumentation out
+#ifndef SENSOR_METRICS
+#define SENSOR_METRICS 1
+#endif
+
+// One in this many calls is timed where timing is sampled (power of two)
+#ifndef SENSOR_METRICS_SAMPLE_PERIOD
+#define SENSOR_METRICS_SAMPLE_PERIOD 64
+#endif
+static_assert((SENSOR_METRICS_SAMPLE_PERIOD & (SENSOR_METRICS_SAMPLE_PERIOD - 1)) == 0,
+              "SENSOR_METRICS_SAMPLE_PERIOD must be a power of two");
+
+using MetricsClock = std::chrono::steady_clock;
+
+/**
+    Copy of one LatencyHistogram. Bucket 0 holds values 0 and 1, bucket i > 0 holds [2^i, 2^(i+1)).
+*/
+struct HistogramSnapshot {
+    static constexpr int BUCKETS = 40;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[BUCKETS];
+
+    uint64_t mean() const { return count > 0 ? sum / count : 0; }
+
+    // Upper bound of the bucket holding the q-quantile (q in [0, 1]); 0 when empty
+    uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        const uint64_t target = static_cast<uint64_t>(q * static_cast<double>(count - 1));
+        uint64_t cumulative = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            cumulative += buckets[i];
+            if (cumulative > target) return (uint64_t(2) << i) - 1;
+        }
+        return UINT64_MAX;
+    }
+};
+
+// Log2 bucket of value, clamped to the last bucket
+inline int histogram_bucket(uint64_t value) {
+    if (value < 2) return 0;
+    const int bucket = 63 - __builtin_clzll(value);
+    return bucket < HistogramSnapshot::BUCKETS ? bucket : HistogramSnapshot::BUCKETS - 1;
+}
+
+#if SENSOR_METRICS
+
+class alignas(64) LatencyHistogram {
+public:
+    void record(uint64_t value) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        buckets[histogram_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_since(MetricsClock::time_point start) {
+        record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(MetricsClock::now() - start).count()));
+    }
+
+    // Fields are read one by one, so a snapshot taken during recording may be off by the calls in flight
+    HistogramSnapshot snapshot() const {
+        HistogramSnapshot copy;
+        copy.count = count.load(std::memory_order_relaxed);
+        copy.sum = sum.load(std::memory_order_relaxed);
+        for (int i = 0; i < HistogramSnapshot::BUCKETS; ++i) copy.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        return copy;
+    }
+
+private:
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> buckets[HistogramSnapshot::BUCKETS] = {};
+};
+
+// Written by one thread at a time (e.g. under the mutex of the buffer it measures)
+class alignas(64) Gauge {
+public:
+    void set(uint64_t value) {
+        current.store(value, std::memory_order_relaxed);
+        if (value > peak.load(std::memory_order_relaxed)) peak.store(value, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const { return current.load(std::memory_order_relaxed); }
+    uint64_t max() const { return peak.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> current{0};
+    std::atomic<uint64_t> peak{0};
+};
+
+class alignas(64) Counter {
+public:
+    void add(uint64_t n) { total.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return total.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> total{0};
+};
+
+// Whether this call is the thread's sampled one; one thread-local increment per call
+inline bool metrics_sample_due() {
+    static thread_local uint32_t calls = 0;
+    return (++calls & (SENSOR_METRICS_SAMPLE_PERIOD - 1)) == 0;
+}
+
+// Records the lifetime of the enclosing scope into a histogram, if timed
+class CallTimer {
+public:
+    explicit CallTimer(LatencyHistogram& histogram, bool timed = true)
+        : histogram(timed ? &histogram : nullptr), start(timed ? MetricsClock::now() : MetricsClock::time_point()) {}
+    ~CallTimer() {
+        if (histogram) histogram->record_since(start);
+    }
+
+    CallTimer(const CallTimer&) = delete;
+    CallTimer& operator=(const CallTimer&) = delete;
+
+private:
+    LatencyHistogram* histogram;
+    MetricsClock::time_point start;
+};
+
+// std::scoped_lock over the given mutexes; the time spent waiting for them goes into `wait`
+template <typename... Mutexes>
+class TimedScopedLock {
+public:
+    explicit TimedScopedLock(LatencyHistogram& wait, Mutexes&... mutexes) : lock(acquire(wait, mutexes...), mutexes...) {}
+
+private:
+    static std::adopt_lock_t acquire(LatencyHistogram& wait, Mutexes&... mutexes) {
+        if (try_all(mutexes...)) return std::adopt_lock;
+        const MetricsClock::time_point start = MetricsClock::now();
+        lock_all(mutexes...);
+        wait.record_since(start);
+        return std::adopt_lock;
+    }
+
+    template <typename Mutex>
+    static bool try_all(Mutex& mutex) { return mutex.try_lock(); }
+    template <typename First, typename Second, typename... Rest>
+    static bool try_all(First& first, Second& second, Rest&... rest) { return std::try_lock(first, second, rest...) == -1; }
+
+    template <typename Mutex>
+    static void lock_all(Mutex& mutex) { mutex.lock(); }
+    template <typename First, typename Second, typename... Rest>
+    static void lock_all(First& first, Second& second, Rest&... rest) { std::lock(first, second, rest...); }
+
+    std::scoped_lock<Mutexes...> lock;
+};
+
+#else
+
+class LatencyHistogram {
+public:
+    void record(uint64_t) {}
+    void record_since(MetricsClock::time_point) {}
+    HistogramSnapshot snapshot() const { return HistogramSnapshot{}; }
+};
+
+class Gauge {
+public:
+    void set(uint64_t) {}
+    uint64_t value() const { return 0; }
+    uint64_t max() const { return 0; }
+};
+
+class Counter {
+public:
+    void add(uint64_t) {}
+    uint64_t value() const { return 0; }
+};
+
+inline bool metrics_sample_due() { return false; }
+
+class CallTimer {
+public:
+    explicit CallTimer(LatencyHistogram&, bool = true) {}
+};
+
+template <typename... Mutexes>
+class TimedScopedLock {
+public:
+    explicit TimedScopedLock(LatencyHistogram&, Mutexes&... mutexes) : lock(mutexes...) {}
+
+private:
+    std::scoped_lock<Mutexes...> lock;
+};
+
+#endif // SENSOR_METRICS
+
+#endif // SENSOR_METRICS_H
@@ -0,0 +1,112 @@
+/**
+    ShardedSensorDataManager.cpp
+
+    Lane routing, shared maintenance and parallel cross-lane queries for BasicShardedSensorDataManager.
+
+    Features:
+    - Lanes constructed against one arena sized up front from LaneManager::ArenaBytes()
+    - Periodic maintenance job installed on the shared WorkerPool, which also runs every lane's
+      asynchronous queries; a second, single-thread pool delivers their standing query updates
+    - Cross-lane queries through WorkerPool::parallel_for
+    - Explicit instantiations for the SensorDataManager and CompactSensorDataManager lane types
+*/
+
+#include "ShardedSensorDataManager.h"
+
+#include <algorithm>
+#include <thread>
+
+// Worker count default: one per lane, up to the hardware threads
+static std::size_t default_worker_count(std::size_t lane_count) {
+    const std::size_t hardware = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    return std::max<std::size_t>(1, std::min(lane_count, hardware));
+}
+
+template <typename LaneManager>
+BasicShardedSensorDataManager<LaneManager>::BasicShardedSensorDataManager(std::size_t lane_count, std::size_t worker_count,
+                                                                          IngestMode mode, QueryConcurrency concurrency,
+                                                                          std::chrono::microseconds maintenance_interval)
+    : arena(lane_count * LaneManager::ArenaBytes()),
+      pool(worker_count > 0 ? worker_count : default_worker_count(lane_count)),
+      delivery_pool(LaneManager::STANDING_DELIVERY_WORKERS) {
+    lanes.reserve(lane_count);
+    for (std::size_t i = 0; i < lane_count; ++i) {
+        lanes.push_back(std::make_unique<LaneManager>(mode, concurrency, &arena));
+        lanes.back()->SetAsyncWorkers(&pool, &delivery_pool);
+    }
+
+    pool.set_periodic(maintenance_interval, [this] { maintain_lanes(); });
+}
+
+template <typename LaneManager>
+BasicShardedSensorDataManager<LaneManager>::~BasicShardedSensorDataManager() {
+    pool.set_periodic(std::chrono::microseconds(0), {});
+    lanes.clear();
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::MeasureDensityReady(std::size_t lane_id, int density, int64_t time_uS) {
+    lanes[lane_id]->MeasureDensityReady(density, time_uS);
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::MeasurePositionReady(std::size_t lane_id, int position_mm, int64_t time_uS) {
+    lanes[lane_id]->MeasurePositionReady(position_mm, time_uS);
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::MeasureDensityBatch(std::size_t lane_id, const SensorSample* samples,
+                                                                     std::size_t count) {
+    lanes[lane_id]->MeasureDensityBatch(samples, count);
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::MeasurePositionBatch(std::size_t lane_id, const SensorSample* samples,
+                                                                      std::size_t count) {
+    lanes[lane_id]->MeasurePositionBatch(samples, count);
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::CalculateDensityValues(std::size_t lane_id, int min_pos_mm, int max_pos_mm,
+                                                                        int* mean_density, int* min_density, int* median_density) {
+    lanes[lane_id]->CalculateDensityValues(min_pos_mm, max_pos_mm, mean_density, min_density, median_density);
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::CalculateDensityValuesAllLanes(int min_pos_mm, int max_pos_mm,
+                                                                                DensityStats* results) {
+    /**
+        One parallel_for index per lane; each lane locks (or snapshots) only itself, so the lanes
+        proceed independently and the caller works on lanes too instead of only waiting.
+    */
+    pool.parallel_for(lanes.size(), [&](std::size_t lane_id) {
+        DensityStats& out = results[lane_id];
+        lanes[lane_id]->CalculateDensityValues(min_pos_mm, max_pos_mm, &out.mean, &out.min, &out.median);
+    });
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::SetQueryEngine(QueryEngine engine) {
+    for (auto& lane : lanes) lane->SetQueryEngine(engine);
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::EnableBoardSegmentation(int reset_drop_mm) {
+    for (auto& lane : lanes) lane->EnableBoardSegmentation(reset_drop_mm, &pool);
+}
+
+template <typename LaneManager>
+std::size_t BasicShardedSensorDataManager<LaneManager>::DroppedSamples() const {
+    std::size_t dropped = 0;
+    for (const auto& lane : lanes) dropped += lane->DroppedSamples();
+    return dropped;
+}
+
+template <typename LaneManager>
+void BasicShardedSensorDataManager<LaneManager>::maintain_lanes() {
+    pool.parallel_for(lanes.size(), [this](std::size_t lane_id) { lanes[lane_id]->Maintain(); });
+}
+
+// Lane configurations available to applications
+template class BasicShardedSensorDataManager<SensorDataManager>;
+template class BasicShardedSensorDataManager<CompactSensorDataManager>;
@@ -0,0 +1,103 @@
+/**
+    ShardedSensorDataManager.h
+
+    Container for the lanes of a multi-head scanner: one BasicSensorDataManager per lane, with
+    the infrastructure shared between lanes instead of duplicated per lane.
+
+    Features:
+    - Samples and queries routed by lane id; lanes never contend with each other
+    - All lanes' sample buffers carved from one SampleArena (a single allocation)
+    - One WorkerPool for every lane: it runs the periodic lane maintenance (ring drain, trim,
+      position resolution and indexing, see Maintain), the cross-lane queries, every lane's
+      asynchronous queries and the finalization of segmented boards; one more thread delivers
+      every lane's standing query updates
+    - Cross-lane queries evaluate the lanes in parallel on the pool and the calling thread
+    - Worker count chosen by the caller, independent of the lane count, so 16+ lanes cost no
+      more threads than one
+
+    Per-lane settings not covered here (median algorithm, registered ranges, ...) are reached
+    through Lane(lane_id).
+*/
+
+#ifndef SHARDED_SENSOR_DATA_MANAGER_H
+#define SHARDED_SENSOR_DATA_MANAGER_H
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "SensorDataManager.h"
+#include "SampleArena.h"
+#include "WorkerPool.h"
+
+/**
+    @tparam LaneManager - BasicSensorDataManager configuration used for every lane
+*/
+template <typename LaneManager = SensorDataManager>
+class BasicShardedSensorDataManager {
+    public:
+        // Default period of the shared maintenance pass
+        static constexpr std::chrono::microseconds DEFAULT_MAINTENANCE_INTERVAL{10'000};
+
+        /**
+            @param lane_count - Number of lanes (scanner heads), ids 0 .. lane_count - 1
+            @param worker_count - Shared worker threads; 0 picks min(lane_count, hardware threads)
+            @param mode - Ingest mode of every lane
+            @param concurrency - Query mode of every lane
+            @param maintenance_interval - How often the workers maintain every lane
+        */
+        explicit BasicShardedSensorDataManager(std::size_t lane_count, std::size_t worker_count = 0,
+                                               IngestMode mode = IngestMode::Locked,
+                                               QueryConcurrency concurrency = QueryConcurrency::Exclusive,
+                                               std::chrono::microseconds maintenance_interval = DEFAULT_MAINTENANCE_INTERVAL);
+
+        // Stops the maintenance and destroys the lanes while the pools still run their tasks
+        ~BasicShardedSensorDataManager();
+
+        std::size_t LaneCount() const { return lanes.size(); }
+
+        // The lane's own manager, for anything not routed here; lane_id < LaneCount()
+        LaneManager& Lane(std::size_t lane_id) { return *lanes[lane_id]; }
+
+        // Per-lane ingest, see the BasicSensorDataManager methods of the same name
+        void MeasureDensityReady(std::size_t lane_id, int density, int64_t time_uS);
+        void MeasurePositionReady(std::size_t lane_id, int position_mm, int64_t time_uS);
+        void MeasureDensityBatch(std::size_t lane_id, const SensorSample* samples, std::size_t count);
+        void MeasurePositionBatch(std::size_t lane_id, const SensorSample* samples, std::size_t count);
+
+        // Per-lane query, see BasicSensorDataManager::CalculateDensityValues
+        void CalculateDensityValues(std::size_t lane_id, int min_pos_mm, int max_pos_mm,
+                                    int* mean_density, int* min_density, int* median_density);
+
+        /**
+            Evaluates the same position range on every lane, lanes in parallel.
+            @param results - Receives LaneCount() entries, indexed by lane id
+        */
+        void CalculateDensityValuesAllLanes(int min_pos_mm, int max_pos_mm, DensityStats* results);
+
+        // Selects the query engine of every lane
+        void SetQueryEngine(QueryEngine engine);
+
+        // Board segmentation on every lane, boards finalized on the shared pool
+        void EnableBoardSegmentation(int reset_drop_mm);
+
+        // Sum of BasicSensorDataManager::DroppedSamples over the lanes
+        std::size_t DroppedSamples() const;
+
+    private:
+        // Runs Maintain on every lane, spread over the idle workers
+        void maintain_lanes();
+
+        // The lanes' tasks on one pool may submit to the other, so the destructor destroys the
+        // lanes (each waiting for its own tasks) before either pool is joined, and the arena
+        // holding their buffers goes last
+        SampleArena arena;
+        WorkerPool pool;
+        WorkerPool delivery_pool;
+        std::vector<std::unique_ptr<LaneManager>> lanes;
+};
+
+// Lanes with the default configuration
+using ShardedSensorDataManager = BasicShardedSensorDataManager<>;
+
+#endif // SHARDED_SENSOR_DATA_MANAGER_H
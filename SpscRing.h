@@ -0,0 +1,116 @@
+/**
+    SpscRing.h
+
+    A fixed-capacity, wait-free single-producer / single-consumer ring buffer used to hand
+    sensor samples from an acquisition thread to the SensorDataManager without taking a lock.
+
+    Features:
+    - Wait-free try_push for the producer (one relaxed load, one store, one release store)
+    - Bulk try_push_bulk publishing a whole block with a single release store
+    - Batched drain for the consumer, publishing the consumed slots with a single release store
+    - Storage allocated once at construction; no allocation on the push or drain paths
+    - Head and tail indices kept on separate cache lines to avoid false sharing
+
+    Exactly one thread may push and exactly one thread (at a time) may drain.
+*/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+template <typename T, std::size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : slots(new T[Capacity]) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    /**
+        Appends an item if there is room. Never blocks and never allocates.
+
+        @param item - Item to copy into the ring
+        @return true if the item was stored, false if the ring was full
+    */
+    bool try_push(const T& item) {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+
+        // Only re-read the consumer's head when our cached copy says the ring is full
+        if (t - cached_head == Capacity) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head == Capacity) return false;
+        }
+
+        slots[t & MASK] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+        Appends as many items of a block as fit, publishing them all at once. Never blocks.
+
+        @param items - Items to copy, in order
+        @param n - Number of items
+        @return Number of leading items stored (the rest did not fit)
+    */
+    std::size_t try_push_bulk(const T* items, std::size_t n) {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+
+        if (Capacity - (t - cached_head) < n) cached_head = head.load(std::memory_order_acquire);
+        const std::size_t room = Capacity - (t - cached_head);
+        const std::size_t count = n < room ? n : room;
+
+        for (std::size_t i = 0; i < count; ++i) {
+            slots[(t + i) & MASK] = items[i];
+        }
+
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+        Consumes every item that was published before the call, in push order.
+
+        @param consume - Callable invoked as consume(const T&) for each item
+        @return Number of items consumed
+    */
+    template <typename Consumer>
+    std::size_t drain(Consumer&& consume) {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        const std::size_t t = tail.load(std::memory_order_acquire);
+
+        for (std::size_t i = h; i != t; ++i) {
+            consume(slots[i & MASK]);
+        }
+
+        // Hand all consumed slots back to the producer at once
+        head.store(t, std::memory_order_release);
+        return t - h;
+    }
+
+    // Approximate number of queued items (exact when called from the consumer with no concurrent push)
+    std::size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+    static constexpr std::size_t MASK = Capacity - 1;
+
+    std::unique_ptr<T[]> slots;
+
+    // Consumer-owned index of the next slot to read
+    alignas(64) std::atomic<std::size_t> head{0};
+
+    // Producer-owned index of the next slot to write, plus its private copy of head
+    alignas(64) std::atomic<std::size_t> tail{0};
+    std::size_t cached_head = 0;
+};
+
+#endif // SPSC_RING_H
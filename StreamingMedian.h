@@ -0,0 +1,117 @@
+/**
+    StreamingMedian.h
+
+    Online median of a changing multiset of integers using two heaps (max-heap for the lower half,
+    min-heap for the upper half) with lazy deletion, so values can expire in any order.
+
+    Features:
+    - insert / erase in O(log n) amortized, median in O(1)
+    - Lazy deletion: erased values are only counted until they surface at a heap top
+    - Heaps are std::vector backed and reused across clear(), so a long-lived instance stops
+      allocating once it has seen its working-set size
+    - Same convention as MedianStrategy::compute: element n / 2 of the sorted data
+
+    erase(v) must only be called for a value that is currently stored.
+*/
+
+#ifndef STREAMING_MEDIAN_H
+#define STREAMING_MEDIAN_H
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+class StreamingMedian {
+public:
+    void insert(int value) {
+        if (lower_size == 0 || value <= lower.front()) {
+            push(lower, value, std::less<int>());
+            ++lower_size;
+        } else {
+            push(upper, value, std::greater<int>());
+            ++upper_size;
+        }
+        rebalance();
+    }
+
+    void erase(int value) {
+        ++pending[value];
+        if (lower_size > 0 && value <= lower.front()) {
+            --lower_size;
+            prune(lower, std::less<int>());
+        } else {
+            --upper_size;
+            prune(upper, std::greater<int>());
+        }
+        rebalance();
+    }
+
+    // Requires size() > 0
+    int median() const { return lower.front(); }
+
+    std::size_t size() const { return lower_size + upper_size; }
+    bool empty() const { return size() == 0; }
+
+    // Drops all values but keeps the heap and pending-table capacity
+    void clear() {
+        lower.clear();
+        upper.clear();
+        for (auto& entry : pending) entry.second = 0;
+        lower_size = upper_size = 0;
+    }
+
+private:
+    template <typename Compare>
+    static void push(std::vector<int>& heap, int value, Compare compare) {
+        heap.push_back(value);
+        std::push_heap(heap.begin(), heap.end(), compare);
+    }
+
+    template <typename Compare>
+    static int pop(std::vector<int>& heap, Compare compare) {
+        std::pop_heap(heap.begin(), heap.end(), compare);
+        int top = heap.back();
+        heap.pop_back();
+        return top;
+    }
+
+    // Discards erased values sitting at the top of a heap. Zero entries are kept in the
+    // pending table so repeated values do not allocate new nodes.
+    template <typename Compare>
+    void prune(std::vector<int>& heap, Compare compare) {
+        while (!heap.empty()) {
+            auto it = pending.find(heap.front());
+            if (it == pending.end() || it->second == 0) return;
+            --it->second;
+            pop(heap, compare);
+        }
+    }
+
+    // Keeps lower holding the n / 2 + 1 smallest live values, so its top is the median
+    void rebalance() {
+        const std::size_t n = lower_size + upper_size;
+        const std::size_t wanted_lower = n == 0 ? 0 : n / 2 + 1;
+
+        while (lower_size > wanted_lower) {
+            push(upper, pop(lower, std::less<int>()), std::greater<int>());
+            --lower_size;
+            ++upper_size;
+            prune(lower, std::less<int>());
+        }
+        while (lower_size < wanted_lower) {
+            push(lower, pop(upper, std::greater<int>()), std::less<int>());
+            ++lower_size;
+            --upper_size;
+            prune(upper, std::greater<int>());
+        }
+    }
+
+    std::vector<int> lower;  // max-heap (std::less)
+    std::vector<int> upper;  // min-heap (std::greater)
+    std::unordered_map<int, int> pending;  // value -> erased copies still inside a heap
+    std::size_t lower_size = 0;  // live values in lower
+    std::size_t upper_size = 0;  // live values in upper
+};
+
+#endif // STREAMING_MEDIAN_H
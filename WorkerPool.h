@@ -0,0 +1,174 @@
+/**
+    WorkerPool.h
+
+    A fixed set of worker threads shared by many SensorDataManager lanes: they run submitted tasks,
+    split parallel loops with the calling thread, and run one optional periodic job (e.g. lane
+    maintenance) when it is due.
+
+    Features:
+    - Thread count fixed at construction, independent of how many lanes use the pool
+    - submit: fire-and-forget tasks from a FIFO queue
+    - parallel_for: the caller and up to every worker claim loop indices from a shared counter,
+      so a loop never waits for a busy pool to pick it up
+    - set_periodic: one job run every interval by whichever worker is idle when it falls due;
+      queued tasks take priority, so a long maintenance pass never starts ahead of a query.
+      Removing the job waits for a run in progress
+    - Destruction finishes queued tasks, then joins the workers
+
+    Tasks must not throw.
+*/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+        @param thread_count - Number of worker threads (at least 1)
+    */
+    explicit WorkerPool(std::size_t thread_count) {
+        if (thread_count == 0) thread_count = 1;
+        workers.reserve(thread_count);
+        for (std::size_t i = 0; i < thread_count; ++i) workers.emplace_back([this] { run(); });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    std::size_t thread_count() const { return workers.size(); }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    /**
+        Runs body(i) for every i in [0, n), on the calling thread and the workers, and returns once
+        all calls have finished. Helpers that only get dequeued after the caller ran out of indices
+        exit without touching the loop, so the caller never waits for a busy pool (and may itself
+        be a pool task).
+    */
+    template <typename Body>
+    void parallel_for(std::size_t n, Body body) {
+        if (n == 0) return;
+
+        // Outlives this call if a helper is dequeued late; body is only touched while counted in running
+        struct Loop {
+            std::atomic<std::size_t> next{0};
+            std::size_t running = 0;
+            bool closed = false;
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+        auto loop = std::make_shared<Loop>();
+        Body* shared_body = &body;
+
+        const std::size_t helpers = std::min(n - 1, workers.size());
+        for (std::size_t h = 0; h < helpers; ++h) {
+            submit([loop, shared_body, n] {
+                {
+                    std::lock_guard<std::mutex> lock(loop->mutex);
+                    if (loop->closed) return;
+                    ++loop->running;
+                }
+                for (std::size_t i = loop->next.fetch_add(1); i < n; i = loop->next.fetch_add(1)) (*shared_body)(i);
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                if (--loop->running == 0) loop->done.notify_one();
+            });
+        }
+
+        for (std::size_t i = loop->next.fetch_add(1); i < n; i = loop->next.fetch_add(1)) body(i);
+
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->closed = true;
+        loop->done.wait(lock, [&] { return loop->running == 0; });
+    }
+
+    /**
+        Installs (or, with an empty job, removes) the periodic job; the first run is one interval from now.
+        The job never runs on two workers at once. Removing it waits for a run in progress, so the
+        job's state may go away afterwards; the job itself must not remove it.
+    */
+    void set_periodic(std::chrono::microseconds interval, std::function<void()> job) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            periodic_interval = interval;
+            periodic_job = std::move(job);
+            periodic_due = Clock::now() + interval;
+            if (!periodic_job) periodic_idle.wait(lock, [this] { return !periodic_running; });
+        }
+        wake.notify_all();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            if (!tasks.empty()) {
+                std::function<void()> task = std::move(tasks.front());
+                tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+                continue;
+            }
+            if (stopping) return;
+
+            if (periodic_job && !periodic_running && Clock::now() >= periodic_due) {
+                // Copy, so set_periodic can replace the job while this run is in progress
+                std::function<void()> job = periodic_job;
+                periodic_running = true;
+                lock.unlock();
+                job();
+                lock.lock();
+                periodic_running = false;
+                periodic_idle.notify_all();
+                periodic_due = Clock::now() + periodic_interval;
+                continue;
+            }
+
+            if (periodic_job && !periodic_running) wake.wait_until(lock, periodic_due);
+            else wake.wait(lock);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+
+    std::function<void()> periodic_job;
+    std::chrono::microseconds periodic_interval{0};
+    Clock::time_point periodic_due;
+    bool periodic_running = false;
+    std::condition_variable periodic_idle;
+};
+
+#endif // WORKER_POOL_H
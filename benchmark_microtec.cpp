@@ -0,0 +1,518 @@
+/**
+    benchmark_microtec.cpp
+
+    Benchmark suite for SensorDataManager: deterministic input, no sleeping, one JSON object per
+    measurement on stdout (JSON Lines), so runs can be diffed and tracked between releases.
+
+    Features:
+    - engines: CalculateDensityValues latency (mean / p50 / p99 / p999 over 10,000 queries per
+      case) of every QueryEngine on a full 5-second window, monotonic and reversing boards,
+      checked against BinarySearch
+    - medians: query latency of every MedianAlgorithm on both storage backends (SensorDataManager
+      and CompactSensorDataManager), checked against NthElement
+    - ingest: single-thread ingest throughput per backend, IngestMode and API (per sample / block)
+    - contention: ingest throughput and query latency with 1..4 density producers and 0..4 query
+      threads running concurrently, per IngestMode and QueryConcurrency, with the manager's own
+      lock-wait metrics (GetMetrics)
+    - replay: full-speed ReplayRecording throughput per backend, over a recorded shift
+      (SampleRecording.h): a synthetic 60 s recording by default, or a production capture given
+      as replay=<path>
+
+    Every record carries "benchmark" (the section) and the case's parameters; latencies are in
+    microseconds, throughputs in samples or queries per second. A leading "config" record describes
+    the build (storage bits, density kernel, hardware threads).
+
+    Build (optimized; build.sh also builds it as ./microtec_bench):
+        g++ -O2 -o microtec_bench SensorDataManager.cpp DensityKernels.cpp benchmark_microtec.cpp -lpthread
+
+    Usage:
+        ./microtec_bench [engines] [medians] [ingest] [contention] [replay[=<recording>]]
+        (no argument: every section)
+
+    Exits with 1 if an engine or median algorithm disagrees with its baseline, 2 on a bad argument
+    or an unreadable recording.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SensorDataManager.h"
+#include "SampleRecording.h"
+
+// 5 s window: 4 kHz density (20k samples) and 1 kHz position (5k samples), board moving at 1 mm/ms
+static constexpr int DENSITY_PERIOD_US = 250;
+static constexpr int POSITION_PERIOD_US = 1000;
+static constexpr int WINDOW_SAMPLES_US = 5'000'000;
+
+// Timed queries per case: p999 then rests on the 10 slowest samples rather than one or two
+static constexpr int QUERY_ITERATIONS = 10'000;
+
+// Fewer latency samples than this (short contention runs) report no p999
+static constexpr std::size_t P999_MIN_SAMPLES = 10'000;
+
+// Ingest: samples per throughput case, and the LockFree drain interval (well inside the 64k rings)
+static constexpr int INGEST_SAMPLES = 2'000'000;
+static constexpr int INGEST_BLOCK = 64;
+static constexpr int LOCK_FREE_DRAIN_INTERVAL = 16'384;
+
+// Contention: wall time per case, and how far (in sample time) densities may run ahead of positions
+static constexpr std::chrono::milliseconds CONTENTION_DURATION{150};
+static constexpr int64_t MAX_POSITION_LAG_US = 500'000;
+
+// Replay: length of the synthetic recording, and where it is written
+static constexpr int64_t REPLAY_SHIFT_US = 60'000'000;
+static const char* const REPLAY_SCRATCH_PATH = "microtec_bench_replay.rec";
+
+using Clock = std::chrono::steady_clock;
+
+struct QueryResult {
+    int mean, min, median;
+
+    bool operator==(const QueryResult& other) const {
+        return mean == other.mean && min == other.min && median == other.median;
+    }
+};
+
+struct EngineCase {
+    const char* name;
+    QueryEngine engine;
+};
+
+static const EngineCase ENGINES[] = {
+    {"BinarySearch", QueryEngine::BinarySearch},
+    {"MergeJoin", QueryEngine::MergeJoin},
+    {"RangeSearch", QueryEngine::RangeSearch},
+    {"Precomputed", QueryEngine::Precomputed},
+    {"Indexed", QueryEngine::Indexed},
+    {"ZoneMap", QueryEngine::ZoneMap},
+};
+
+struct MedianCase {
+    const char* name;
+    MedianAlgorithm algorithm;
+};
+
+static const MedianCase MEDIANS[] = {
+    {"NthElement", MedianAlgorithm::NthElement},
+    {"FullSort", MedianAlgorithm::FullSort},
+    {"HeapMedian", MedianAlgorithm::HeapMedian},
+    {"OrderStatistic", MedianAlgorithm::OrderStatistic},
+    {"Histogram", MedianAlgorithm::Histogram},
+};
+
+// One JSON object, built field by field and printed as a single line
+class Record {
+public:
+    explicit Record(const char* benchmark) { add("benchmark", benchmark); }
+
+    Record& add(const char* key, const char* value) {
+        field(key);
+        text += '"';
+        text += value;
+        text += '"';
+        return *this;
+    }
+    Record& add(const char* key, double value) {
+        char number[32];
+        snprintf(number, sizeof(number), "%.3f", value);
+        field(key);
+        text += number;
+        return *this;
+    }
+    Record& add(const char* key, int64_t value) {
+        field(key);
+        text += std::to_string(value);
+        return *this;
+    }
+    Record& add(const char* key, int value) { return add(key, static_cast<int64_t>(value)); }
+    Record& add(const char* key, bool value) {
+        field(key);
+        text += value ? "true" : "false";
+        return *this;
+    }
+
+    void emit() {
+        printf("{%s}\n", text.c_str());
+        fflush(stdout);
+    }
+
+private:
+    void field(const char* key) {
+        if (!text.empty()) text += ',';
+        text += '"';
+        text += key;
+        text += "\":";
+    }
+
+    std::string text;
+};
+
+// Latency distribution of one case, nearest-rank percentiles
+struct Latency {
+    double mean_us, p50_us, p99_us, p999_us;
+    std::size_t samples;
+
+    static Latency of(std::vector<double>& samples_us) {
+        if (samples_us.empty()) return Latency{0, 0, 0, 0, 0};
+        std::sort(samples_us.begin(), samples_us.end());
+        double total = 0;
+        for (double sample : samples_us) total += sample;
+        auto rank = [&](double quantile) {
+            const std::size_t index = static_cast<std::size_t>(quantile * (samples_us.size() - 1) + 0.5);
+            return samples_us[index];
+        };
+        return Latency{total / samples_us.size(), rank(0.50), rank(0.99), rank(0.999), samples_us.size()};
+    }
+
+    void add_to(Record& record) const {
+        record.add("mean_us", mean_us).add("p50_us", p50_us).add("p99_us", p99_us);
+        if (samples >= P999_MIN_SAMPLES) record.add("p999_us", p999_us);
+    }
+};
+
+static double elapsed_us(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// Deterministic density stream, identical on every platform (unlike rand())
+static int density_at(uint64_t sample_index) {
+    uint64_t x = sample_index * 0x9E3779B97F4A7C15ull;
+    x ^= x >> 29;
+    return static_cast<int>(x % 200);
+}
+
+// reverse_at_us >= 0 makes the board run backwards after that time (exercises the RangeSearch fallback)
+template <typename Manager>
+static void fill(Manager& target, int reverse_at_us = -1) {
+    int next_position_us = 0;
+    for (int t = 0; t < WINDOW_SAMPLES_US; t += DENSITY_PERIOD_US) {
+        while (next_position_us <= t) {
+            int position_mm = next_position_us / 1000;
+            if (reverse_at_us >= 0 && next_position_us > reverse_at_us)
+                position_mm = (2 * reverse_at_us - next_position_us) / 1000;
+            target.MeasurePositionReady(position_mm, next_position_us);
+            next_position_us += POSITION_PERIOD_US;
+        }
+        target.MeasureDensityReady(density_at(t / DENSITY_PERIOD_US), t);
+    }
+}
+
+// Times QUERY_ITERATIONS single queries; result receives the last answer
+template <typename Manager>
+static Latency time_queries(Manager& target, int min_mm, int max_mm, QueryResult* result) {
+    std::vector<double> samples_us(QUERY_ITERATIONS);
+    for (int i = 0; i < QUERY_ITERATIONS; ++i) {
+        const Clock::time_point start = Clock::now();
+        target.CalculateDensityValues(min_mm, max_mm, &result->mean, &result->min, &result->median);
+        samples_us[i] = elapsed_us(start, Clock::now());
+    }
+    return Latency::of(samples_us);
+}
+
+static const int RANGES[][2] = {{10, 200}, {0, 5000}, {1000, 4000}};
+
+// Every engine on each range; returns false if any engine disagrees with BinarySearch
+static bool bench_engines() {
+    SensorDataManager monotonic;
+    fill(monotonic);
+    SensorDataManager reversing;
+    fill(reversing, WINDOW_SAMPLES_US / 2);
+
+    bool all_match = true;
+    for (auto& dataset : {std::make_pair("monotonic", &monotonic), std::make_pair("reversing", &reversing)}) {
+        for (const auto& range : RANGES) {
+            QueryResult baseline{};
+            double baseline_p50_us = 0;
+            for (const auto& engine_case : ENGINES) {
+                dataset.second->SetQueryEngine(engine_case.engine);
+                QueryResult result{};
+                const Latency latency = time_queries(*dataset.second, range[0], range[1], &result);
+                if (engine_case.engine == QueryEngine::BinarySearch) {
+                    baseline = result;
+                    baseline_p50_us = latency.p50_us;
+                }
+                const bool match = result == baseline;
+                all_match = all_match && match;
+
+                Record record("engines");
+                record.add("dataset", dataset.first).add("min_mm", range[0]).add("max_mm", range[1])
+                      .add("engine", engine_case.name);
+                latency.add_to(record);
+                record.add("speedup_p50", baseline_p50_us / latency.p50_us).add("match", match).emit();
+            }
+        }
+    }
+    return all_match;
+}
+
+// Every median algorithm on one backend, whole window selected so the median dominates
+template <typename Manager>
+static bool bench_medians(const char* backend) {
+    Manager target;
+    target.SetQueryEngine(QueryEngine::Precomputed);
+    fill(target);
+
+    bool all_match = true;
+    for (const auto& range : RANGES) {
+        QueryResult baseline{};
+        for (const auto& median_case : MEDIANS) {
+            target.SetMedianAlgorithm(median_case.algorithm);
+            QueryResult result{};
+            const Latency latency = time_queries(target, range[0], range[1], &result);
+            if (median_case.algorithm == MedianAlgorithm::NthElement) baseline = result;
+            const bool match = result == baseline;
+            all_match = all_match && match;
+
+            Record record("medians");
+            record.add("backend", backend).add("min_mm", range[0]).add("max_mm", range[1])
+                  .add("median", median_case.name);
+            latency.add_to(record);
+            record.add("match", match).emit();
+        }
+    }
+    return all_match;
+}
+
+// Single-producer ingest throughput: INGEST_SAMPLES densities plus one position per 4 densities
+template <typename Manager>
+static void bench_ingest(const char* backend, IngestMode mode, bool blocks) {
+    Manager target(mode);
+    std::vector<SensorSample> density_block, position_block;
+    density_block.reserve(INGEST_BLOCK);
+    position_block.reserve(INGEST_BLOCK);
+
+    const Clock::time_point start = Clock::now();
+    for (int i = 0; i < INGEST_SAMPLES; ++i) {
+        const int64_t t = int64_t(i) * DENSITY_PERIOD_US;
+        const int density = density_at(i);
+        const bool position_due = i % (POSITION_PERIOD_US / DENSITY_PERIOD_US) == 0;
+        const int position_mm = static_cast<int>((t / 1000) % 5000);
+
+        if (blocks) {
+            density_block.push_back({density, t});
+            if (position_due) position_block.push_back({position_mm, t});
+            if (density_block.size() == INGEST_BLOCK) {
+                target.MeasureDensityBatch(density_block.data(), density_block.size());
+                target.MeasurePositionBatch(position_block.data(), position_block.size());
+                density_block.clear();
+                position_block.clear();
+            }
+        } else {
+            target.MeasureDensityReady(density, t);
+            if (position_due) target.MeasurePositionReady(position_mm, t);
+        }
+        if (mode == IngestMode::LockFree && i % LOCK_FREE_DRAIN_INTERVAL == LOCK_FREE_DRAIN_INTERVAL - 1) target.Maintain();
+    }
+    const double seconds = elapsed_us(start, Clock::now()) / 1e6;
+
+    Record("ingest")
+        .add("backend", backend)
+        .add("mode", mode == IngestMode::LockFree ? "LockFree" : "Locked")
+        .add("api", blocks ? "block" : "sample")
+        .add("samples", INGEST_SAMPLES)
+        .add("samples_per_s", INGEST_SAMPLES / seconds)
+        .add("dropped", static_cast<int64_t>(target.DroppedSamples()))
+        .emit();
+}
+
+/**
+    Producers and queriers hammering one manager for CONTENTION_DURATION. Density producers share
+    one sample clock, so the combined stream stays (nearly) time ordered; one position producer
+    follows that clock, and producers wait while they lead it by more than MAX_POSITION_LAG_US, so
+    every query sees a window that is mostly positioned. LockFree mode supports a single producer per stream and adds a thread
+    draining the rings. Producers run unthrottled, so LockFree cases may drop samples once the
+    drain falls behind; ingest_samples_per_s counts accepted samples only.
+*/
+static void bench_contention(IngestMode mode, QueryConcurrency concurrency, int producers, int queriers) {
+    SensorDataManager target(mode, concurrency);
+    fill(target);
+
+    std::atomic<int64_t> sample_clock{WINDOW_SAMPLES_US};
+    std::atomic<int64_t> position_clock{WINDOW_SAMPLES_US};
+    std::atomic<int64_t> ingested{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::vector<double>> latencies(queriers);
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+            int64_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (sample_clock.load(std::memory_order_relaxed) > position_clock.load(std::memory_order_relaxed) + MAX_POSITION_LAG_US) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                const int64_t t = sample_clock.fetch_add(DENSITY_PERIOD_US, std::memory_order_relaxed);
+                target.MeasureDensityReady(density_at(t / DENSITY_PERIOD_US), t);
+                ++count;
+            }
+            ingested.fetch_add(count);
+        });
+    }
+    threads.emplace_back([&] {
+        int64_t next_position_us = WINDOW_SAMPLES_US;
+        while (!stop.load(std::memory_order_relaxed)) {
+            const int64_t now_us = sample_clock.load(std::memory_order_relaxed);
+            for (; next_position_us <= now_us; next_position_us += POSITION_PERIOD_US)
+                target.MeasurePositionReady(static_cast<int>((next_position_us / 1000) % 5000), next_position_us);
+            position_clock.store(next_position_us, std::memory_order_relaxed);
+            std::this_thread::yield();
+        }
+    });
+    if (mode == IngestMode::LockFree) {
+        // The consumer side of the rings, as a ShardedSensorDataManager's maintenance would be
+        threads.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) target.Maintain();
+        });
+    }
+    for (int q = 0; q < queriers; ++q) {
+        threads.emplace_back([&, q] {
+            std::vector<double>& samples_us = latencies[q];
+            samples_us.reserve(1 << 16);
+            QueryResult result;
+            while (!stop.load(std::memory_order_relaxed)) {
+                const Clock::time_point start = Clock::now();
+                target.CalculateDensityValues(1000, 4000, &result.mean, &result.min, &result.median);
+                samples_us.push_back(elapsed_us(start, Clock::now()));
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(CONTENTION_DURATION);
+    stop.store(true);
+    for (std::thread& thread : threads) thread.join();
+
+    std::vector<double> all_us;
+    for (const auto& samples_us : latencies) all_us.insert(all_us.end(), samples_us.begin(), samples_us.end());
+    const double seconds = std::chrono::duration<double>(CONTENTION_DURATION).count();
+    const int64_t dropped = static_cast<int64_t>(target.DroppedSamples());
+
+    Record record("contention");
+    record.add("mode", mode == IngestMode::LockFree ? "LockFree" : "Locked")
+          .add("concurrency", concurrency == QueryConcurrency::Snapshot ? "Snapshot" : "Exclusive")
+          .add("producers", producers).add("queriers", queriers)
+          .add("ingest_samples_per_s", (ingested.load() - dropped) / seconds)
+          .add("queries_per_s", all_us.size() / seconds);
+    Latency::of(all_us).add_to(record);
+
+    // Where the time went, from the manager's own metrics (zeros with -DSENSOR_METRICS=0)
+    const SensorMetricsSnapshot metrics = target.GetMetrics();
+    record.add("density_lock_waits", static_cast<int64_t>(metrics.density_lock_wait_ns.count))
+          .add("density_lock_wait_p99_ns", static_cast<int64_t>(metrics.density_lock_wait_ns.percentile(0.99)))
+          .add("query_lock_waits", static_cast<int64_t>(metrics.query_lock_wait_ns.count))
+          .add("query_lock_wait_p99_ns", static_cast<int64_t>(metrics.query_lock_wait_ns.percentile(0.99)))
+          .add("peak_density_depth", static_cast<int64_t>(metrics.peak_density_depth));
+    record.add("dropped", dropped).emit();
+}
+
+// Synthetic shift in recording form: the fill() traffic pattern for REPLAY_SHIFT_US
+static void record_synthetic_shift(const char* path) {
+    SampleRecorder recorder(path);
+    int64_t next_position_us = 0;
+    for (int64_t t = 0; t < REPLAY_SHIFT_US; t += DENSITY_PERIOD_US) {
+        for (; next_position_us <= t; next_position_us += POSITION_PERIOD_US)
+            recorder.record(SampleStream::Position, static_cast<int>((next_position_us / 1000) % 5000), next_position_us);
+        recorder.record(SampleStream::Density, density_at(static_cast<uint64_t>(t / DENSITY_PERIOD_US)), t);
+    }
+}
+
+// Decoding plus ingest of a whole recording, as fast as possible
+template <typename Manager>
+static void bench_replay(const char* backend, const char* source, SampleRecordingReader& reader) {
+    Manager target;
+    reader.rewind();
+    const ReplayResult result = ReplayRecording(reader, target);
+
+    Record("replay")
+        .add("backend", backend)
+        .add("source", source)
+        .add("samples", static_cast<int64_t>(result.samples))
+        .add("bytes_per_sample", static_cast<double>(reader.size_bytes()) / std::max<uint64_t>(1, result.samples))
+        .add("samples_per_s", result.samples / result.seconds)
+        .emit();
+}
+
+static const char* kernel_name(DensityKernelIsa isa) {
+    switch (isa) {
+        case DensityKernelIsa::SSE41: return "SSE41";
+        case DensityKernelIsa::AVX2: return "AVX2";
+        case DensityKernelIsa::AVX512: return "AVX512";
+        case DensityKernelIsa::NEON: return "NEON";
+        default: return "Scalar";
+    }
+}
+
+int main(int argc, char** argv) {
+    static const char* const SECTIONS[] = {"engines", "medians", "ingest", "contention", "replay"};
+    const char* recording_path = nullptr;
+    auto selected = [&](const char* section) {
+        if (argc < 2) return true;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], section) == 0) return true;
+        }
+        return false;
+    };
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "replay=", 7) == 0) {
+            recording_path = argv[i] + 7;
+            argv[i] = const_cast<char*>("replay");
+        }
+        if (std::none_of(std::begin(SECTIONS), std::end(SECTIONS), [&](const char* s) { return strcmp(argv[i], s) == 0; })) {
+            fprintf(stderr, "usage: %s [engines] [medians] [ingest] [contention] [replay[=<recording>]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Record("config")
+        .add("time_storage_bits", SENSOR_TIME_STORAGE_BITS)
+        .add("metrics", SENSOR_METRICS != 0)
+        .add("density_kernel", kernel_name(active_density_kernel()))
+        .add("hardware_threads", static_cast<int>(std::thread::hardware_concurrency()))
+        .add("query_iterations", QUERY_ITERATIONS)
+        .emit();
+
+    bool all_match = true;
+    if (selected("engines")) all_match = bench_engines() && all_match;
+    if (selected("medians")) {
+        all_match = bench_medians<SensorDataManager>("default") && all_match;
+        all_match = bench_medians<CompactSensorDataManager>("compact") && all_match;
+    }
+    if (selected("ingest")) {
+        for (IngestMode mode : {IngestMode::Locked, IngestMode::LockFree}) {
+            for (bool blocks : {false, true}) {
+                bench_ingest<SensorDataManager>("default", mode, blocks);
+                bench_ingest<CompactSensorDataManager>("compact", mode, blocks);
+            }
+        }
+    }
+    if (selected("contention")) {
+        for (QueryConcurrency concurrency : {QueryConcurrency::Exclusive, QueryConcurrency::Snapshot}) {
+            for (int queriers : {0, 1, 2, 4}) {
+                for (int producers : {1, 2, 4}) bench_contention(IngestMode::Locked, concurrency, producers, queriers);
+                bench_contention(IngestMode::LockFree, concurrency, 1, queriers);
+            }
+        }
+    }
+
+    if (selected("replay")) {
+        try {
+            if (!recording_path) record_synthetic_shift(REPLAY_SCRATCH_PATH);
+            SampleRecordingReader reader(recording_path ? recording_path : REPLAY_SCRATCH_PATH);
+            const char* source = recording_path ? recording_path : "synthetic";
+            bench_replay<SensorDataManager>("default", source, reader);
+            bench_replay<CompactSensorDataManager>("compact", source, reader);
+        } catch (const std::exception& error) {
+            fprintf(stderr, "replay: %s\n", error.what());
+            return 2;
+        }
+        if (!recording_path) std::remove(REPLAY_SCRATCH_PATH);
+    }
+
+    return all_match ? 0 : 1;
+}
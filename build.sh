@@ -4,13 +4,23 @@
 set -e
 
 # === Configuration ===
-SRC_FILE="SensorDataManager.cpp"
+SRC_FILES=("SensorDataManager.cpp" "DensityKernels.cpp" "ShardedSensorDataManager.cpp")
 TEST_FILE="unit_tests_microtec.cpp"  # Change this to swap test/main files
 OUTPUT_BINARY="./microtec_test"
 GPP_FLAGS=("-g" "-o" "$OUTPUT_BINARY" "-lpthread")
 
+# Benchmark suite, always optimized (see benchmark_microtec.cpp for its sections and output)
+BENCH_FILE="benchmark_microtec.cpp"
+BENCH_BINARY="./microtec_bench"
+BENCH_FLAGS=("-O2" "-g" "-o" "$BENCH_BINARY" "-lpthread")
+
 # === Compilation ===
 echo "  ~ Compiling SensorDataManager with g++..."
-g++ "${GPP_FLAGS[@]}" "${SRC_FILE}" "${TEST_FILE}"
+g++ "${GPP_FLAGS[@]}" "${SRC_FILES[@]}" "${TEST_FILE}"
+
+echo "  ~ Build successful. Output binary: $OUTPUT_BINARY"
+
+echo "  ~ Compiling benchmark suite with g++..."
+g++ "${BENCH_FLAGS[@]}" "${SRC_FILES[@]}" "${BENCH_FILE}"
 
-echo "  ~ Build successful. Output binary: $OUTPUT_BINARY"
\ No newline at end of file
+echo "  ~ Build successful. Output binary: $BENCH_BINARY"
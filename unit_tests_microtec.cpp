@@ -1,37 +1,1312 @@
 #include <thread>
 #include <chrono>
+#include <cassert>
+#include <atomic>
+#include <climits>
+#include <future>
+#include <mutex>
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+#include <vector>
 #include "SensorDataManager.h"
+#include "ShardedSensorDataManager.h"
+#include "SampleRecording.h"
+
+// Allocation-counting hook: every global operator new of this binary counts against the calling thread
+static thread_local std::size_t thread_allocations = 0;
+
+// GCC cannot see that the replaced operator new pairs with std::free below
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(std::size_t size) {
+    ++thread_allocations;
+    if (void* memory = std::malloc(size > 0 ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    ++thread_allocations;
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    // aligned_alloc requires a size that is a non-zero multiple of the alignment
+    const std::size_t rounded = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+    if (void* memory = std::aligned_alloc(align, rounded)) return memory;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+#pragma GCC diagnostic pop
 
 SensorDataManager manager;
+SensorDataManager lock_free_manager(IngestMode::LockFree);
 
-void simulate_density_input() {
+void simulate_density_input(SensorDataManager& target) {
     for (int i = 0; i < 1000; ++i) {
-        manager.MeasureDensityReady(rand() % 200, i * 1000);
+        target.MeasureDensityReady(rand() % 200, i * 1000);
         std::this_thread::sleep_for(std::chrono::microseconds(500));
     }
 }
 
-void simulate_position_input() {
+void simulate_position_input(SensorDataManager& target) {
     for (int i = 0; i < 300; ++i) {
-        manager.MeasurePositionReady(i, i * 3000);
+        target.MeasurePositionReady(i, i * 3000);
         std::this_thread::sleep_for(std::chrono::microseconds(1000));
     }
 }
 
-void simulate_query() {
+void simulate_query(SensorDataManager& target) {
     for (int i = 0; i < 100; ++i) {
         int mean, min, median;
-        manager.CalculateDensityValues(10, 200, &mean, &min, &median);
+        target.CalculateDensityValues(10, 200, &mean, &min, &median);
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 }
 
+// Feeds 8 s of deterministic data (so trimming kicks in) and checks that a registered range
+// answers exactly like a full scan of an identically fed manager.
+void verify_registered_range(MedianAlgorithm algorithm) {
+    SensorDataManager indexed, scanned;
+    indexed.RegisterDensityRange(1500, 2000, algorithm);
+
+    for (int i = 0; i < 8000; ++i) {
+        int density = (i * 7919) % 200;
+        indexed.MeasureDensityReady(density, i * 1000);
+        scanned.MeasureDensityReady(density, i * 1000);
+        if (i % 3 == 0) {
+            indexed.MeasurePositionReady(i / 3, i * 1000);
+            scanned.MeasurePositionReady(i / 3, i * 1000);
+        }
+
+        if (i % 500 == 499) {
+            int mean[2], min[2], median[2];
+            indexed.CalculateDensityValues(1500, 2000, &mean[0], &min[0], &median[0]);
+            scanned.CalculateDensityValues(1500, 2000, &mean[1], &min[1], &median[1]);
+            assert(mean[0] == mean[1] && min[0] == min[1] && median[0] == median[1]);
+        }
+    }
+}
+
+// Every MedianStrategy algorithm must agree with NthElement, including out-of-domain data
+void verify_median_strategies() {
+    const MedianAlgorithm algorithms[] = {MedianAlgorithm::FullSort, MedianAlgorithm::HeapMedian,
+                                          MedianAlgorithm::OrderStatistic, MedianAlgorithm::Histogram};
+    for (int n = 1; n < 200; n += 7) {
+        std::vector<int> data(n);
+        for (int i = 0; i < n; ++i) data[i] = (n % 3 == 0) ? rand() % 100'000 - 500 : rand() % 200;
+
+        std::vector<int> reference = data;
+        int expected = MedianStrategy::compute(reference, MedianAlgorithm::NthElement);
+        for (MedianAlgorithm algorithm : algorithms) {
+            std::vector<int> copy = data;
+            assert(MedianStrategy::compute(copy, algorithm) == expected);
+        }
+    }
+
+    // Sliding-window use of StreamingMedian with lazy expiry (many duplicates)
+    StreamingMedian streaming;
+    std::deque<int> window;
+    for (int i = 0; i < 2000; ++i) {
+        int value = rand() % 20;
+        streaming.insert(value);
+        window.push_back(value);
+        if (window.size() > 37) {
+            streaming.erase(window.front());
+            window.pop_front();
+        }
+        std::vector<int> sorted(window.begin(), window.end());
+        std::sort(sorted.begin(), sorted.end());
+        assert(streaming.median() == sorted[sorted.size() / 2]);
+    }
+}
+
+// Every SIMD kernel this CPU supports must match the scalar kernel, output order included
+void verify_density_kernels() {
+    const DensityKernelIsa kernels[] = {DensityKernelIsa::SSE41, DensityKernelIsa::AVX2,
+                                        DensityKernelIsa::AVX512, DensityKernelIsa::NEON};
+    for (int n : {0, 1, 7, 8, 15, 16, 33, 1000}) {
+        std::vector<int> positions(n), densities(n), expected_out(n), out(n);
+        for (int i = 0; i < n; ++i) {
+            positions[i] = rand() % 300;
+            densities[i] = rand() % 4000 - 100;
+        }
+
+        DensityAccumulator expected = filter_reduce_densities(DensityKernelIsa::Scalar, positions.data(), densities.data(),
+                                                              n, 50, 250, expected_out.data());
+        for (DensityKernelIsa isa : kernels) {
+            if (!density_kernel_supported(isa)) continue;
+            DensityAccumulator got = filter_reduce_densities(isa, positions.data(), densities.data(), n, 50, 250, out.data());
+            assert(got.sum == expected.sum && got.count == expected.count && got.min == expected.min);
+            assert(std::equal(out.begin(), out.begin() + got.count, expected_out.begin()));
+        }
+
+        // 16-bit density columns must give the same answers as their widened int copy
+        std::vector<uint16_t> narrow(n);
+        for (int i = 0; i < n; ++i) narrow[i] = static_cast<uint16_t>(densities[i] = rand() % 4000);
+        expected = filter_reduce_densities(DensityKernelIsa::Scalar, positions.data(), densities.data(), n, 50, 250,
+                                           expected_out.data());
+        for (DensityKernelIsa isa : {DensityKernelIsa::Scalar, DensityKernelIsa::SSE41, DensityKernelIsa::AVX2,
+                                     DensityKernelIsa::AVX512, DensityKernelIsa::NEON}) {
+            if (!density_kernel_supported(isa)) continue;
+            DensityAccumulator got = filter_reduce_densities(isa, positions.data(), narrow.data(), n, 50, 250, out.data());
+            assert(got.sum == expected.sum && got.count == expected.count && got.min == expected.min);
+            assert(std::equal(out.begin(), out.begin() + got.count, expected_out.begin()));
+        }
+    }
+}
+
+// A batch over overlapping, unsorted and registered ranges must match one call per range
+void verify_batch_query() {
+    SensorDataManager target;
+    for (int i = 0; i < 3000; ++i) {
+        target.MeasureDensityReady((i * 7919) % 200, i * 1000);
+        if (i % 3 == 0) target.MeasurePositionReady(i / 3, i * 1000);
+    }
+    target.RegisterDensityRange(100, 300);
+
+    const DensityRange ranges[] = {{500, 700}, {0, 50}, {100, 300}, {250, 600}, {900, 800}, {40, 60}, {2000, 3000}};
+    const std::size_t count = sizeof(ranges) / sizeof(ranges[0]);
+    DensityStats batch[count];
+    target.CalculateDensityValuesBatch(ranges, batch, count);
+
+    for (std::size_t r = 0; r < count; ++r) {
+        DensityStats single;
+        target.CalculateDensityValues(ranges[r].min_pos_mm, ranges[r].max_pos_mm, &single.mean, &single.min, &single.median);
+        assert(batch[r].mean == single.mean && batch[r].min == single.min && batch[r].median == single.median);
+    }
+}
+
+// Block ingest (locked and lock-free) must leave the same state as per-sample ingest
+void verify_batch_ingest() {
+    SensorDataManager per_sample, batched, lock_free_batched(IngestMode::LockFree);
+    std::vector<SensorSample> density_block, position_block;
+
+    for (int i = 0; i < 9000; ++i) {
+        int density = (i * 7919) % 200;
+        per_sample.MeasureDensityReady(density, i * 1000);
+        density_block.push_back({density, i * 1000});
+        if (i % 3 == 0) {
+            per_sample.MeasurePositionReady(i / 3, i * 1000);
+            position_block.push_back({i / 3, i * 1000});
+        }
+
+        // Deliver in irregular blocks, positions first as a frame grabber would
+        if (density_block.size() == 257 || i == 8999) {
+            for (SensorDataManager* target : {&batched, &lock_free_batched}) {
+                target->MeasurePositionBatch(position_block.data(), position_block.size());
+                target->MeasureDensityBatch(density_block.data(), density_block.size());
+            }
+            density_block.clear();
+            position_block.clear();
+
+            for (const DensityRange& range : {DensityRange{0, 5000}, DensityRange{1800, 2500}}) {
+                DensityStats expected, got, got_lock_free;
+                per_sample.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &expected.mean, &expected.min, &expected.median);
+                batched.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &got.mean, &got.min, &got.median);
+                lock_free_batched.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm,
+                                                         &got_lock_free.mean, &got_lock_free.min, &got_lock_free.median);
+                for (const DensityStats& stats : {got, got_lock_free}) {
+                    assert(stats.mean == expected.mean && stats.min == expected.min && stats.median == expected.median);
+                }
+            }
+        }
+    }
+}
+
+// Snapshot queries must match exclusive ones, and stay consistent while a producer keeps writing
+void verify_snapshot_queries() {
+    SensorDataManager exclusive;
+    SensorDataManager snapshot(IngestMode::Locked, QueryConcurrency::Snapshot);
+
+    for (int i = 0; i < 12000; ++i) {
+        for (SensorDataManager* target : {&exclusive, &snapshot}) {
+            target->MeasureDensityReady((i * 7919) % 200, i * 1000);
+            // The board reverses once, so RangeSearch has to detect it on the copy
+            if (i % 3 == 0) target->MeasurePositionReady(i < 6000 ? i / 3 : 4000 - i / 3, i * 1000);
+        }
+        if (i % 1000 != 999) continue;
+
+        for (QueryEngine engine : {QueryEngine::BinarySearch, QueryEngine::MergeJoin, QueryEngine::RangeSearch}) {
+            exclusive.SetQueryEngine(engine);
+            snapshot.SetQueryEngine(engine);
+            DensityStats expected, got;
+            exclusive.CalculateDensityValues(1500, 2600, &expected.mean, &expected.min, &expected.median);
+            snapshot.CalculateDensityValues(1500, 2600, &got.mean, &got.min, &got.median);
+            assert(got.mean == expected.mean && got.min == expected.min && got.median == expected.median);
+        }
+    }
+
+    // Concurrent readers against a live writer: every answer must come from a consistent copy
+    // (all densities are in [0, 200) and the whole window lies inside the queried range)
+    SensorDataManager live(IngestMode::Locked, QueryConcurrency::Snapshot);
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        for (int i = 0; i < 200000; ++i) {
+            live.MeasureDensityReady(i % 200, i * 50);
+            if (i % 4 == 0) live.MeasurePositionReady(i / 4, i * 50);
+        }
+        done = true;
+    });
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&] {
+            while (!done) {
+                DensityStats stats;
+                live.CalculateDensityValues(INT_MIN, INT_MAX, &stats.mean, &stats.min, &stats.median);
+                assert(stats.min >= 0 && stats.min <= stats.median && stats.median < 200);
+                assert(stats.mean >= stats.min && stats.mean < 200);
+            }
+        });
+    }
+    writer.join();
+    for (std::thread& reader : readers) reader.join();
+}
+
+// Timestamps past the 32-bit range (and a forward clock jump) must behave like small ones
+void verify_wide_timestamps() {
+    const int64_t start_us = INT32_MAX - int64_t(3'000'000);
+    const int64_t jump_us = int64_t(3600) * 1'000'000;
+
+    SensorDataManager wide, wide_snapshot(IngestMode::Locked, QueryConcurrency::Snapshot);
+    SensorDataManager reference, reference_after_jump;
+
+    for (int i = 0; i < 24000; ++i) {
+        // Second half arrives one hour later: the window must restart instead of wrapping
+        const bool jumped = i >= 12000;
+        const int64_t local_us = int64_t(i) * 1000 + 1'000'000;
+        const int64_t wide_us = start_us + local_us + (jumped ? jump_us : 0);
+        SensorDataManager& expected = jumped ? reference_after_jump : reference;
+
+        const int density = (i * 7919) % 200;
+        const int position = (i % 12000) / 3;
+        for (SensorDataManager* target : {&wide, &wide_snapshot, &expected}) {
+            target->MeasureDensityReady(density, target == &expected ? local_us : wide_us);
+            if (i % 3 == 0) target->MeasurePositionReady(position, target == &expected ? local_us : wide_us);
+        }
+        if (i % 997 != 0) continue;
+
+        DensityStats want, got, got_snapshot;
+        expected.CalculateDensityValues(500, 3000, &want.mean, &want.min, &want.median);
+        wide.CalculateDensityValues(500, 3000, &got.mean, &got.min, &got.median);
+        wide_snapshot.CalculateDensityValues(500, 3000, &got_snapshot.mean, &got_snapshot.min, &got_snapshot.median);
+        for (const DensityStats& stats : {got, got_snapshot}) {
+            assert(stats.mean == want.mean && stats.min == want.min && stats.median == want.median);
+        }
+    }
+}
+
+// 2-byte densities / 4-byte timestamps must answer exactly like the default configuration
+void verify_compact_manager() {
+    SensorDataManager wide;
+    CompactSensorDataManager compact;
+    const int registered = compact.RegisterDensityRange(1200, 1900);
+    wide.RegisterDensityRange(1200, 1900);
+
+    for (int i = 0; i < 15000; ++i) {
+        const int density = (i * 7919) % 4000;
+        wide.MeasureDensityReady(density, i * 500);
+        compact.MeasureDensityReady(density, i * 500);
+        if (i % 4 == 0) {
+            wide.MeasurePositionReady(i / 4, i * 500);
+            compact.MeasurePositionReady(i / 4, i * 500);
+        }
+        if (i % 1500 != 1499) continue;
+
+        for (QueryEngine engine : {QueryEngine::BinarySearch, QueryEngine::MergeJoin, QueryEngine::RangeSearch}) {
+            wide.SetQueryEngine(engine);
+            compact.SetQueryEngine(engine);
+            for (const DensityRange& range : {DensityRange{0, 5000}, DensityRange{1200, 1900}, DensityRange{2500, 2600}}) {
+                DensityStats expected, got;
+                wide.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &expected.mean, &expected.min, &expected.median);
+                compact.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &got.mean, &got.min, &got.median);
+                assert(got.mean == expected.mean && got.min == expected.min && got.median == expected.median);
+            }
+        }
+
+        DensityRange ranges[] = {{0, 1000}, {1000, 2000}, {1500, 3000}};
+        DensityStats expected[3], got[3];
+        wide.CalculateDensityValuesBatch(ranges, expected, 3);
+        compact.CalculateDensityValuesBatch(ranges, got, 3);
+        for (int r = 0; r < 3; ++r) {
+            assert(got[r].mean == expected[r].mean && got[r].min == expected[r].min && got[r].median == expected[r].median);
+        }
+    }
+    compact.UnregisterDensityRange(registered);
+}
+
+// Positions resolved at ingest (and the bucket index built on them) must answer like the interpolating
+// engines. Positions arrive every 5 ms and queries run on a 5 ms boundary, so every density sample in
+// the window is bracketed by positions still in the window (where the resolving and the clamping
+// engines agree by definition). The last second holds out-of-domain densities (index fallback).
+void verify_precomputed_engine(QueryEngine engine) {
+    SensorDataManager reference, precomputed, switched, lock_free(IngestMode::LockFree);
+    precomputed.SetQueryEngine(engine);
+    lock_free.SetQueryEngine(engine);
+    int registered = -1;
+
+    for (int i = 0; i <= 12000; ++i) {
+        const int density = i > 11000 && i % 97 == 0 ? 5000 : (i * 7919) % 200;
+        // The board reverses half way through
+        const int position = i < 6000 ? i / 5 : 2400 - i / 5;
+        for (SensorDataManager* target : {&reference, &precomputed, &switched, &lock_free}) {
+            target->MeasureDensityReady(density, i * 1000);
+            if (i % 5 == 0) target->MeasurePositionReady(position, i * 1000);
+        }
+
+        // Switching engines backfills the window; a range registered and dropped meanwhile must not
+        // disturb the column
+        if (i == 7000) switched.SetQueryEngine(engine);
+        if (i == 3000) registered = precomputed.RegisterDensityRange(600, 900);
+        if (i == 9000) precomputed.UnregisterDensityRange(registered);
+        if (i % 1000 != 0 || i == 0) continue;
+
+        const DensityRange ranges[] = {{0, 5000}, {600, 900}, {1000, 1150}, {300, 200}, {64, 127}, {-50, 70}, {1100, 1100}};
+        for (const DensityRange& range : ranges) {
+            DensityStats expected;
+            reference.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &expected.mean, &expected.min, &expected.median);
+            for (SensorDataManager* target : {&precomputed, &switched, &lock_free}) {
+                DensityStats got;
+                target->CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &got.mean, &got.min, &got.median);
+                assert(got.mean == expected.mean && got.min == expected.min && got.median == expected.median);
+            }
+        }
+
+        DensityStats expected[7], got[7];
+        reference.CalculateDensityValuesBatch(ranges, expected, 7);
+        precomputed.CalculateDensityValuesBatch(ranges, got, 7);
+        for (int r = 0; r < 7; ++r) {
+            assert(got[r].mean == expected[r].mean && got[r].min == expected[r].min && got[r].median == expected[r].median);
+        }
+    }
+}
+
+// Lanes of a sharded manager must answer like standalone managers fed the same lane data, and the
+// shared maintenance must drain lock-free lanes that are never queried
+void verify_sharded_manager() {
+    const std::size_t lanes = 5;
+    ShardedSensorDataManager sharded(lanes, 2, IngestMode::Locked, QueryConcurrency::Exclusive, std::chrono::microseconds(500));
+    std::vector<std::unique_ptr<SensorDataManager>> standalone;
+    for (std::size_t lane = 0; lane < lanes; ++lane) standalone.push_back(std::make_unique<SensorDataManager>());
+
+    std::vector<std::vector<SensorSample>> blocks(lanes);
+    for (int i = 0; i < 9000; ++i) {
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            const int density = (i * 7919 + static_cast<int>(lane) * 31) % 200;
+            const int position = i / 3 + static_cast<int>(lane) * 100;
+            std::vector<SensorSample>& block = blocks[lane];
+            // Odd lanes deliver their densities in blocks, each lane its own
+            if (lane % 2 == 1) {
+                block.push_back({density, i * 1000});
+                if (block.size() == 64) {
+                    sharded.MeasureDensityBatch(lane, block.data(), block.size());
+                    standalone[lane]->MeasureDensityBatch(block.data(), block.size());
+                    block.clear();
+                }
+            } else {
+                sharded.MeasureDensityReady(lane, density, i * 1000);
+                standalone[lane]->MeasureDensityReady(density, i * 1000);
+            }
+            if (i % 3 == 0) {
+                sharded.MeasurePositionReady(lane, position, i * 1000);
+                standalone[lane]->MeasurePositionReady(position, i * 1000);
+            }
+            // Flush lane blocks so every lane holds the same samples at query time
+            if (lane % 2 == 1 && !block.empty() && i % 1000 == 999) {
+                sharded.MeasureDensityBatch(lane, block.data(), block.size());
+                standalone[lane]->MeasureDensityBatch(block.data(), block.size());
+                block.clear();
+            }
+        }
+        if (i % 1000 != 999) continue;
+
+        DensityStats all[lanes];
+        sharded.CalculateDensityValuesAllLanes(1000, 2500, all);
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            DensityStats expected, got;
+            standalone[lane]->CalculateDensityValues(1000, 2500, &expected.mean, &expected.min, &expected.median);
+            sharded.CalculateDensityValues(lane, 1000, 2500, &got.mean, &got.min, &got.median);
+            for (const DensityStats& stats : {got, all[lane]}) {
+                assert(stats.mean == expected.mean && stats.min == expected.min && stats.median == expected.median);
+            }
+        }
+    }
+
+    // Lanes answer asynchronous queries on the shared pool
+    std::vector<std::future<DensityStats>> futures;
+    for (std::size_t lane = 0; lane < lanes; ++lane) futures.push_back(sharded.Lane(lane).CalculateDensityValuesAsync(1000, 2500));
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        DensityStats expected;
+        const DensityStats got = futures[lane].get();
+        standalone[lane]->CalculateDensityValues(1000, 2500, &expected.mean, &expected.min, &expected.median);
+        assert(got.mean == expected.mean && got.min == expected.min && got.median == expected.median);
+    }
+
+    // 2 x 60000 samples overflow a 65536-slot ingest ring unless maintenance drains it in between
+    ShardedSensorDataManager lock_free(2, 1, IngestMode::LockFree, QueryConcurrency::Exclusive, std::chrono::microseconds(500));
+    int64_t time_us = 0;
+    for (int round = 0; round < 4; ++round) {
+        for (int i = 0; i < 60000; ++i, time_us += 10) lock_free.MeasureDensityReady(round % 2, i % 200, time_us);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    assert(lock_free.DroppedSamples() == 0);
+}
+
+void verify_board_segmentation(IngestMode mode, WorkerPool* pool) {
+    // 1.5 s boards; the position climbs 0 -> 749 mm and drops back to 0 at the next board's leading edge
+    const int board_ms = 1500, boards = 6;
+    SensorDataManager segmented(mode);
+    segmented.EnableBoardSegmentation(100, pool);
+    std::vector<std::unique_ptr<SensorDataManager>> reference;
+
+    for (int i = 0; i < boards * board_ms + 1200; ++i) {
+        const int board = i / board_ms, t = i % board_ms;
+        if (t == 0) reference.push_back(std::make_unique<SensorDataManager>());
+        const int density = (i * 7919) % 200;
+        segmented.MeasureDensityReady(density, i * 1000);
+        reference[board]->MeasureDensityReady(density, i * 1000);
+        if (i % 3 == 0) {
+            segmented.MeasurePositionReady(t / 2, i * 1000);
+            reference[board]->MeasurePositionReady(t / 2, i * 1000);
+        }
+
+        // The live buffers hold the current board only
+        if (t == 1100) {
+            if (mode == IngestMode::LockFree) segmented.Maintain();
+            DensityStats expected, got;
+            reference[board]->CalculateDensityValues(INT_MIN, INT_MAX, &expected.mean, &expected.min, &expected.median);
+            segmented.CalculateDensityValues(INT_MIN, INT_MAX, &got.mean, &got.min, &got.median);
+            assert(got.mean == expected.mean && got.min == expected.min && got.median == expected.median);
+        }
+    }
+    segmented.Maintain();
+    assert(segmented.BoardsDetected() == boards);
+
+    for (int board = 0; board < boards; ++board) {
+        BoardSummary summary;
+        while (!segmented.GetBoardSummary(board, &summary)) std::this_thread::yield();
+        assert(summary.board_id == static_cast<uint64_t>(board));
+        assert(summary.start_time_uS == int64_t(board) * board_ms * 1000);
+        assert(summary.end_time_uS == int64_t(board + 1) * board_ms * 1000);
+        assert(summary.sample_count == board_ms && summary.min_pos_mm == 0 && summary.max_pos_mm == 748);
+
+        DensityStats expected, got;
+        reference[board]->CalculateDensityValues(INT_MIN, INT_MAX, &expected.mean, &expected.min, &expected.median);
+        assert(summary.stats.mean == expected.mean && summary.stats.min == expected.min && summary.stats.median == expected.median);
+
+        reference[board]->CalculateDensityValues(200, 400, &expected.mean, &expected.min, &expected.median);
+        assert(segmented.CalculateBoardDensityValues(board, 200, 400, &got.mean, &got.min, &got.median));
+        assert(got.mean == expected.mean && got.min == expected.min && got.median == expected.median);
+    }
+    BoardSummary missing;
+    assert(!segmented.GetBoardSummary(boards, &missing));
+}
+
+// A board scanned for longer than the window is trimmed before its reset and says so
+void verify_truncated_board() {
+    SensorDataManager segmented;
+    segmented.EnableBoardSegmentation(100);
+
+    // Board 0 takes 7 s, board 1 takes 1 s, board 2 ends the test. Positions come every 3 ms, so
+    // the resets land at 7.002 s and 8.001 s
+    auto board_time = [](int i) { return i < 7000 ? i : i < 8000 ? i - 7000 : i - 8000; };
+    for (int i = 0; i < 8100; ++i) {
+        segmented.MeasureDensityReady((i * 7919) % 200, int64_t(i) * 1000);
+        if (i % 3 == 0) segmented.MeasurePositionReady(board_time(i) / 2, int64_t(i) * 1000);
+    }
+    segmented.Maintain();
+    assert(segmented.BoardsDetected() == 2);
+
+    BoardSummary summary;
+    assert(segmented.GetBoardSummary(0, &summary));
+    assert(summary.truncated);
+    assert(summary.start_time_uS >= 1'900'000 && summary.end_time_uS == 7'002'000);
+    assert(summary.sample_count > 4900 && summary.sample_count < 5200);
+
+    assert(segmented.GetBoardSummary(1, &summary));
+    assert(!summary.truncated);
+    assert(summary.start_time_uS == 7'002'000 && summary.end_time_uS == 8'001'000 && summary.sample_count == 999);
+}
+
+// Once a thread has run a query shape, repeating it (with ingest in between) must not allocate
+void verify_query_allocations(QueryEngine engine, QueryConcurrency concurrency, MedianAlgorithm algorithm) {
+    SensorDataManager target(IngestMode::Locked, concurrency);
+    target.SetQueryEngine(engine);
+    target.SetMedianAlgorithm(algorithm);
+    if (concurrency == QueryConcurrency::Exclusive) target.RegisterDensityRange(100, 300);
+
+    // 3 s sawtooth boards: every round ingests one period, so the window content repeats exactly
+    const DensityRange ranges[] = {{500, 700}, {0, 50}, {100, 300}, {250, 600}, {1200, 1400}};
+    const std::size_t count = sizeof(ranges) / sizeof(ranges[0]);
+    int i = 0;
+    auto round = [&] {
+        for (const int end = i + 3000; i < end; ++i) {
+            target.MeasureDensityReady((i * 7919) % 200, int64_t(i) * 1000);
+            if (i % 3 == 0) target.MeasurePositionReady((i % 3000) / 2, int64_t(i) * 1000);
+        }
+        int mean, min, median;
+        target.CalculateDensityValues(200, 900, &mean, &min, &median);
+        target.CalculateDensityValues(100, 300, &mean, &min, &median);
+        target.CalculateDensityReport(200, 900, {10, 50, 90});
+        int profile[64];
+        target.ResampleDensityProfile(200, 64, profile);
+        DensityStats batch[count];
+        target.CalculateDensityValuesBatch(ranges, batch, count);
+    };
+
+    for (int warm_up = 0; warm_up < 4; ++warm_up) round();
+    const std::size_t before = thread_allocations;
+    for (int steady = 0; steady < 4; ++steady) round();
+    assert(thread_allocations == before);
+}
+
+// Built-in metrics count every public call and account for every trimmed sample
+void verify_metrics() {
+    SensorDataManager target;
+    std::vector<SensorSample> block;
+    for (int i = 0; i < 8000; ++i) {
+        if (i < 4000) target.MeasureDensityReady((i * 7919) % 200, i * 1000);
+        else block.push_back({(i * 7919) % 200, i * 1000});
+        if (block.size() == 100) {
+            target.MeasureDensityBatch(block.data(), block.size());
+            block.clear();
+        }
+        if (i % 3 == 0) target.MeasurePositionReady(i / 3, i * 1000);
+    }
+    for (int q = 0; q < 10; ++q) {
+        int mean, min, median;
+        target.CalculateDensityValues(100, 2000, &mean, &min, &median);
+    }
+
+    const SensorMetricsSnapshot metrics = target.GetMetrics();
+    if (!metrics.enabled) {
+        assert(metrics.queries == 0 && metrics.query_ns.count == 0 && metrics.densities_trimmed == 0);
+        return;
+    }
+    assert(metrics.density_ingest_calls == 4000 + 40 && metrics.position_ingest_calls == 2667 && metrics.queries == 10);
+    assert(metrics.query_ns.count == 10);
+
+    // Ingest timing samples one call in SENSOR_METRICS_SAMPLE_PERIOD per thread, across both streams
+    const uint64_t ingest_calls = metrics.density_ingest_calls + metrics.position_ingest_calls;
+    const uint64_t timed_calls = metrics.density_ingest_ns.count + metrics.position_ingest_ns.count;
+    assert(timed_calls <= ingest_calls / SENSOR_METRICS_SAMPLE_PERIOD + 1 && timed_calls + 1 >= ingest_calls / SENSOR_METRICS_SAMPLE_PERIOD);
+
+    // Single-threaded, so no acquisition ever waited
+    assert(metrics.density_lock_wait_ns.count == 0 && metrics.query_lock_wait_ns.count == 0);
+
+    // Queries trim exactly: every sample is either trimmed or live, and each query saw the live window
+    assert(metrics.densities_trimmed + metrics.density_depth == 8000);
+    assert(metrics.positions_trimmed + metrics.position_depth == 2667);
+    assert(metrics.peak_density_depth >= metrics.density_depth);
+    assert(metrics.query_window_samples.sum == 10 * metrics.density_depth);
+    assert(metrics.query_ns.percentile(0.5) > 0 && metrics.query_ns.percentile(0.5) <= metrics.query_ns.percentile(1.0));
+    assert(metrics.density_ring_depth == 0 && metrics.dropped_samples == 0);
+
+    // A batch counts one query per range and one timing sample
+    const DensityRange ranges[] = {{100, 400}, {400, 900}, {900, 2000}};
+    DensityStats results[3];
+    target.CalculateDensityValuesBatch(ranges, results, 3);
+    const SensorMetricsSnapshot batched = target.GetMetrics();
+    assert(batched.queries == metrics.queries + 3 && batched.query_ns.count == metrics.query_ns.count + 1);
+}
+
+// Asynchronous queries (futures, callbacks, coalesced rounds) answer exactly like synchronous ones
+void verify_async_queries(QueryConcurrency concurrency) {
+    SensorDataManager target(IngestMode::Locked, concurrency);
+    for (int i = 0; i < 8000; ++i) {
+        target.MeasureDensityReady((i * 7919) % 200, i * 1000);
+        if (i % 3 == 0) target.MeasurePositionReady(i / 3, i * 1000);
+    }
+
+    const DensityRange ranges[] = {{500, 700}, {0, 50}, {1200, 2400}, {500, 700}, {1900, 2100}};
+    const int range_count = sizeof(ranges) / sizeof(ranges[0]);
+    DensityStats expected[range_count];
+    for (int r = 0; r < range_count; ++r) {
+        target.CalculateDensityValues(ranges[r].min_pos_mm, ranges[r].max_pos_mm, &expected[r].mean, &expected[r].min, &expected[r].median);
+    }
+
+    std::vector<std::future<DensityStats>> futures;
+    std::vector<DensityStats> callback_results(200);
+    std::atomic<int> callbacks_done{0};
+    for (int q = 0; q < 200; ++q) {
+        const DensityRange& range = ranges[q % range_count];
+        futures.push_back(target.CalculateDensityValuesAsync(range.min_pos_mm, range.max_pos_mm));
+        target.CalculateDensityValuesAsync(range.min_pos_mm, range.max_pos_mm, [&, q](const DensityStats& stats) {
+            callback_results[q] = stats;
+            callbacks_done.fetch_add(1, std::memory_order_release);
+        });
+    }
+    for (int q = 0; q < 200; ++q) {
+        const DensityStats got = futures[q].get();
+        const DensityStats& want = expected[q % range_count];
+        assert(got.mean == want.mean && got.min == want.min && got.median == want.median);
+    }
+    while (callbacks_done.load(std::memory_order_acquire) < 200) std::this_thread::yield();
+    for (int q = 0; q < 200; ++q) {
+        const DensityStats& want = expected[q % range_count];
+        assert(callback_results[q].mean == want.mean && callback_results[q].min == want.min &&
+               callback_results[q].median == want.median);
+    }
+
+    const SensorMetricsSnapshot metrics = target.GetMetrics();
+    assert(!metrics.enabled || (metrics.async_queries == 400 && metrics.async_rounds >= 1 && metrics.async_rounds <= 400));
+
+    // Destruction answers every request still queued
+    std::atomic<int> answered{0};
+    {
+        SensorDataManager short_lived(IngestMode::Locked, concurrency);
+        short_lived.MeasurePositionReady(0, 0);
+        for (int q = 0; q < 100; ++q) short_lived.CalculateDensityValuesAsync(0, 10, [&](const DensityStats&) { ++answered; });
+    }
+    assert(answered == 100);
+
+    // An external pool answers instead of the internal one, and outlives a manager that still has requests on it
+    WorkerPool shared(1);
+    std::promise<std::thread::id> worker_id;
+    shared.submit([&] { worker_id.set_value(std::this_thread::get_id()); });
+    const std::thread::id worker = worker_id.get_future().get();
+    std::atomic<int> on_worker{0};
+    {
+        SensorDataManager pooled(IngestMode::Locked, concurrency);
+        pooled.SetAsyncWorkers(&shared);
+        pooled.MeasurePositionReady(0, 0);
+        for (int q = 0; q < 100; ++q) {
+            pooled.CalculateDensityValuesAsync(0, 10, [&](const DensityStats&) {
+                if (std::this_thread::get_id() == worker) ++on_worker;
+            });
+        }
+    }
+    assert(on_worker == 100);
+}
+
+// Callbacks waiting for asynchronous results neither deadlock the query pool nor, from a slow
+// subscriber, hold up other queries
+void verify_async_callback_waits() {
+    SensorDataManager target;
+    for (int i = 0; i < 3000; ++i) {
+        target.MeasureDensityReady((i * 7919) % 200, i * 1000);
+        if (i % 3 == 0) target.MeasurePositionReady(i / 3, i * 1000);
+    }
+    DensityStats want;
+    target.CalculateDensityValues(200, 600, &want.mean, &want.min, &want.median);
+
+    // Every worker busy in on_done, each waiting for a future
+    std::atomic<int> matched{0};
+    for (int q = 0; q < 16; ++q) {
+        target.CalculateDensityValuesAsync(0, 10, [&](const DensityStats&) {
+            const DensityStats got = target.CalculateDensityValuesAsync(200, 600).get();
+            if (got.mean == want.mean && got.min == want.min && got.median == want.median) ++matched;
+        });
+    }
+    for (int wait = 0; wait < 5000 && matched < 16; ++wait) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(matched == 16);
+
+    // A subscriber stuck in on_update: futures are still answered, and it may wait for one itself
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<int> updates{0};
+    std::atomic<bool> waited{false};
+    const int id = target.SubscribeDensityRange(200, 600, [&](const DensityStats&) {
+        if (updates++ != 0) return;
+        released.wait();
+        const DensityStats got = target.CalculateDensityValuesAsync(200, 600).get();
+        waited = got.mean == want.mean;
+    });
+    while (updates == 0) std::this_thread::yield();
+    const DensityStats got = target.CalculateDensityValuesAsync(200, 600).get();
+    assert(got.mean == want.mean && got.min == want.min && got.median == want.median);
+    release.set_value();
+    while (!waited) std::this_thread::yield();
+    target.UnregisterDensityRange(id);
+}
+
+// Standing queries push the maintained statistics of their range as samples enter and leave it,
+// and nothing for ranges no sample touches
+void verify_standing_queries(MedianAlgorithm algorithm) {
+    struct Subscriber {
+        std::mutex mutex;
+        DensityStats latest{-1, -1, -1};
+        int updates = 0;
+    };
+    Subscriber leaving, live, untouched;
+    auto subscribe = [](SensorDataManager& target, int min_pos_mm, int max_pos_mm, Subscriber& subscriber,
+                        MedianAlgorithm algorithm) {
+        return target.SubscribeDensityRange(min_pos_mm, max_pos_mm, [&subscriber](const DensityStats& stats) {
+            std::lock_guard<std::mutex> lock(subscriber.mutex);
+            subscriber.latest = stats;
+            ++subscriber.updates;
+        }, algorithm);
+    };
+    auto settles_at = [](Subscriber& subscriber, const DensityStats& want) {
+        for (int wait = 0; wait < 2000; ++wait) {
+            {
+                std::lock_guard<std::mutex> lock(subscriber.mutex);
+                if (subscriber.latest.mean == want.mean && subscriber.latest.min == want.min &&
+                    subscriber.latest.median == want.median)
+                    return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    };
+
+    SensorDataManager target;
+    // The current (empty) state is pushed at once
+    const int leaving_id = subscribe(target, 500, 700, leaving, algorithm);
+    const int live_id = subscribe(target, 2000, 2300, live, algorithm);
+    subscribe(target, 100'000, 100'100, untouched, algorithm);
+    assert(settles_at(untouched, DensityStats{0, 0, 0}));
+
+    // 8 s of data: [500, 700] fills after ~1.5 s and is trimmed empty again by the end
+    for (int i = 0; i < 8000; ++i) {
+        target.MeasureDensityReady((i * 7919) % 200, i * 1000);
+        if (i % 3 == 0) target.MeasurePositionReady(i / 3, i * 1000);
+    }
+    target.MeasurePositionReady(2667, 8'000'000);
+
+    DensityStats want;
+    target.CalculateDensityValues(2000, 2300, &want.mean, &want.min, &want.median);
+    assert(want.mean > 0);
+    assert(settles_at(live, want));
+    assert(settles_at(leaving, DensityStats{0, 0, 0}));
+    {
+        std::lock_guard<std::mutex> lock(leaving.mutex);
+        assert(leaving.updates > 2);
+    }
+    {
+        std::lock_guard<std::mutex> lock(untouched.mutex);
+        assert(untouched.updates == 1);
+    }
+
+    // No update after UnregisterDensityRange once the delivery in progress has finished
+    target.UnregisterDensityRange(live_id);
+    target.UnregisterDensityRange(leaving_id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    int live_updates;
+    {
+        std::lock_guard<std::mutex> lock(live.mutex);
+        live_updates = live.updates;
+    }
+    for (int i = 8000; i < 9000; ++i) {
+        target.MeasureDensityReady(100, i * 1000);
+        if (i % 3 == 0) target.MeasurePositionReady(2100, i * 1000);
+    }
+    target.Maintain();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::lock_guard<std::mutex> lock(live.mutex);
+    assert(live.updates == live_updates);
+
+    const SensorMetricsSnapshot metrics = target.GetMetrics();
+    assert(!metrics.enabled || metrics.standing_updates >= 3);
+}
+
+// A capture file carries the window across a restart: the re-attached manager answers like one
+// that never stopped, and the raw layout is readable through the header alone
+void verify_capture_file() {
+    const char* path = "microtec_capture_test.ring";
+    std::remove(path);
+    SensorDataManager uninterrupted;
+    auto feed = [&](SensorDataManager& target, int from, int to) {
+        for (int i = from; i < to; ++i) {
+            const int density = (i * 7919) % 200;
+            target.MeasureDensityReady(density, i * 1000);
+            uninterrupted.MeasureDensityReady(density, i * 1000);
+            if (i % 3 == 0) {
+                target.MeasurePositionReady(i / 3, i * 1000);
+                uninterrupted.MeasurePositionReady(i / 3, i * 1000);
+            }
+        }
+    };
+    auto same_answers = [&](SensorDataManager& target) {
+        for (const DensityRange range : {DensityRange{1500, 2000}, DensityRange{0, 3000}, DensityRange{2600, 2700}}) {
+            DensityStats got, want;
+            target.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &got.mean, &got.min, &got.median);
+            uninterrupted.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &want.mean, &want.min, &want.median);
+            assert(got.mean == want.mean && got.min == want.min && got.median == want.median);
+        }
+    };
+
+    {
+        MappedRingFile file(path, SensorDataManager::CaptureLayout());
+        assert(!file.attached());
+        SensorDataManager first_run(file);
+        feed(first_run, 0, 8000);
+        same_answers(first_run);
+    }
+    {
+        MappedRingFile file(path, SensorDataManager::CaptureLayout());
+        assert(file.attached());
+
+        // Raw reader view: the newest density sits at head + count - 1 of ring 0
+        const MappedRingHeader& header = file.header();
+        const SampleRingIndices& densities = header.indices[MappedRingFile::DENSITY];
+        assert(densities.pushed == 8000 && densities.count > 0 && densities.count <= header.layout.density_capacity);
+        const int* values = reinterpret_cast<const int*>(file.data() + header.values_offset[MappedRingFile::DENSITY]);
+        const DefaultSensorTime* times = reinterpret_cast<const DefaultSensorTime*>(file.data() + header.times_offset[MappedRingFile::DENSITY]);
+        assert(values[densities.head + densities.count - 1] == (7999 * 7919) % 200);
+        assert(header.time_base_us + times[densities.head + densities.count - 1] == 7'999'000);
+
+        SensorDataManager second_run(file);
+        same_answers(second_run);
+        feed(second_run, 8000, 12000);
+        same_answers(second_run);
+    }
+    {
+        // Another configuration's layout starts over with an empty capture
+        MappedRingFile file(path, CompactSensorDataManager::CaptureLayout());
+        assert(!file.attached());
+        CompactSensorDataManager other(file);
+        int mean, min, median;
+        other.CalculateDensityValues(0, 3000, &mean, &min, &median);
+        assert(mean == 0 && min == 0 && median == 0);
+    }
+    std::remove(path);
+}
+
+// A recording replays into a manager that then answers exactly like the recorded one; the
+// encoding round-trips every sample, including backwards steps and large jumps
+void verify_record_replay() {
+    const char* path = "microtec_recording_test.rec";
+    SensorDataManager recorded;
+    std::vector<RecordedSample> expected;
+    SampleRecorder recorder(path);
+    recorded.SetRecorder(&recorder);
+    std::vector<SensorSample> block;
+    for (int i = 0; i < 8000; ++i) {
+        // Out-of-order density timestamps and a board reversal, as production traffic has
+        const int64_t time_us = int64_t(i) * 1000 + (i % 97 == 0 ? -1500 : 0);
+        const int density = (i * 7919) % 200 + (i == 4000 ? 1'000'000 : 0);
+        const int position_mm = i < 6000 ? i / 3 : 4000 - i / 3;
+        recorded.MeasureDensityReady(density, time_us);
+        expected.push_back({SampleStream::Density, density, time_us});
+        if (i % 3 == 0) block.push_back({position_mm, int64_t(i) * 1000});
+        if (block.size() == 8 || i == 7999) {
+            recorded.MeasurePositionBatch(block.data(), block.size());
+            for (const SensorSample& position : block) expected.push_back({SampleStream::Position, position.value, position.time_uS});
+            block.clear();
+        }
+        if (i % 250 == 249) recorded.Maintain();
+    }
+    recorded.SetRecorder(nullptr);
+    recorder.flush();
+    assert(recorder.samples() == expected.size());
+
+    // Each stream keeps its own order, and apart from the deliberately late densities the
+    // recording is in timestamp order across the streams
+    SampleRecordingReader reader(path);
+    assert(reader.size_bytes() < 4 * expected.size());
+    RecordedSample sample;
+    std::size_t next[2] = {0, 0};
+    std::vector<RecordedSample> per_stream[2];
+    for (const RecordedSample& want : expected) per_stream[static_cast<int>(want.stream)].push_back(want);
+    int64_t previous_us = INT64_MIN;
+    while (reader.next(sample)) {
+        const std::vector<RecordedSample>& stream = per_stream[static_cast<int>(sample.stream)];
+        std::size_t& i = next[static_cast<int>(sample.stream)];
+        assert(i < stream.size() && sample.value == stream[i].value && sample.time_uS == stream[i].time_uS);
+        ++i;
+        if (sample.time_uS % 1000 != 0) continue;
+        assert(sample.time_uS >= previous_us);
+        previous_us = sample.time_uS;
+    }
+    assert(next[0] == per_stream[0].size() && next[1] == per_stream[1].size());
+
+    reader.rewind();
+    SensorDataManager replayed;
+    const ReplayResult result = ReplayRecording(reader, replayed);
+    assert(result.samples == expected.size());
+    for (const DensityRange range : {DensityRange{500, 900}, DensityRange{0, 3000}}) {
+        DensityStats got, want;
+        replayed.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &got.mean, &got.min, &got.median);
+        recorded.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &want.mean, &want.min, &want.median);
+        assert(got.mean == want.mean && got.min == want.min && got.median == want.median);
+    }
+
+    recorded.MeasureDensityReady(5, 9'000'000);
+    assert(recorder.samples() == expected.size());
+    std::remove(path);
+}
+
+// Samples a full LockFree ring drops never reach the recording
+void verify_record_accepted_only() {
+    const char* path = "microtec_recording_dropped_test.rec";
+    SensorDataManager manager(IngestMode::LockFree);
+    SampleRecorder recorder(path);
+    manager.SetRecorder(&recorder);
+    const int pushed = (1 << 16) + 5000;
+    for (int i = 0; i < pushed; ++i) manager.MeasureDensityReady(i % 200, int64_t(i) * 50);
+    assert(recorder.samples() == 0);
+
+    manager.Maintain();
+    manager.SetRecorder(nullptr);
+    assert(manager.DroppedSamples() > 0 && manager.UnrecordedSamples() == 0);
+    assert(recorder.samples() == pushed - manager.DroppedSamples());
+
+    // Without Maintain, a Locked stream's stage fills up and the excess is counted instead
+    SensorDataManager unmaintained;
+    SampleRecorder overflowing(path);
+    unmaintained.SetRecorder(&overflowing);
+    for (int i = 0; i < pushed; ++i) unmaintained.MeasureDensityReady(i % 200, int64_t(i) * 50);
+    assert(overflowing.samples() == 0);
+    unmaintained.SetRecorder(nullptr);
+    assert(unmaintained.UnrecordedSamples() == 5000 && overflowing.samples() == 1 << 16);
+    std::remove(path);
+}
+
+// A maintained recording is in arrival-time order across the streams, even with positions
+// delivered in late blocks and nothing but Maintain() writing
+void verify_record_order(IngestMode mode) {
+    const char* path = "microtec_recording_order_test.rec";
+    std::size_t total = 0;
+    {
+        SensorDataManager manager(mode);
+        SampleRecorder recorder(path);
+        manager.SetRecorder(&recorder);
+        std::vector<SensorSample> block;
+        for (int i = 0; i < 20000; ++i) {
+            manager.MeasureDensityReady((i * 7919) % 200, int64_t(i) * 1000);
+            ++total;
+            if (i % 3 == 0) block.push_back({i / 3, int64_t(i) * 1000});
+            if (block.size() == 16) {
+                manager.MeasurePositionBatch(block.data(), block.size());
+                total += block.size();
+                block.clear();
+            }
+            if (i % 100 == 99) manager.Maintain();
+        }
+        manager.Maintain();
+        assert(recorder.samples() > 0 && recorder.samples() < total);
+        manager.SetRecorder(nullptr);
+        assert(recorder.samples() == total && manager.UnrecordedSamples() == 0);
+    }
+
+    SampleRecordingReader reader(path);
+    RecordedSample sample;
+    int64_t previous_us = INT64_MIN;
+    std::size_t read = 0;
+    for (; reader.next(sample); ++read) {
+        assert(sample.time_uS >= previous_us);
+        previous_us = sample.time_uS;
+    }
+    assert(read == total);
+    std::remove(path);
+}
+
+// A failed write is sticky: flush() throws and failed() stays set, the destructor does not throw
+void verify_recording_write_failure() {
+    std::FILE* probe = std::fopen("/dev/full", "wb");
+    if (!probe) return;
+    std::fclose(probe);
+
+    SampleRecorder recorder("/dev/full");
+    assert(!recorder.failed());
+    for (int i = 0; i < 50000; ++i) recorder.record(SampleStream::Density, i % 200, int64_t(i) * 1000);
+    bool threw = false;
+    try {
+        recorder.flush();
+    } catch (const std::system_error& e) {
+        threw = e.code().value() == ENOSPC;
+    }
+    assert(threw && recorder.failed() && recorder.samples() == 50000);
+
+    threw = false;
+    try {
+        recorder.flush();
+    } catch (const std::system_error&) {
+        threw = true;
+    }
+    assert(threw && recorder.failed());
+}
+
+void verify_compressed_history() {
+    SensorDataManager manager;
+    DensityStats got;
+    assert(!manager.CalculateHistoryDensityValues(1'000'000, 0, 100, &got.mean, &got.min, &got.median));
+
+    // 20 s at 1 kHz, four times the live window; the history starts 2 s in and backfills the
+    // window. Densities share the position timestamps, so every resolved position is exact.
+    struct Kept { int64_t time_us; int pos; int density; };
+    std::vector<Kept> kept;
+    for (int i = 0; i < 20000; ++i) {
+        if (i == 2000) manager.EnableCompressedHistory(30'000'000);
+        const int64_t time_us = int64_t(i) * 1000 + (i % 7 == 0 ? 13 : 0);
+        const int pos = i % 3000;
+        const int density = (i * 7919) % 4096;
+        manager.MeasurePositionReady(pos, time_us);
+        manager.MeasureDensityReady(density, time_us);
+        kept.push_back({time_us, pos, density});
+    }
+
+    for (const int64_t window_us : {int64_t(1'000'000), int64_t(7'000'000), int64_t(30'000'000)}) {
+        for (const DensityRange range : {DensityRange{0, 2999}, DensityRange{500, 900}, DensityRange{1000, 1000},
+                                         DensityRange{5000, 6000}}) {
+            assert(manager.CalculateHistoryDensityValues(window_us, range.min_pos_mm, range.max_pos_mm,
+                                                         &got.mean, &got.min, &got.median));
+            std::vector<int> matching;
+            int64_t sum = 0;
+            int min = INT_MAX;
+            for (const Kept& k : kept) {
+                if (k.time_us < kept.back().time_us - window_us || k.pos < range.min_pos_mm || k.pos > range.max_pos_mm) continue;
+                matching.push_back(k.density);
+                sum += k.density;
+                min = std::min(min, k.density);
+            }
+            if (matching.empty()) {
+                assert(got.mean == 0 && got.min == 0 && got.median == 0);
+                continue;
+            }
+            assert(got.mean == sum / static_cast<int64_t>(matching.size()) && got.min == min);
+            assert(got.median == MedianStrategy::compute(matching, MedianAlgorithm::NthElement));
+        }
+    }
+    assert(manager.HistorySamples() == kept.size());
+    assert(manager.HistoryBytes() < 4 * kept.size());
+
+    // Shortening the history drops whole blocks past it on the next samples
+    manager.EnableCompressedHistory(3'000'000);
+    for (int i = 20000; i < 21000; ++i) {
+        const int64_t time_us = int64_t(i) * 1000;
+        manager.MeasurePositionReady(i % 3000, time_us);
+        manager.MeasureDensityReady(7, time_us);
+    }
+    assert(manager.CalculateHistoryDensityValues(3'000'000, 0, 3000, &got.mean, &got.min, &got.median));
+    assert(manager.HistorySamples() >= 3001 && manager.HistorySamples() <= 3001 + CompressedHistory::BLOCK_SAMPLES);
+
+    // An unbounded history length keeps everything instead of overflowing the eviction cutoff
+    SensorDataManager unbounded;
+    unbounded.EnableCompressedHistory(INT64_MAX);
+    for (int i = 0; i < 5000; ++i) {
+        unbounded.MeasurePositionReady(i % 3000, int64_t(i) * 1000);
+        unbounded.MeasureDensityReady(i % 100, int64_t(i) * 1000);
+    }
+    assert(unbounded.CalculateHistoryDensityValues(INT64_MAX, 0, 3000, &got.mean, &got.min, &got.median));
+    assert(unbounded.HistorySamples() == 5000 && got.min == 0);
+}
+
+void verify_density_report(QueryEngine engine, QueryConcurrency concurrency) {
+    SensorDataManager manager(IngestMode::Locked, concurrency);
+    manager.SetQueryEngine(engine);
+    // Densities near 2^30, so the sum leaves 32-bit range; densities share the position timestamps,
+    // so every expected position is exact
+    std::vector<std::pair<int, int>> window;  // {position, density}
+    for (int i = 0; i < 4000; ++i) {
+        const int pos = i / 2;
+        const int density = 1'000'000'000 + (i * 7919) % 100'000;
+        manager.MeasurePositionReady(pos, int64_t(i) * 1000);
+        manager.MeasureDensityReady(density, int64_t(i) * 1000);
+        window.emplace_back(pos, density);
+    }
+
+    for (const DensityRange range : {DensityRange{0, 2000}, DensityRange{300, 700}, DensityRange{1999, 1999}, DensityRange{5000, 6000}}) {
+        const DensityReport report = manager.CalculateDensityReport(range.min_pos_mm, range.max_pos_mm, {90, 10, 50, 0, 100, 10});
+        std::vector<int> matching;
+        for (const auto& sample : window) {
+            if (sample.first >= range.min_pos_mm && sample.first <= range.max_pos_mm) matching.push_back(sample.second);
+        }
+        assert(report.percentile_count == 6);
+        if (matching.empty()) {
+            assert(report.count == 0 && report.sum == 0 && report.mean == 0 && report.max == 0 && report.percentiles[0] == 0);
+            continue;
+        }
+
+        std::sort(matching.begin(), matching.end());
+        const int64_t sum = std::accumulate(matching.begin(), matching.end(), int64_t(0));
+        const double mean = static_cast<double>(sum) / matching.size();
+        double squares = 0;
+        for (int density : matching) squares += (density - mean) * (density - mean);
+        const std::size_t n = matching.size();
+        auto percentile = [&](double p) { return matching[std::min(static_cast<std::size_t>(p * n / 100), n - 1)]; };
+
+        assert(report.count == static_cast<int>(n) && report.sum == sum && report.mean == mean);
+        assert(report.min == matching.front() && report.max == matching.back() && report.median == matching[n / 2]);
+        assert(std::abs(report.variance - squares / n) <= 1e-6 * (squares / n) + 1e-9);
+        assert(report.percentiles[0] == percentile(90) && report.percentiles[1] == percentile(10) &&
+               report.percentiles[2] == report.median && report.percentiles[3] == report.min &&
+               report.percentiles[4] == report.max && report.percentiles[5] == percentile(10));
+
+        DensityStats stats;
+        manager.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &stats.mean, &stats.min, &stats.median);
+        assert(stats.mean == sum / static_cast<int64_t>(n) && stats.min == report.min && stats.median == report.median);
+    }
+
+    bool rejected = false;
+    try {
+        manager.CalculateDensityReport(0, 100, {101});
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    assert(rejected);
+}
+
+void verify_parallel_queries(QueryEngine engine, QueryConcurrency concurrency, WorkerPool& pool) {
+    SensorDataManager serial(IngestMode::Locked, concurrency), parallel(IngestMode::Locked, concurrency);
+    serial.SetQueryEngine(engine);
+    parallel.SetQueryEngine(engine);
+    parallel.SetParallelQueries(&pool, 1);
+
+    // 6 s at 18 kHz: about 90000 samples (three chunks) in the window. The board reverses, so
+    // RangeSearch scans too. Positions 1000-1200 carry a narrow density spread, selected bucket by value.
+    for (int i = 0; i < 108000; ++i) {
+        const int64_t time_us = int64_t(i) * 1'000'000 / 18'000;
+        const int density = i >= 40000 && i < 48000 ? 500 + (i * 7919) % 300 : (i * 7919) % 4'000'000 - 1000;
+        for (SensorDataManager* target : {&serial, &parallel}) {
+            target->MeasureDensityReady(density, time_us);
+            if (i % 4 == 0) target->MeasurePositionReady(i < 80000 ? i / 40 : 4000 - i / 40, time_us);
+        }
+    }
+    const DensityRange ranges[] = {{1000, 1190}, {1950, 1952}, {0, 4000}, {900, 1500}, {7000, 8000}};
+    for (const DensityRange& range : ranges) {
+        DensityStats want, got;
+        serial.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &want.mean, &want.min, &want.median);
+        parallel.CalculateDensityValues(range.min_pos_mm, range.max_pos_mm, &got.mean, &got.min, &got.median);
+        assert(got.mean == want.mean && got.min == want.min && got.median == want.median);
+    }
+}
+
+void verify_density_profile(QueryEngine engine, QueryConcurrency concurrency) {
+    // One-shot resampling matches one CalculateDensityValues call per millimetre
+    SensorDataManager manager(IngestMode::Locked, concurrency);
+    manager.SetQueryEngine(engine);
+    for (int i = 0; i <= 6000; ++i) {
+        manager.MeasureDensityReady((i * 7919) % 200, int64_t(i) * 1000);
+        if (i % 5 == 0) manager.MeasurePositionReady(i < 4000 ? i / 4 : 2000 - i / 4, int64_t(i) * 1000);
+    }
+    const int first_mm = 150;
+    const std::size_t cells = 1000;
+    std::vector<int> means(cells), mins(cells), counts(cells);
+    manager.ResampleDensityProfile(first_mm, cells, means.data(), mins.data(), counts.data());
+    int total = 0;
+    for (std::size_t c = 0; c < cells; ++c) {
+        DensityStats want;
+        const int pos = first_mm + static_cast<int>(c);
+        manager.CalculateDensityValues(pos, pos, &want.mean, &want.min, &want.median);
+        assert(means[c] == want.mean && mins[c] == want.min);
+        if (counts[c] == 0) assert(means[c] == 0 && mins[c] == 0);
+        total += counts[c];
+    }
+    assert(total > 0);
+}
+
+void verify_tracked_profile() {
+    // A tracked profile keeps every resolved sample, including those that left the 5 s window
+    SensorDataManager manager;
+    const std::size_t cells = 2500;
+    const int profile = manager.TrackDensityProfile(0, cells);
+    std::vector<int> means(cells, -1), mins(cells, -1), counts(cells, -1);
+    std::vector<int64_t> sums(cells, 0);
+    std::vector<int> expected_counts(cells, 0), expected_mins(cells, INT_MAX);
+
+    ProfileCells written = manager.UpdateDensityProfile(profile, means.data(), mins.data(), counts.data());
+    assert(written.first_cell == 0 && written.end_cell == cells && counts[0] == 0 && means[cells - 1] == 0);
+    for (int i = 0; i < 9000; ++i) {
+        const int pos = i / 4;
+        const int density = (i * 7919) % 500;
+        manager.MeasurePositionReady(pos, int64_t(i) * 1000);
+        manager.MeasureDensityReady(density, int64_t(i) * 1000);
+        sums[pos] += density;
+        ++expected_counts[pos];
+        expected_mins[pos] = std::min(expected_mins[pos], density);
+
+        if (i % 3000 != 2999) continue;
+        written = manager.UpdateDensityProfile(profile, means.data(), mins.data(), counts.data());
+        // Only the cells the board moved over since the last update
+        assert(written.first_cell == static_cast<std::size_t>((i - 2999) / 4) && written.end_cell == static_cast<std::size_t>(pos + 1));
+        for (std::size_t c = 0; c < cells; ++c) {
+            const int count = expected_counts[c];
+            assert(counts[c] == count && means[c] == (count ? sums[c] / count : 0) && mins[c] == (count ? expected_mins[c] : 0));
+        }
+    }
+    written = manager.UpdateDensityProfile(profile, means.data());
+    assert(written.first_cell == written.end_cell);
+    manager.UntrackDensityProfile(profile);
+    written = manager.UpdateDensityProfile(profile, means.data());
+    assert(written.first_cell == 0 && written.end_cell == 0);
+}
+
 int main() {
-    std::thread t1(simulate_density_input);
-    std::thread t2(simulate_position_input);
-    std::thread t3(simulate_query);
+    verify_density_kernels();
+    verify_metrics();
+    verify_async_queries(QueryConcurrency::Exclusive);
+    verify_async_queries(QueryConcurrency::Snapshot);
+    verify_async_callback_waits();
+    verify_standing_queries(MedianAlgorithm::OrderStatistic);
+    verify_standing_queries(MedianAlgorithm::HeapMedian);
+    verify_capture_file();
+    verify_record_replay();
+    verify_record_accepted_only();
+    verify_record_order(IngestMode::Locked);
+    verify_record_order(IngestMode::LockFree);
+    verify_recording_write_failure();
+    verify_compressed_history();
+    for (QueryEngine engine : {QueryEngine::BinarySearch, QueryEngine::Precomputed, QueryEngine::ZoneMap}) {
+        verify_density_profile(engine, QueryConcurrency::Exclusive);
+    }
+    verify_density_profile(QueryEngine::MergeJoin, QueryConcurrency::Snapshot);
+    verify_tracked_profile();
+    for (QueryEngine engine : {QueryEngine::BinarySearch, QueryEngine::RangeSearch, QueryEngine::Precomputed,
+                               QueryEngine::Indexed, QueryEngine::ZoneMap}) {
+        verify_density_report(engine, QueryConcurrency::Exclusive);
+    }
+    verify_density_report(QueryEngine::MergeJoin, QueryConcurrency::Snapshot);
+    {
+        WorkerPool pool(3);
+        for (QueryEngine engine : {QueryEngine::BinarySearch, QueryEngine::RangeSearch, QueryEngine::Precomputed}) {
+            verify_parallel_queries(engine, QueryConcurrency::Exclusive, pool);
+        }
+        verify_parallel_queries(QueryEngine::MergeJoin, QueryConcurrency::Snapshot, pool);
+    }
+    for (QueryEngine engine : {QueryEngine::BinarySearch, QueryEngine::MergeJoin, QueryEngine::RangeSearch,
+                               QueryEngine::Precomputed, QueryEngine::Indexed, QueryEngine::ZoneMap}) {
+        for (MedianAlgorithm algorithm : {MedianAlgorithm::NthElement, MedianAlgorithm::FullSort,
+                                          MedianAlgorithm::HeapMedian, MedianAlgorithm::Histogram}) {
+            verify_query_allocations(engine, QueryConcurrency::Exclusive, algorithm);
+            verify_query_allocations(engine, QueryConcurrency::Snapshot, algorithm);
+        }
+    }
+    verify_sharded_manager();
+    verify_board_segmentation(IngestMode::Locked, nullptr);
+    {
+        WorkerPool pool(1);
+        verify_board_segmentation(IngestMode::LockFree, &pool);
+    }
+    verify_truncated_board();
+    verify_precomputed_engine(QueryEngine::Precomputed);
+    verify_precomputed_engine(QueryEngine::Indexed);
+    verify_precomputed_engine(QueryEngine::ZoneMap);
+    verify_compact_manager();
+    verify_wide_timestamps();
+    verify_snapshot_queries();
+    verify_batch_ingest();
+    verify_batch_query();
+    verify_median_strategies();
+    verify_registered_range(MedianAlgorithm::OrderStatistic);
+    verify_registered_range(MedianAlgorithm::HeapMedian);
+
+    std::thread t1(simulate_density_input, std::ref(manager));
+    std::thread t2(simulate_position_input, std::ref(manager));
+    std::thread t3(simulate_query, std::ref(manager));
+
+    // Same traffic through the wait-free ingest rings
+    std::thread t4(simulate_density_input, std::ref(lock_free_manager));
+    std::thread t5(simulate_position_input, std::ref(lock_free_manager));
+    std::thread t6(simulate_query, std::ref(lock_free_manager));
 
     t1.join();
     t2.join();
     t3.join();
-}
\ No newline at end of file
+    t4.join();
+    t5.join();
+    t6.join();
+}